@@ -1,3 +1,7 @@
 C:\VulkanSDK\1.2.198.1\Bin\glslc.exe shaders\simple_shader.vert -o shaders\simple_shader.vert.spv
 C:\VulkanSDK\1.2.198.1\Bin\glslc.exe shaders\simple_shader.frag -o shaders\simple_shader.frag.spv
+C:\VulkanSDK\1.2.198.1\Bin\glslc.exe shaders\simple_shader_instanced.vert -o shaders\simple_shader_instanced.vert.spv
+C:\VulkanSDK\1.2.198.1\Bin\glslc.exe shaders\cull.comp -o shaders\cull.comp.spv
+C:\VulkanSDK\1.2.198.1\Bin\glslc.exe shaders\simple_shader_bindless.frag -o shaders\simple_shader_bindless.frag.spv
+C:\VulkanSDK\1.2.198.1\Bin\glslc.exe shaders\simple_shader_push.vert -o shaders\simple_shader_push.vert.spv
 pause
\ No newline at end of file
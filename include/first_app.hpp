@@ -1,11 +1,24 @@
 #pragma once
 
+#include "vk_bindless.hpp"
+#include "vk_culling.hpp"
 #include "vk_device.hpp"
+#include "vk_engine_config.hpp"
+#include "vk_frame_pacer.hpp"
+#include "vk_gpu_scene.hpp"
+#include "vk_parallel_recorder.hpp"
 #include "vk_pipeline.hpp"
+#include "vk_profiler.hpp"
+#include "vk_scene.hpp"
+#include "vk_shader_watcher.hpp"
 #include "vk_swap_chain.hpp"
+#include "vk_thread_pool.hpp"
+#include "vk_upload_manager.hpp"
 #include "vk_window.hpp"
 
+#include <cmath>
 #include <iostream>
+#include <random>
 #include <vulkan/vulkan.h>
 
 namespace ve {
@@ -14,27 +27,114 @@ public:
   static const int WIDTH = 800;
   static const int HEIGHT = 600;
 
-  int currentFrame = 0;
+  // Frames timed per draw mode by --bench-instancing, after a warm up
+  static const uint32_t BENCH_FRAMES = 300;
+  static const uint32_t BENCH_WARMUP_FRAMES = 30;
 
-  VkWindow vkWindow{WIDTH, HEIGHT, "First Vulkan"};
+  // Culls per kernel timed by --bench-culling
+  static const uint32_t BENCH_CULL_REPEATS = 50;
+
+  // How the copies of the model are turned into draws
+  enum class DrawMode {
+    // One draw and one uniform per copy
+    Uniforms,
+    // One draw per copy reading its InstanceData, only for benchmarking
+    SeparateInstances,
+    // One draw per copy with its model matrix pushed, one shared uniform
+    PushConstants,
+    // A single instanced draw for all copies
+    Instanced,
+    // The GPU scene, culled by a compute pass and drawn indirectly
+    GpuCulled
+  };
+
+  // Generated textures added to the bindless array next to the model's
+  static const uint32_t BINDLESS_CHECKER_TEXTURES = 7;
+
+  // Distance between neighbouring objects of the GPU scene grid
+  static constexpr float GPU_SCENE_SPACING = 3.0f;
+
+  // Copies along a row parented to the first of them, see createCopyScene
+  static const uint32_t COPY_GROUP_SIZE = 4;
+
+  // Has to be declared first so the members below can be built from it
+  EngineConfig config;
+
+  VkWindow vkWindow{WIDTH, HEIGHT, "First Vulkan", config.headless};
 
   VkEngineDevice vkEngineDevice{vkWindow};
 
-  VkModel vkModel{vkEngineDevice};
+  VkEngineUploadManager vkUploadManager{vkEngineDevice};
+
+  VkEngineProfiler vkProfiler{vkEngineDevice};
+
+  VkEngineThreadPool vkThreadPool{config.recordThreads};
+
+  VkEngineParallelRecorder vkParallelRecorder{vkEngineDevice, vkThreadPool};
+
+  VkEngineCuller vkCuller{vkThreadPool};
+
+  VkEngineScene vkScene{vkThreadPool};
+
+  VkModel vkModel{vkEngineDevice, vkUploadManager};
 
-  VkEngineSwapChain vkEngineSwapChain{vkEngineDevice, vkModel};
+  VkEngineGpuScene vkGpuScene{vkEngineDevice, vkUploadManager, vkModel};
+
+  VkEngineSwapChain vkEngineSwapChain{vkEngineDevice, vkModel,
+                                      config.presentMode,
+                                      config.swapChainImages};
+
+  VkEngineBindlessTextures vkBindless{vkEngineDevice, vkUploadManager};
+
+  VkEngineFramePacer vkFramePacer{vkEngineDevice, vkEngineSwapChain,
+                                  config.serializeFrames};
 
   VkEnginePipeline vkEnginePipeline{
       vkEngineDevice,
       vkEngineSwapChain,
-      VkEnginePipeline::defaultPipelineConfigInfo(WIDTH, HEIGHT),
-      "shaders/simple_shader.vert.spv",
-      "shaders/simple_shader.frag.spv",
-      vkModel};
+      VkEnginePipeline::defaultPipelineConfigInfo(),
+      "shaders/simple_shader.vert",
+      "shaders/simple_shader.frag",
+      vkModel,
+      vkProfiler,
+      vkParallelRecorder,
+      vkGpuScene,
+      vkBindless};
+
+  // Declared after the pipeline so it's stopped before the pipeline its
+  // thread builds into goes away. Only started with --hot-reload
+  VkEngineShaderWatcher vkShaderWatcher;
 
   bool frameBufferResized = false;
 
-  FirstApp();
+  // Filled in by updateUniformBuffer and recorded into this frame's commands
+  std::vector<DrawCall> drawCalls;
+  // Only used in DrawMode::GpuCulled
+  GpuSceneDraw gpuSceneDraw{};
+
+  DrawMode drawMode = DrawMode::Uniforms;
+  // Copies of the model drawn each frame
+  uint32_t drawCount = 1;
+
+  // CPU time spent filling uniforms and recording the last frame
+  double lastRecordMs = 0.0;
+
+  // Bindless slots the copies cycle through, empty unless --bindless
+  std::vector<uint32_t> materialTextures;
+
+  // One scene entity per copy of the model, visibleCopies indexes into it
+  std::vector<SceneEntity> copyEntities;
+  // Index of the copy each copy's group hangs off, its own for the leaders
+  std::vector<uint32_t> copyLeaders;
+  // Group leaders turned every frame, the rest of the scene stays put
+  std::vector<SceneEntity> spinningLeaders;
+
+  // Copies the culler currently holds bounds for
+  uint32_t culledCopyCount = 0;
+  // Copies drawn this frame, all of them unless culling on the CPU
+  std::vector<uint32_t> visibleCopies;
+
+  FirstApp(EngineConfig engineConfig);
   ~FirstApp();
 
   // deleting copy constructors
@@ -42,10 +142,24 @@ public:
   void operator=(const FirstApp &) = delete;
 
   void run();
+  void runHeadless();
+  void runInstancingBenchmark();
+  void benchmarkDrawMode(DrawMode mode, const char *name);
+  void runCullingBenchmark();
 
   void drawFrame();
+  // Latest GPU time of a whole frame from the profiler, 0 until known
+  double gpuFrameMs() const;
+  void configureFramePacing();
+
+  void createBindlessTextures();
+  uint32_t materialTexture(uint32_t index) const;
+  void createGpuScene();
+  void createCopyScene();
 
-  void updateUniformBuffer(uint32_t currentImage);
+  void updateUniformBuffer(uint32_t frameIndex);
+  void updateGpuScene(uint32_t frameIndex, float time, float aspect);
+  void updateVisibleCopies(const glm::mat4 &viewProj);
   static void framebufferResizeCallback(GLFWwindow *window, int width,
                                         int height);
 };
@@ -3,7 +3,9 @@
 
 #include <cstdlib>
 #include <iostream>
+#include <limits>
 #include <stdexcept>
+#include <string>
 
 // for loading stb image function objs
 #define STB_IMAGE_IMPLEMENTATION
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace ve {
+
+class VkEngineMemoryBlock;
+
+// A piece of a larger VkDeviceMemory block handed out by VkEngineAllocator.
+// Bind resources with memory + offset, never at offset 0 of memory
+struct VkEngineAllocation {
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size = 0;
+
+  // Host visible blocks stay mapped for their whole lifetime, this points at
+  // offset inside that mapping. nullptr for device local memory
+  void *mappedData = nullptr;
+
+  VkEngineMemoryBlock *block = nullptr;
+};
+
+// One vkAllocateMemory call that gets carved up into many allocations
+class VkEngineMemoryBlock {
+public:
+  struct FreeRange {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+  };
+
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize size = 0;
+  uint32_t memoryTypeIndex = 0;
+  void *mappedData = nullptr;
+
+  // Sorted by offset, neighbouring ranges are always merged on free
+  std::vector<FreeRange> freeRanges;
+  uint32_t allocationCount = 0;
+
+  bool allocate(VkDeviceSize allocSize, VkDeviceSize alignment,
+                VkDeviceSize &outOffset);
+  void free(VkDeviceSize offset, VkDeviceSize allocSize);
+};
+
+// Engine wide device memory allocator owned by VkEngineDevice.
+// Instead of one vkAllocateMemory per resource (which quickly runs into
+// maxMemoryAllocationCount, and is slow in the driver) memory is grabbed in
+// large blocks per memory type and sub allocated with a first fit free list.
+//
+// bufferImageGranularity: linear resources (buffers) and optimal tiling images
+// are kept in separate blocks, so they can never end up on the same
+// granularity "page" and aliasing rules are satisfied without extra padding
+class VkEngineAllocator {
+public:
+  static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull * 1024 * 1024;
+
+  VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+  VkDevice logicalDevice = VK_NULL_HANDLE;
+
+  // Queried once, findMemoryType used to ask the driver on every call
+  VkPhysicalDeviceMemoryProperties memProperties{};
+  VkDeviceSize bufferImageGranularity = 1;
+
+  // [memoryTypeIndex][0 = linear, 1 = optimal image]
+  std::vector<std::unique_ptr<VkEngineMemoryBlock>> blocks[VK_MAX_MEMORY_TYPES]
+                                                          [2];
+
+  // (typeFilter << 32 | properties) -> memory type index
+  std::unordered_map<uint64_t, uint32_t> memoryTypeCache;
+
+  std::mutex allocatorMutex;
+
+  // Buffers created with TRANSFER_DST usage are shared CONCURRENT between
+  // these families when there is more than one (see
+  // VkEngineDevice::uploadQueueFamilies)
+  std::vector<uint32_t> concurrentQueueFamilies;
+
+  // Stats
+  uint32_t deviceMemoryAllocations = 0;
+  uint32_t liveAllocations = 0;
+
+  VkEngineAllocator() = default;
+  ~VkEngineAllocator() = default;
+
+  // deleting copy constructors
+  VkEngineAllocator(const VkEngineAllocator &) = delete;
+  void operator=(const VkEngineAllocator &) = delete;
+
+  void init(VkPhysicalDevice physical, VkDevice device);
+  void cleanup();
+
+  uint32_t findMemoryType(uint32_t typeFilter,
+                          VkMemoryPropertyFlags properties);
+
+  VkEngineAllocation allocate(const VkMemoryRequirements &memRequirements,
+                              VkMemoryPropertyFlags properties, bool linear);
+  void free(VkEngineAllocation &allocation);
+
+  void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+                    VkMemoryPropertyFlags properties, VkBuffer &buffer,
+                    VkEngineAllocation &allocation);
+  void destroyBuffer(VkBuffer buffer, VkEngineAllocation &allocation);
+
+  void createImage(const VkImageCreateInfo &imageInfo,
+                   VkMemoryPropertyFlags properties, VkImage &image,
+                   VkEngineAllocation &allocation);
+  void destroyImage(VkImage image, VkEngineAllocation &allocation);
+
+  void printStats();
+};
+
+} // namespace ve
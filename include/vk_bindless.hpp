@@ -0,0 +1,82 @@
+#pragma once
+
+#include "vk_device.hpp"
+#include "vk_upload_manager.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace ve {
+
+// One descriptor set holding every texture the instanced draws can sample,
+// as a single array of combined image samplers. Materials pick their texture
+// by index (InstanceData::textureIndex) instead of by binding a set, so
+// copies with different textures can share one draw and nothing is rebound
+// when the texture changes.
+//
+// The array is partially bound and update after bind, using the descriptor
+// indexing features of Vulkan 1.2: slots that are never used don't need a
+// valid descriptor, and new textures can be added while the set is bound by
+// frames still in flight, as long as those frames don't read the new slots.
+//
+// Bound as set 1 by VkEnginePipeline's bindless pipeline. Everything stays
+// VK_NULL_HANDLE when the device lacks the features (see enabled())
+class VkEngineBindlessTextures {
+public:
+  // Size of the array. Far below the 500000 update after bind samplers every
+  // descriptor indexing device has to support, so no limit is queried
+  static const uint32_t MAX_TEXTURES = 1024;
+
+  // A texture this class created, and has to destroy
+  struct OwnedTexture {
+    VkImage image;
+    VkEngineAllocation memory;
+    VkImageView view;
+  };
+
+  VkEngineDevice &engineDevice;
+  VkEngineUploadManager &uploadManager;
+
+  VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+  // Used for the textures created by createCheckerTexture
+  VkSampler sampler = VK_NULL_HANDLE;
+  std::vector<OwnedTexture> ownedTextures;
+
+  // Slots written so far, the next texture goes into slot textureCount
+  uint32_t textureCount = 0;
+
+  VkEngineBindlessTextures(VkEngineDevice &eDevice,
+                           VkEngineUploadManager &uploader);
+  ~VkEngineBindlessTextures();
+
+  // deleting copy constructors
+  VkEngineBindlessTextures(const VkEngineBindlessTextures &) = delete;
+  void operator=(const VkEngineBindlessTextures &) = delete;
+
+  bool enabled() const;
+
+  // Writes view into the next free slot and returns its index. view has to
+  // be in SHADER_READ_ONLY_OPTIMAL and outlive every draw that samples it
+  uint32_t addTexture(VkImageView view, VkSampler viewSampler);
+
+  // Creates and uploads a size x size checkerboard of two colors, then adds
+  // it. The upload is flushed, the next graphics submit waits for it
+  uint32_t createCheckerTexture(uint32_t size, const glm::vec4 &colorA,
+                                const glm::vec4 &colorB);
+
+private:
+  void createDescriptorSetLayout();
+  void createDescriptorSet();
+  void createSampler();
+};
+
+} // namespace ve
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "vk_thread_pool.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VE_CULLING_X86 1
+#endif
+
+namespace ve {
+
+// World space bounds of one object. Both volumes share the centre, an object
+// is culled when either of them is entirely outside a frustum plane
+struct CullBounds {
+  glm::vec3 center;
+  float radius;
+  // Half size of the axis aligned box
+  glm::vec3 extents;
+};
+
+// Frustum culling for objects that are drawn from the CPU.
+//
+// Bounds are kept as structure of arrays, one float array per component, so
+// a SIMD kernel can load the same component of 8 (AVX2) or 4 (SSE) objects
+// with one instruction and test them against a plane at once. The arrays are
+// padded to a multiple of LANES with objects that are always culled, so the
+// kernels never need a scalar tail.
+//
+// Large object counts are split into ranges that are culled on the worker
+// threads, each range collecting its visible indices separately so nothing
+// is shared between tasks
+class VkEngineCuller {
+public:
+  enum class Kernel { Scalar, Sse, Avx2 };
+
+  // Widest kernel, the arrays are padded to this many objects
+  static const uint32_t LANES = 8;
+  // Below this many objects threading costs more than it saves
+  static const uint32_t PARALLEL_MIN_OBJECTS = 16384;
+  // Objects per task when culling in parallel, multiple of LANES
+  static const uint32_t TASK_OBJECTS = 4096;
+
+  VkEngineThreadPool &threadPool;
+
+  uint32_t objectCount = 0;
+  std::vector<float> centerX;
+  std::vector<float> centerY;
+  std::vector<float> centerZ;
+  std::vector<float> radius;
+  std::vector<float> extentX;
+  std::vector<float> extentY;
+  std::vector<float> extentZ;
+
+  // Best kernel the CPU supports, used by cull
+  Kernel kernel = Kernel::Scalar;
+
+  // Visible indices of every task of the last cull
+  std::vector<std::vector<uint32_t>> taskVisible;
+
+  VkEngineCuller(VkEngineThreadPool &pool);
+
+  // deleting copy constructors
+  VkEngineCuller(const VkEngineCuller &) = delete;
+  void operator=(const VkEngineCuller &) = delete;
+
+  void setObjects(const std::vector<CullBounds> &bounds);
+  void setObject(uint32_t index, const CullBounds &bounds);
+
+  // Fills visible with the indices of the objects inside the frustum of
+  // viewProj, in ascending order, and returns how many there are
+  uint32_t cull(const glm::mat4 &viewProj, std::vector<uint32_t> &visible);
+
+  // Same with an explicit kernel and threading, for benchmarking
+  uint32_t cullWith(Kernel cullKernel, const glm::vec4 planes[6],
+                    bool parallel, std::vector<uint32_t> &visible);
+
+  // Planes of the frustum of viewProj, xyz normal pointing into the frustum
+  // and w distance, normalized so distances are in world units
+  static void extractFrustumPlanes(const glm::mat4 &viewProj,
+                                   glm::vec4 planes[6]);
+
+  static bool kernelSupported(Kernel cullKernel);
+  static const char *kernelName(Kernel cullKernel);
+
+private:
+  // Appends the visible objects of [first, first + count) to visible, count
+  // is a multiple of LANES
+  void cullRange(Kernel cullKernel, const glm::vec4 planes[6], uint32_t first,
+                 uint32_t count, std::vector<uint32_t> &visible) const;
+  void cullRangeScalar(const glm::vec4 planes[6], uint32_t first,
+                       uint32_t count, std::vector<uint32_t> &visible) const;
+#ifdef VE_CULLING_X86
+  void cullRangeSse(const glm::vec4 planes[6], uint32_t first, uint32_t count,
+                    std::vector<uint32_t> &visible) const;
+  void cullRangeAvx2(const glm::vec4 planes[6], uint32_t first,
+                     uint32_t count, std::vector<uint32_t> &visible) const;
+#endif
+};
+
+} // namespace ve
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "vk_allocator.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <vulkan/vulkan.h>
+
+namespace ve {
+
+// Destroys GPU objects once the work that last used them has retired, so
+// replacing something doesn't need a vkDeviceWaitIdle first.
+//
+// Every deletion is tagged with either the frame being recorded when it was
+// pushed (frameSerial), or a timeline semaphore value like the ones
+// VkEngineUploadManager::flush() returns. The frame pacer reports the serial
+// of every frame whose fence it waited on through collect(), frames are
+// submitted to one queue in order, so everything tagged up to that serial is
+// done with. Owned by VkEngineDevice, cleanup() runs whatever is left once
+// the device is idle. Not thread safe, push from the render thread
+class VkEngineDeletionQueue {
+public:
+  struct Deletion {
+    // VK_NULL_HANDLE for frame tagged deletions
+    VkSemaphore timeline;
+    // Frame serial, or the value timeline has to reach
+    uint64_t value;
+    std::function<void()> destroy;
+  };
+
+  VkDevice logicalDevice = VK_NULL_HANDLE;
+  VkEngineAllocator *allocator = nullptr;
+
+  // Serial of the frame being recorded, advanced by the frame pacer. Starts
+  // at 1 so 0 can mean no frame submitted yet
+  uint64_t frameSerial = 1;
+  // Highest serial known to be finished on the GPU
+  uint64_t completedSerial = 0;
+
+  // Frame tagged deletions are pushed with a rising serial, so only the
+  // front ever needs checking
+  std::deque<Deletion> frameDeletions;
+  std::deque<Deletion> timelineDeletions;
+
+  // Stats
+  uint64_t pushed = 0;
+  uint64_t destroyed = 0;
+
+  VkEngineDeletionQueue() = default;
+  ~VkEngineDeletionQueue() = default;
+
+  // deleting copy constructors
+  VkEngineDeletionQueue(const VkEngineDeletionQueue &) = delete;
+  void operator=(const VkEngineDeletionQueue &) = delete;
+
+  void init(VkDevice device, VkEngineAllocator &memoryAllocator);
+  // The device has to be idle, everything still queued is destroyed
+  void cleanup();
+
+  // destroy runs once the frame being recorded and every earlier one are done
+  void push(std::function<void()> destroy);
+  // destroy runs once timeline reaches value
+  void pushAfterTimeline(VkSemaphore timeline, uint64_t value,
+                         std::function<void()> destroy);
+
+  // Frame tagged shorthands for the most common objects
+  void destroyBuffer(VkBuffer buffer, VkEngineAllocation allocation);
+  void destroyImage(VkImage image, VkEngineAllocation allocation);
+  void destroyImageView(VkImageView imageView);
+  void destroyPipeline(VkPipeline pipeline);
+
+  // Every frame up to finishedSerial is done on the GPU, runs what that
+  // frees and polls the timeline deletions
+  void collect(uint64_t finishedSerial);
+
+private:
+  void runFront(std::deque<Deletion> &deletions);
+};
+
+} // namespace ve
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace ve {
+
+// Hands out descriptor sets from a list of pools that grows on demand, so
+// there's no fixed limit on how many sets can exist.
+//
+// Allocation is from the current pool until the driver reports it full
+// (VK_ERROR_OUT_OF_POOL_MEMORY or VK_ERROR_FRAGMENTED_POOL). That pool is
+// then retired to fullPools and the next one comes from readyPools, or is
+// created with twice the sets of the last one (up to MAX_SETS_PER_POOL).
+// Every allocation is at most one failed and one successful
+// vkAllocateDescriptorSets, and pool creation gets rarer as pools grow, so
+// the cost per set is amortized O(1).
+//
+// Sets are never freed one by one. reset() hands every set back at once
+// with one vkResetDescriptorPool per pool and keeps the pools for reuse,
+// which makes it a cheap per frame allocator when there's one per frame in
+// flight. Not thread safe, use one per thread
+class VkEngineDescriptorAllocator {
+public:
+  // Descriptors of type per set a pool is sized for
+  struct PoolSizeRatio {
+    VkDescriptorType type;
+    float ratio;
+  };
+
+  static const uint32_t MAX_SETS_PER_POOL = 4096;
+
+  VkDevice logicalDevice = VK_NULL_HANDLE;
+  std::vector<PoolSizeRatio> ratios;
+  // Sets the next created pool holds
+  uint32_t setsPerPool = 0;
+
+  VkDescriptorPool currentPool = VK_NULL_HANDLE;
+  // Emptied by reset(), reused before any new pool is created
+  std::vector<VkDescriptorPool> readyPools;
+  // Ran out of space since the last reset()
+  std::vector<VkDescriptorPool> fullPools;
+
+  // Stats, pool churn is poolsFilled against poolsCreated
+  uint64_t setsAllocated = 0;
+  uint32_t poolsCreated = 0;
+  uint32_t poolsFilled = 0;
+  uint32_t resets = 0;
+
+  VkEngineDescriptorAllocator() = default;
+  ~VkEngineDescriptorAllocator() = default;
+
+  // deleting copy constructors
+  VkEngineDescriptorAllocator(const VkEngineDescriptorAllocator &) = delete;
+  void operator=(const VkEngineDescriptorAllocator &) = delete;
+
+  void init(VkDevice device, uint32_t initialSetsPerPool,
+            const std::vector<PoolSizeRatio> &poolRatios);
+  void cleanup();
+
+  VkDescriptorSet allocate(VkDescriptorSetLayout layout);
+  // Every set allocated so far becomes invalid, the GPU can't be using any
+  void reset();
+
+  void report(const char *name);
+
+private:
+  VkDescriptorPool grabPool();
+  VkDescriptorPool createPool(uint32_t setCount);
+};
+
+// Creates each distinct descriptor set layout once. Layouts are looked up by
+// their create flags and bindings, so every module can describe the layout
+// it needs without coordinating who owns it. They're all destroyed in
+// cleanup(), callers never destroy them
+class VkEngineDescriptorLayoutCache {
+public:
+  struct LayoutBinding {
+    uint32_t binding;
+    VkDescriptorType type;
+    uint32_t count;
+    VkShaderStageFlags stages;
+    // From a chained VkDescriptorSetLayoutBindingFlagsCreateInfo, 0 if none
+    VkDescriptorBindingFlags bindingFlags;
+
+    bool operator==(const LayoutBinding &other) const;
+  };
+
+  struct LayoutKey {
+    VkDescriptorSetLayoutCreateFlags flags;
+    // Sorted by binding, so the order they were declared in doesn't matter
+    std::vector<LayoutBinding> bindings;
+
+    bool operator==(const LayoutKey &other) const;
+  };
+
+  struct LayoutKeyHash {
+    size_t operator()(const LayoutKey &key) const;
+  };
+
+  VkDevice logicalDevice = VK_NULL_HANDLE;
+  std::unordered_map<LayoutKey, VkDescriptorSetLayout, LayoutKeyHash> layouts;
+
+  // Stats
+  uint32_t hits = 0;
+  uint32_t misses = 0;
+
+  VkEngineDescriptorLayoutCache() = default;
+  ~VkEngineDescriptorLayoutCache() = default;
+
+  // deleting copy constructors
+  VkEngineDescriptorLayoutCache(const VkEngineDescriptorLayoutCache &) =
+      delete;
+  void operator=(const VkEngineDescriptorLayoutCache &) = delete;
+
+  void init(VkDevice device);
+  void cleanup();
+
+  // Returns the cached layout equal to layoutInfo, creating it on the first
+  // request. The only pNext understood is
+  // VkDescriptorSetLayoutBindingFlagsCreateInfo, immutable samplers aren't
+  // supported
+  VkDescriptorSetLayout createLayout(
+      const VkDescriptorSetLayoutCreateInfo &layoutInfo);
+};
+
+} // namespace ve
@@ -6,10 +6,16 @@
 
 #include <GLFW/glfw3.h>
 #include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <optional>
 #include <set>
 #include <string>
 #include <vector>
+#include <vk_allocator.hpp>
+#include <vk_deletion_queue.hpp>
+#include <vk_descriptors.hpp>
+#include <vk_shader_cache.hpp>
 #include <vk_window.hpp>
 
 #include <algorithm> // Necessary for std::clamp
@@ -20,6 +26,9 @@ namespace ve {
 struct QueueFamilyIndices {
   std::optional<uint32_t> graphicsFamily;
   std::optional<uint32_t> presentFamily;
+  // A transfer only family if the device has one (DMA engine), otherwise the
+  // graphics family
+  std::optional<uint32_t> transferFamily;
 };
 
 struct SwapChainSupportDetails {
@@ -33,7 +42,11 @@ public:
   VkWindow &vkWindow;
   VkInstance instance;
 
-  VkSurfaceKHR surface;
+  // Stays VK_NULL_HANDLE when running headless
+  VkSurfaceKHR surface = VK_NULL_HANDLE;
+
+  // No surface, swapchain or presentation, render to offscreen images only
+  bool headless = false;
 
   static const int MAX_FRAMES_IN_FLIGHT = 3;
   // actual physical device
@@ -46,11 +59,70 @@ public:
 
   VkQueue graphicsQueue;
   VkQueue presentQueue;
+  // Same queue as graphicsQueue when there is no separate transfer family
+  VkQueue transferQueue;
+
+  uint32_t graphicsFamilyIndex = 0;
+  uint32_t transferFamilyIndex = 0;
+  // Image copies on the transfer family have to line up with this, (0,0,0)
+  // means only whole mip levels can be copied. Always (1,1,1) for graphics
+  VkExtent3D transferImageGranularity = {1, 1, 1};
+
+  // Families that resources written by the upload manager are shared between.
+  // Has two entries when uploads run on a separate transfer family, then those
+  // resources are created VK_SHARING_MODE_CONCURRENT so no queue family
+  // ownership transfer is needed
+  std::vector<uint32_t> uploadQueueFamilies;
 
   VkDebugUtilsMessengerEXT debugMessenger;
 
   VkCommandPool commandPool;
 
+  // Every buffer and image gets its memory from here
+  VkEngineAllocator allocator;
+  // Objects that can still be in use by frames in flight or uploads are
+  // destroyed through here instead of after a vkDeviceWaitIdle
+  VkEngineDeletionQueue deletionQueue;
+
+  // Descriptor sets that live as long as what they point at, and the layouts
+  // of every set, shared by all modules
+  VkEngineDescriptorAllocator descriptorAllocator;
+  VkEngineDescriptorLayoutCache layoutCache;
+
+  // Every shader module, compiled (or loaded) once and shared by all
+  // pipelines that use it
+  VkEngineShaderCache shaderCache;
+
+  // Shared by every vkCreate*Pipelines call. Loaded from pipelineCachePath at
+  // startup and written back on shutdown so shaders aren't recompiled by the
+  // driver on every launch
+  VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+  std::string pipelineCachePath = "pipeline_cache.bin";
+  // True when usable cache data was found on disk
+  bool pipelineCacheLoaded = false;
+
+  // Enabled when supported, decides whether BCn textures can be used
+  bool textureCompressionBC = false;
+
+  // Used by VkEngineProfiler. timestampValidBits is for the graphics family,
+  // 0 means that queue can't write timestamps at all
+  bool pipelineStatisticsQuery = false;
+  // Lets secondary command buffers run inside an active statistics query
+  bool inheritedQueries = false;
+  float timestampPeriod = 1.0f;
+  uint32_t timestampValidBits = 0;
+
+  // Vulkan 1.2 drawIndirectCount, needed for the GPU culled scene
+  bool drawIndirectCount = false;
+  // Also needed for it, the cull shader passes each object's index to the
+  // vertex shader as the draw's firstInstance
+  bool drawIndirectFirstInstance = false;
+
+  // The Vulkan 1.2 descriptor indexing features VkEngineBindlessTextures
+  // needs: a runtime sized, partially bound sampled image array that can be
+  // written while bound and indexed with non uniform indices
+  bool descriptorIndexing = false;
+
   VkEngineDevice(VkWindow &window);
   ~VkEngineDevice();
 
@@ -105,5 +177,10 @@ public:
   void createSurface();
 
   void createCommandPool();
+  void createDescriptorAllocators();
+
+  void createPipelineCache();
+  bool isPipelineCacheCompatible(const std::vector<char> &cacheData);
+  void savePipelineCache();
 };
 } // namespace ve
\ No newline at end of file
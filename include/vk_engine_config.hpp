@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vulkan/vulkan.h>
+
+namespace ve {
+
+// Startup options for the engine, filled in from the command line in main
+struct EngineConfig {
+  // Render into offscreen VkImages without a GLFW window, surface or
+  // swapchain. Used on machines with no display (e.g. lavapipe only boxes)
+  bool headless = false;
+
+  // How many frames to render before exiting when running headless
+  uint32_t headlessFrameCount = 1000;
+
+  // Wait for the queue to go idle after every frame instead of keeping
+  // MAX_FRAMES_IN_FLIGHT frames queued, for measuring the pipelining gain
+  bool serializeFrames = false;
+
+  // Frames the CPU can queue ahead of the GPU, 1 to MAX_FRAMES_IN_FLIGHT.
+  // 0 keeps the maximum
+  uint32_t framesInFlight = 0;
+
+  // VK_PRESENT_MODE_MAX_ENUM_KHR lets the swap chain pick (MAILBOX, else
+  // FIFO). Falls back to that when the surface doesn't support the mode
+  VkPresentModeKHR presentMode = VK_PRESENT_MODE_MAX_ENUM_KHR;
+
+  // Swap chain images to ask for, 0 for one more than the surface minimum
+  uint32_t swapChainImages = 0;
+
+  // Frames per second to cap at, 0 for uncapped
+  uint32_t fpsCap = 0;
+
+  // Delay the start of each frame by the measured GPU time so input is read
+  // as late as possible, instead of letting frames queue behind the GPU
+  bool lowLatency = false;
+
+  // Worker threads recording secondary command buffers, 0 picks one less
+  // than the number of hardware threads
+  uint32_t recordThreads = 0;
+
+  // Copies of the model drawn each frame, one draw call each. Enough of them
+  // make command recording split across the worker threads
+  uint32_t drawCount = 1;
+
+  // Draw the drawCount copies with a single instanced draw instead of one
+  // draw (and uniform) each
+  bool instanced = false;
+
+  // When non zero, time this many copies drawn as separate draws against
+  // one instanced draw, then exit
+  uint32_t benchInstancingCount = 0;
+
+  // When non zero, draw a static grid of this many objects culled and drawn
+  // entirely on the GPU instead of the copies above
+  uint32_t gpuCullObjectCount = 0;
+
+  // Frustum cull the copies on the CPU and only draw the visible ones
+  bool cpuCull = false;
+
+  // When non zero, time culling this many objects with each CPU kernel,
+  // then exit
+  uint32_t benchCullingCount = 0;
+
+  // Give the instanced copies (and GPU scene objects) different textures
+  // from the bindless array, all still drawn without rebinding anything
+  bool bindless = false;
+
+  // Draw the copies one by one with their model matrix in push constants,
+  // instead of a uniform slot and descriptor rebind each
+  bool pushConstants = false;
+
+  // Recompile shaders/*.vert and *.frag when they're saved and swap the
+  // rebuilt pipelines in, without restarting
+  bool hotReload = false;
+  // GLSL compiler the hot reload runs, looked up on the PATH. Not needed
+  // when built with VE_SHADERC
+  std::string shaderCompiler = "glslc";
+};
+
+} // namespace ve
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "vk_device.hpp"
+#include "vk_swap_chain.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vulkan/vulkan.h>
+
+namespace ve {
+
+// Keeps up to framesInFlight frames queued on the GPU using the swap
+// chain's inFlightFences/imagesInFlight. The CPU only blocks when it wraps
+// around to a frame slot the GPU hasn't finished yet, so recording frame N+1
+// overlaps with the GPU executing frame N.
+//
+// throttle() can delay the start of a frame, before input is read, either to
+// cap the frame rate or in low latency mode to keep frames from queueing up
+// behind the GPU.
+//
+// Also measures how much of each frame the CPU spends blocked on the GPU, the
+// rest of the frame is CPU work that overlapped with GPU work
+class VkEngineFramePacer {
+public:
+  using Clock = std::chrono::high_resolution_clock;
+
+  // Print stats every this many frames
+  static const uint32_t REPORT_INTERVAL = 500;
+
+  // Low latency mode aims to submit this long before the GPU runs dry
+  static constexpr double LOW_LATENCY_MARGIN_MS = 1.0;
+  // Weight of the newest sample in the CPU/GPU time averages
+  static constexpr double AVERAGE_WEIGHT = 0.1;
+
+  VkEngineDevice &engineDevice;
+  VkEngineSwapChain &engineSwapChain;
+
+  // Index of the frame in flight being recorded, selects the fence,
+  // semaphores, command buffer and descriptor set for this frame
+  uint32_t currentFrame = 0;
+
+  // Old behaviour, waits for the queue to go idle after every present.
+  // Only kept to compare against
+  bool serializeFrames = false;
+
+  // Frame slots cycled through, at most MAX_FRAMES_IN_FLIGHT which every per
+  // frame resource is sized for. Fewer lets the CPU get less far ahead
+  uint32_t framesInFlight = VkEngineDevice::MAX_FRAMES_IN_FLIGHT;
+
+  // Minimum time between frame starts, 0 for no cap
+  double frameCapMs = 0.0;
+  Clock::time_point nextFrameTime;
+
+  // Sleep until the GPU is predicted to nearly be done with the submitted
+  // frames, so input is read as late as possible and the new frame doesn't
+  // wait in the queue. Predictions come from the GPU time passed to throttle
+  // and the measured CPU time up to the submit
+  bool lowLatency = false;
+  double gpuMsAverage = 0.0;
+  double cpuMsAverage = 0.0;
+  Clock::time_point cpuFrameStart;
+  bool throttled = false;
+  // When the GPU should finish the last submitted frame
+  Clock::time_point predictedGpuDone;
+
+  // Deletion queue serial each frame slot last submitted, 0 if none yet.
+  // Once the slot's fence is waited on, that frame and every earlier one
+  // are finished
+  uint64_t submittedSerials[VkEngineDevice::MAX_FRAMES_IN_FLIGHT] = {};
+
+  // Stats since the last report
+  Clock::time_point lastFrameStart;
+  bool hasLastFrame = false;
+  double frameTimeTotal = 0.0;
+  double waitTimeTotal = 0.0;
+  double throttleTimeTotal = 0.0;
+  uint32_t gpuFramesQueuedTotal = 0;
+  uint32_t framesMeasured = 0;
+
+  VkEngineFramePacer(VkEngineDevice &eDevice, VkEngineSwapChain &eSwapChain,
+                     bool serialize);
+  ~VkEngineFramePacer();
+
+  // deleting copy constructors
+  VkEngineFramePacer(const VkEngineFramePacer &) = delete;
+  void operator=(const VkEngineFramePacer &) = delete;
+
+  // Clamped to 1..MAX_FRAMES_IN_FLIGHT. Only call between frames, when no
+  // frame slot is being recorded
+  void setFramesInFlight(uint32_t count);
+
+  // Call before reading input for the next frame. Sleeps for the frame cap
+  // and low latency mode, gpuFrameMs is the latest measured GPU time of a
+  // frame (0 if unknown, which turns low latency off)
+  void throttle(double gpuFrameMs);
+
+  // Blocks until the GPU is done with the last use of this frame slot
+  void waitForFrame();
+
+  // Images can be acquired out of order, so also wait for whichever frame
+  // last rendered into this image
+  void waitForImage(uint32_t imageIndex);
+
+  // Resets this frame's fence and returns it to pass to vkQueueSubmit
+  VkFence beginSubmit();
+
+  // Moves on to the next frame slot
+  void endFrame();
+
+  void report();
+};
+
+} // namespace ve
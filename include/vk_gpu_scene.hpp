@@ -0,0 +1,102 @@
+#pragma once
+
+#include "vk_device.hpp"
+#include "vk_model.hpp"
+#include "vk_upload_manager.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace ve {
+
+// Read by cull.comp from a slot of the uniform ring
+struct CullParams {
+  // From VkEngineCuller::extractFrustumPlanes
+  alignas(16) glm::vec4 planes[6];
+  uint32_t objectCount;
+};
+
+// Per object draw arguments, copied into the indirect command of every
+// object that survives culling
+struct ObjectDrawArgs {
+  uint32_t indexCount;
+  uint32_t firstIndex;
+  int32_t vertexOffset;
+  uint32_t pad;
+};
+
+// Objects drawn entirely GPU driven. Everything about them lives in device
+// local storage buffers, uploaded once:
+//   instanceBuffer  InstanceData, vertex binding 1 of the instanced pipeline
+//   boundsBuffer    world space bounding sphere
+//   drawArgsBuffer  ObjectDrawArgs
+//
+// Each frame a compute dispatch (see VkEnginePipeline::recordCull) tests every
+// bounding sphere against the frustum and appends a
+// VkDrawIndexedIndirectCommand for the visible ones, drawn by one
+// vkCmdDrawIndexedIndirectCount. The CPU cost per frame doesn't depend on the
+// object count at all.
+//
+// The indirect and count buffers are written by the GPU every frame, so there
+// is one of each per frame in flight
+class VkEngineGpuScene {
+public:
+  static constexpr uint32_t MAX_OBJECTS = 1u << 20;
+  // Must match local_size_x in cull.comp
+  static const uint32_t CULL_WORKGROUP_SIZE = 64;
+
+  VkEngineDevice &engineDevice;
+  VkEngineUploadManager &uploadManager;
+  VkModel &engineModel;
+
+  uint32_t objectCount = 0;
+  // Timeline value of the object upload
+  uint64_t uploadValue = 0;
+
+  VkBuffer instanceBuffer = VK_NULL_HANDLE;
+  VkEngineAllocation instanceBufferMemory;
+  VkBuffer boundsBuffer = VK_NULL_HANDLE;
+  VkEngineAllocation boundsBufferMemory;
+  VkBuffer drawArgsBuffer = VK_NULL_HANDLE;
+  VkEngineAllocation drawArgsBufferMemory;
+
+  std::vector<VkBuffer> indirectBuffers;
+  std::vector<VkEngineAllocation> indirectBufferMemory;
+  std::vector<VkBuffer> countBuffers;
+  std::vector<VkEngineAllocation> countBufferMemory;
+
+  // Bindings of cull.comp, the pipeline builds its compute layout from this
+  VkDescriptorSetLayout cullDescriptorSetLayout;
+
+  VkEngineGpuScene(VkEngineDevice &eDevice, VkEngineUploadManager &uploader,
+                   VkModel &model);
+  ~VkEngineGpuScene();
+
+  // deleting copy constructors
+  VkEngineGpuScene(const VkEngineGpuScene &) = delete;
+  void operator=(const VkEngineGpuScene &) = delete;
+
+  // Uploads one copy of the model per instance. Calling it again replaces
+  // the objects without waiting for frames in flight, their old buffers go
+  // through the device's deletion queue
+  void setObjects(const std::vector<InstanceData> &instances);
+
+  bool empty() const;
+
+  // Points set, allocated with cullDescriptorSetLayout, at the current
+  // objects and frameIndex's indirect and count buffers. The pipeline does
+  // this every frame on a set from its frame allocator, so replaced objects
+  // never leave sets behind
+  void writeCullDescriptorSet(VkDescriptorSet set, uint32_t frameIndex);
+
+private:
+  void createCullDescriptorSetLayout();
+  void destroyBuffers();
+  void retireBuffers();
+};
+
+} // namespace ve
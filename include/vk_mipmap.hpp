@@ -0,0 +1,43 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define VE_MIPMAP_SSE2 1
+#endif
+
+namespace ve {
+
+// One level of a CPU generated mip chain, tightly packed RGBA8
+struct MipLevel {
+  uint32_t width;
+  uint32_t height;
+  std::vector<uint8_t> pixels;
+};
+
+// floor(log2(max(width, height))) + 1, every level down to 1x1
+uint32_t mipLevelCount(uint32_t width, uint32_t height);
+
+// vkCmdBlitImage with VK_FILTER_LINEAR needs all three of these on the
+// optimal tiling format, otherwise generate the chain on the CPU
+bool formatSupportsLinearBlit(VkPhysicalDevice physicalDevice,
+                              VkFormat format);
+
+// Fallback for formats the GPU can't blit. Returns levels 1..N-1, level 0 is
+// the source itself so it isn't copied
+std::vector<MipLevel> generateMipChainCpu(const uint8_t *rgba, uint32_t width,
+                                          uint32_t height);
+
+// 2x2 box filter of one RGBA8 level into the next. Odd sizes clamp the last
+// row/column. Colors are sRGB encoded, they are averaged in linear space
+// (like the GPU blit does for _SRGB formats) so the smaller levels don't get
+// darker. Alpha is averaged as is
+void downsampleBox(const uint8_t *src, uint32_t srcWidth, uint32_t srcHeight,
+                   uint8_t *dst, uint32_t dstWidth, uint32_t dstHeight);
+
+} // namespace ve
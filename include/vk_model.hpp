@@ -1,5 +1,8 @@
 #pragma once
 #include "vk_device.hpp"
+#include "vk_mipmap.hpp"
+#include "vk_texture_file.hpp"
+#include "vk_upload_manager.hpp"
 #include <chrono>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -48,6 +51,57 @@ struct Vertex {
   }
 };
 
+// Per copy data for instanced draws, read from vertex binding 1 with
+// VK_VERTEX_INPUT_RATE_INSTANCE (see simple_shader_instanced.vert)
+struct InstanceData {
+  glm::mat4 model;
+  glm::vec4 color;
+  // Slot in VkEngineBindlessTextures, only read by the bindless pipeline
+  uint32_t textureIndex;
+
+  static VkVertexInputBindingDescription getBindingDescription() {
+    VkVertexInputBindingDescription bindingDescription{};
+    bindingDescription.binding = 1;
+    bindingDescription.stride = sizeof(InstanceData);
+    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+    return bindingDescription;
+  }
+
+  static std::vector<VkVertexInputAttributeDescription>
+  getAttributeDescriptions() {
+    // A mat4 attribute is four vec4 locations, one per column
+    std::vector<VkVertexInputAttributeDescription> attributeDescriptions(6);
+    for (uint32_t column = 0; column < 4; column++) {
+      attributeDescriptions[column].binding = 1;
+      attributeDescriptions[column].location = 3 + column;
+      attributeDescriptions[column].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+      attributeDescriptions[column].offset =
+          offsetof(InstanceData, model) + sizeof(glm::vec4) * column;
+    }
+
+    attributeDescriptions[4].binding = 1;
+    attributeDescriptions[4].location = 7;
+    attributeDescriptions[4].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    attributeDescriptions[4].offset = offsetof(InstanceData, color);
+
+    attributeDescriptions[5].binding = 1;
+    attributeDescriptions[5].location = 8;
+    attributeDescriptions[5].format = VK_FORMAT_R32_UINT;
+    attributeDescriptions[5].offset = offsetof(InstanceData, textureIndex);
+
+    return attributeDescriptions;
+  }
+};
+
+// Per draw data of the push constant pipeline, recorded straight into the
+// command buffer instead of going through the uniform ring. 68 bytes, every
+// device supports at least 128
+struct DrawPushConstants {
+  glm::mat4 model;
+  // Slot in VkEngineBindlessTextures, only read by the bindless variant
+  uint32_t textureIndex;
+};
+
 struct UniformBufferObject {
   alignas(16) glm::mat4 model;
   alignas(16) glm::mat4 view;
@@ -57,25 +111,49 @@ struct UniformBufferObject {
 class VkModel {
 public:
   VkEngineDevice &engineDevice;
+  VkEngineUploadManager &uploadManager;
+
+  // Timeline value of the upload batch holding this model's vertex, index
+  // and texture data
+  uint64_t uploadValue = 0;
 
   VkBuffer vertexBuffer;
-  VkDeviceMemory vertexBufferMemory;
+  VkEngineAllocation vertexBufferMemory;
 
   VkBuffer indexBuffer;
-  VkDeviceMemory indexBufferMemory;
+  VkEngineAllocation indexBufferMemory;
+
+  // One persistently mapped, host coherent ring for all per frame uniforms.
+  // Split into MAX_FRAMES_IN_FLIGHT regions, each region is bump allocated
+  // in uniformStride sized slots and bound with a dynamic offset, so any
+  // number of objects can share the single descriptor set
+  static const uint32_t MAX_UNIFORMS_PER_FRAME = 1024;
 
-  std::vector<VkBuffer> uniformBuffers;
-  std::vector<VkDeviceMemory> uniformBuffersMemory;
+  VkBuffer uniformBuffer;
+  VkEngineAllocation uniformBufferMemory;
+  VkDeviceSize uniformStride = 0;
+  VkDeviceSize uniformFrameSize = 0;
+  std::vector<VkDeviceSize> uniformFrameUsed;
 
-  VkDescriptorPool descriptorPool;
+  // Per instance data, laid out like the uniform ring: one persistently
+  // mapped region per frame in flight, bump allocated each frame. Bound at
+  // the start of the frame's region, so firstInstance is relative to it
+  static constexpr uint32_t MAX_INSTANCES_PER_FRAME = 65536;
+
+  VkBuffer instanceBuffer;
+  VkEngineAllocation instanceBufferMemory;
+  std::vector<uint32_t> instanceFrameUsed;
 
   std::vector<Vertex> vertices;
   std::vector<uint16_t> indices;
 
   VkImage textureImage;
-  VkDeviceMemory textureImageMemory;
+  VkEngineAllocation textureImageMemory;
+  // BCn when a cooked .vtex was loaded, otherwise RGBA8
+  VkFormat textureFormat = VK_FORMAT_R8G8B8A8_SRGB;
+  uint32_t textureMipLevels = 1;
 
-  VkModel(VkEngineDevice &eDevice);
+  VkModel(VkEngineDevice &eDevice, VkEngineUploadManager &uploader);
   ~VkModel();
 
   void createVertexBuffer(std::vector<Vertex> vertices);
@@ -84,30 +162,35 @@ public:
 
   void createUniformBuffers();
 
-  void createDescriptorPool();
-
-  void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
-                    VkMemoryPropertyFlags properties, VkBuffer &buffer,
-                    VkDeviceMemory &bufferMemory);
+  // Reset frameIndex's region, only safe once that frame's fence has signaled
+  void beginUniformFrame(uint32_t frameIndex);
+  // Returns where to write size bytes (size <= uniformStride) and the dynamic
+  // offset to bind them with
+  void *allocateUniform(uint32_t frameIndex, VkDeviceSize size,
+                        uint32_t &dynamicOffset);
 
-  VkCommandBuffer beginSingleTimeCommands();
-  void endSingleTimeCommands(VkCommandBuffer commandBuffer);
+  void createInstanceBuffer();
 
-  void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
+  // Reset frameIndex's region, only safe once that frame's fence has signaled
+  void beginInstanceFrame(uint32_t frameIndex);
+  // Returns room for count instances and the firstInstance to draw them with
+  InstanceData *allocateInstances(uint32_t frameIndex, uint32_t count,
+                                  uint32_t &firstInstance);
+  // Where frameIndex's region starts, to bind binding 1 at
+  VkDeviceSize instanceFrameOffset(uint32_t frameIndex) const;
 
-  uint32_t findMemoryType(uint32_t typeFilter,
-                          VkMemoryPropertyFlags properties);
+  void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+                    VkMemoryPropertyFlags properties, VkBuffer &buffer,
+                    VkEngineAllocation &bufferMemory);
 
   void createImage(uint32_t width, uint32_t height, VkFormat format,
                    VkImageTiling tiling, VkImageUsageFlags usage,
                    VkMemoryPropertyFlags properties, VkImage &image,
-                   VkDeviceMemory &imageMemory);
+                   VkEngineAllocation &imageMemory, uint32_t mipLevels = 1);
   void createTextureImage();
-
-  void transitionImageLayout(VkImage image, VkFormat format,
-                             VkImageLayout oldLayout, VkImageLayout newLayout);
-  void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width,
-                         uint32_t height);
+  bool isTextureFormatSupported(VkFormat format);
+  void createCookedTextureImage(const TextureFile &cooked);
+  void createUncompressedTextureImage();
 };
 
 } // namespace ve
\ No newline at end of file
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "vk_device.hpp"
+#include "vk_thread_pool.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace ve {
+
+// Records a frame's draws into secondary command buffers on several threads,
+// the primary command buffer then runs them with vkCmdExecuteCommands inside
+// its render pass.
+//
+// Draws are split into fixed size chunks and every chunk's secondary is kept
+// around per frame in flight. A chunk is only re-recorded when it is dirty:
+// its draws changed since it was last recorded into this frame slot, or
+// invalidate() was called because something it references was recreated. A
+// static scene then costs a compare per draw instead of a re-record, and in a
+// dynamic one only the chunks that actually changed get rebuilt.
+//
+// Every chunk has its own command pool per frame slot, reset with
+// vkResetCommandPool before re-recording. Per worker pools would not work
+// with the cache: resetting a worker's pool resets every secondary it ever
+// recorded, including the clean ones that are about to be reused, and which
+// worker picks up a chunk changes from frame to frame. Pools aren't thread
+// safe, but a chunk is only ever recorded by one task at a time so no locking
+// is needed
+class VkEngineParallelRecorder {
+public:
+  // Draws per chunk, also the least that's worth a secondary
+  static constexpr uint32_t CHUNK_SIZE = 64;
+
+  // Print cache stats every this many frames
+  static const uint32_t REPORT_INTERVAL = 500;
+
+  // Records count draws starting at first into commandBuffer
+  using RecordFunc = std::function<void(VkCommandBuffer commandBuffer,
+                                        uint32_t first, uint32_t count)>;
+
+  // Cached secondary for one chunk of draws in one frame slot
+  struct Chunk {
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    // Copy of the draws as they were recorded, compared against to find out
+    // if the chunk is dirty
+    std::vector<char> recordedDraws;
+    bool valid = false;
+  };
+
+  VkEngineDevice &engineDevice;
+  VkEngineThreadPool &threadPool;
+
+  // [frame in flight][chunk]
+  std::vector<std::vector<Chunk>> frames;
+
+  // Stats since the last report
+  uint32_t chunksRecorded = 0;
+  uint32_t chunksReused = 0;
+  uint32_t framesRecorded = 0;
+
+  VkEngineParallelRecorder(VkEngineDevice &eDevice,
+                           VkEngineThreadPool &pool);
+  ~VkEngineParallelRecorder();
+
+  // deleting copy constructors
+  VkEngineParallelRecorder(const VkEngineParallelRecorder &) = delete;
+  void operator=(const VkEngineParallelRecorder &) = delete;
+
+  // True when drawCount draws are worth splitting into secondaries
+  bool useSecondaries(uint32_t drawCount) const;
+
+  // Forces every chunk to be re-recorded, for when the render pass, pipeline
+  // or anything else baked into the secondaries is recreated
+  void invalidate();
+
+  // Records the dirty chunks in parallel and returns the secondaries of
+  // every chunk in draw order.
+  //
+  // drawData holds drawCount draws of drawSize bytes each, whatever
+  // recordDraws reads besides those has to stay the same until invalidate().
+  // inheritance has to describe the render pass the secondaries will be
+  // executed in. Its framebuffer should be VK_NULL_HANDLE, cached
+  // secondaries are reused with every swap chain image
+  void record(uint32_t frameIndex,
+              const VkCommandBufferInheritanceInfo &inheritance,
+              const void *drawData, size_t drawSize, uint32_t drawCount,
+              const RecordFunc &recordDraws,
+              std::vector<VkCommandBuffer> &secondaries);
+
+  void report();
+
+private:
+  void createChunk(Chunk &chunk);
+};
+
+} // namespace ve
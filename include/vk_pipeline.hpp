@@ -1,42 +1,139 @@
 #pragma once
 
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <mutex>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
 #include <vulkan/vulkan.h>
 
+#include <vk_bindless.hpp>
 #include <vk_device.hpp>
+#include <vk_gpu_scene.hpp>
 #include <vk_model.hpp>
+#include <vk_parallel_recorder.hpp>
+#include <vk_profiler.hpp>
 #include <vk_swap_chain.hpp>
 namespace ve {
 struct PipelineConfigInfo {
-  VkViewport viewport;
-  VkRect2D scissor;
-  // VkPipelineViewportStateCreateInfo viewportStateInfo;
+  // Viewport and scissor are among these, set from the swap chain extent
+  // while recording, so a resize doesn't rebuild any pipeline
+  std::vector<VkDynamicState> dynamicStates;
   VkPipelineInputAssemblyStateCreateInfo inputAssemblyInfo;
   VkPipelineRasterizationStateCreateInfo rasterizationInfo;
   VkPipelineMultisampleStateCreateInfo multisampleInfo;
   VkPipelineColorBlendAttachmentState colorBlendAttachment;
   VkPipelineColorBlendStateCreateInfo colorBlendInfo;
   VkPipelineDepthStencilStateCreateInfo depthStencilInfo;
+  // Shared by every pipeline layout, so switching between pipelines never
+  // disturbs what was pushed or bound
+  std::vector<VkPushConstantRange> pushConstantRanges;
   // VkPipelineLayout pipelineLayout = nullptr;
   // VkRenderPass renderPass = nullptr;
   uint32_t subpass = 0;
 };
+// Every handle createGraphicsPipeline makes. A set is built whole, possibly
+// off the render thread, then installed into VkEnginePipeline at once.
+// Variants whose shader isn't there stay VK_NULL_HANDLE
+struct GraphicsPipelineSet {
+  VkPipeline graphicsPipeline = VK_NULL_HANDLE;
+  VkPipeline instancedPipeline = VK_NULL_HANDLE;
+  VkPipeline bindlessPipeline = VK_NULL_HANDLE;
+  VkPipeline pushPipeline = VK_NULL_HANDLE;
+  VkPipeline pushBindlessPipeline = VK_NULL_HANDLE;
+  VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+  VkPipelineLayout bindlessPipelineLayout = VK_NULL_HANDLE;
+  VkShaderModule vertShaderModule = VK_NULL_HANDLE;
+  VkShaderModule fragShaderModule = VK_NULL_HANDLE;
+  VkShaderModule instancedVertShaderModule = VK_NULL_HANDLE;
+  VkShaderModule pushVertShaderModule = VK_NULL_HANDLE;
+  VkShaderModule bindlessFragShaderModule = VK_NULL_HANDLE;
+};
+
+// Per draw state needed while recording a frame's command buffer. Compared
+// byte for byte to find dirty secondaries, so keep it free of padding and
+// pointers
+struct DrawCall {
+  // dynamic offset of this draw's UniformBufferObject in the uniform ring
+  uint32_t uniformOffset;
+  // 0 draws a single copy with the model matrix from the uniform. Otherwise
+  // draws instanceCount copies with the instanced pipeline, reading
+  // InstanceData from firstInstance on in this frame's instance region
+  uint32_t instanceCount;
+  uint32_t firstInstance;
+  // Pushed before the draw when VkEnginePipeline::usePushConstants is set,
+  // then every non instanced draw can share one uniform. Part of the
+  // comparison too, a moved object re-records its secondary
+  DrawPushConstants push;
+};
+
+// This frame's draw of the GPU culled scene, both offsets are into the
+// uniform ring
+struct GpuSceneDraw {
+  // UniformBufferObject with view/proj for the instanced pipeline
+  uint32_t uniformOffset;
+  // CullParams for cull.comp
+  uint32_t cullParamsOffset;
+};
+
 class VkEnginePipeline {
 public:
   VkEngineDevice &engineDevice;
   VkEngineSwapChain &engineSwapChain;
   VkModel &engineInputModel;
+  // Times the passes recorded in recordCommandBuffer
+  VkEngineProfiler &engineProfiler;
+  // Splits large frames over cached secondary command buffers, recorded on
+  // worker threads
+  VkEngineParallelRecorder &parallelRecorder;
 
   VkPipeline graphicsPipeline;
   VkShaderModule vertShaderModule;
   VkShaderModule fragShaderModule;
 
+  // Same state as graphicsPipeline plus the per instance vertex binding.
+  // Stays VK_NULL_HANDLE when the instanced vertex shader isn't there (see
+  // VkEngineShaderCache::isAvailable)
+  VkPipeline instancedPipeline = VK_NULL_HANDLE;
+  VkShaderModule instancedVertShaderModule = VK_NULL_HANDLE;
+  std::string instancedVertexCodeFilePath =
+      "shaders/simple_shader_instanced.vert";
+
+  // Frustum culls engineGpuScene into an indirect buffer. Like the instanced
+  // pipeline it's skipped when cull.comp hasn't been compiled
+  VkEngineGpuScene &engineGpuScene;
+  VkPipeline cullPipeline = VK_NULL_HANDLE;
+  VkPipelineLayout cullPipelineLayout = VK_NULL_HANDLE;
+  std::string cullComputeFilePath = "shaders/cull.comp";
+
+  // Instanced pipeline whose fragment shader samples the texture each
+  // instance names out of engineBindless, bound as set 1. Stays
+  // VK_NULL_HANDLE without descriptor indexing or the compiled shader
+  VkEngineBindlessTextures &engineBindless;
+  VkPipeline bindlessPipeline = VK_NULL_HANDLE;
+  VkPipelineLayout bindlessPipelineLayout = VK_NULL_HANDLE;
+  VkShaderModule bindlessFragShaderModule = VK_NULL_HANDLE;
+  std::string bindlessFragmentCodeFilePath =
+      "shaders/simple_shader_bindless.frag";
+  // Draw instanced copies with bindlessPipeline instead of instancedPipeline
+  bool useBindless = false;
+
+  // Non instanced draws that take their model matrix from
+  // DrawCall::push, no uniform slot or descriptor rebind per draw. Stays
+  // VK_NULL_HANDLE when the shader hasn't been compiled
+  VkPipeline pushPipeline = VK_NULL_HANDLE;
+  // Same with the bindless fragment shader, when useBindless is set
+  VkPipeline pushBindlessPipeline = VK_NULL_HANDLE;
+  VkShaderModule pushVertShaderModule = VK_NULL_HANDLE;
+  std::string pushVertexCodeFilePath = "shaders/simple_shader_push.vert";
+  // Draw non instanced draws with pushPipeline instead of graphicsPipeline
+  bool usePushConstants = false;
+
   VkDescriptorSetLayout descriptorSetLayout = nullptr;
   std::vector<VkDescriptorSet> descriptorSets;
 
@@ -45,7 +142,36 @@ public:
   std::string vertexCodeFilePath;
   std::string fragmentCodeFilePath;
 
+  // Primary command buffer of every frame in flight, each allocated from its
+  // frame's pool
+  std::vector<VkCommandPool> frameCommandPools;
   std::vector<VkCommandBuffer> commandBuffers;
+  // Secondaries executed by the frame being recorded
+  std::vector<VkCommandBuffer> secondaryCommandBuffers;
+
+  // Descriptor sets that only live for one frame (the GPU scene's cull set),
+  // like the command pools every frame slot has its own, reset when the
+  // slot is reused
+  VkEngineDescriptorAllocator
+      frameDescriptorAllocators[VkEngineDevice::MAX_FRAMES_IN_FLIGHT];
+
+  // Counts pipeline builds, only the first one can be a cold cache miss.
+  // Shader reloads build on the watcher thread
+  std::atomic<uint32_t> pipelinesCreated{0};
+
+  // What the pipelines were first built with, reused by every rebuild
+  PipelineConfigInfo graphicsPipelineConfig;
+
+  // Shader hot reload. buildPendingPipelines makes a whole new set off the
+  // render thread and parks it in pendingPipelines, swapPendingPipelines
+  // installs it between frames. buildMutex is held for a whole build so the
+  // render pass can't be replaced underneath it, pendingMutex only guards
+  // the hand over
+  std::mutex buildMutex;
+  std::mutex pendingMutex;
+  GraphicsPipelineSet pendingPipelines{};
+  std::atomic<bool> pipelinesPending{false};
+  uint32_t pipelineSwaps = 0;
 
   // deleting copy constructors
   VkEnginePipeline(const VkEnginePipeline &) = delete;
@@ -54,27 +180,82 @@ public:
   VkEnginePipeline(VkEngineDevice &eDevice, VkEngineSwapChain &eSwapChain,
                    const PipelineConfigInfo &pipelineConfig,
                    std::string vertFilepath, std::string fragFilepath,
-                   VkModel &inputModel);
+                   VkModel &inputModel, VkEngineProfiler &profiler,
+                   VkEngineParallelRecorder &recorder,
+                   VkEngineGpuScene &gpuScene,
+                   VkEngineBindlessTextures &bindless);
   ~VkEnginePipeline();
 
-  static std::vector<char> readFile(std::string filePath);
-
   void createCommandBuffers();
-  // for window resizes
+  void createFrameDescriptorAllocators();
+  // Frees every set frameIndex's slot allocated last time, once its fence
+  // was waited on
+  void resetFrameDescriptors(uint32_t frameIndex);
+  // Valid until resetFrameDescriptors is called for the same slot
+  VkDescriptorSet allocateFrameDescriptorSet(uint32_t frameIndex,
+                                             VkDescriptorSetLayout layout);
+  // Re-record every cached secondary on its next use. Needed when something
+  // recordDraws reads besides the DrawCalls themselves changes
+  void markCommandsDirty();
+  void recordCommandBuffer(uint32_t imageIndex, uint32_t frameIndex,
+                           const std::vector<DrawCall> &drawCalls,
+                           const GpuSceneDraw *gpuSceneDraw = nullptr);
+  // Binds and draws drawCalls[first, first + count), into either the primary
+  // or one of the secondaries
+  void recordDraws(VkCommandBuffer commandBuffer, uint32_t frameIndex,
+                   const std::vector<DrawCall> &drawCalls, uint32_t first,
+                   uint32_t count);
+  // for window resizes. Only the swap chain, its image views and
+  // framebuffers are rebuilt, the pipelines outlive them. The old ones are
+  // retired rather than destroyed, so this doesn't wait for the GPU
   void recreateSwapChain();
-  void cleanupSwapChain();
+  // Viewport and scissor covering the swap chain, for every command buffer
+  // that draws (secondaries don't inherit dynamic state)
+  void setViewportAndScissor(VkCommandBuffer commandBuffer);
 
+  // Builds and installs the pipelines, render thread only
   void createGraphicsPipeline(const PipelineConfigInfo &pipelineConfig);
+  // Safe from any thread, nothing in the engine is touched. Throws after
+  // destroying whatever it made when a pipeline can't be created
+  GraphicsPipelineSet
+  buildGraphicsPipelines(const PipelineConfigInfo &pipelineConfig);
+  void installGraphicsPipelines(const GraphicsPipelineSet &pipelines);
+  // Right away, only for sets no command buffer ever used
+  void destroyGraphicsPipelineSet(GraphicsPipelineSet &pipelines);
+  // Called by the shader watcher with the sources that changed. Rebuilds
+  // every pipeline if any of them is used here, failures keep the old ones
+  void buildPendingPipelines(const std::vector<std::string> &sourcePaths);
+  // Installs the set buildPendingPipelines finished, if any. Call between
+  // frames, before recording. True when the pipelines changed
+  bool swapPendingPipelines();
+  // Destroys every pipeline and layout createGraphicsPipeline made through
+  // the device's deletion queue, so it's safe with frames in flight
+  void retireGraphicsPipelines();
+  bool hasInstancing() const;
+  bool hasBindless() const;
+  bool hasPushConstants() const;
 
-  VkShaderModule createShaderModule(const std::vector<char> &shaderCode);
+  void createCullPipeline();
+  // True when the device and shaders allow drawing the GPU culled scene
+  bool hasGpuCulling() const;
+  // Outside the render pass: fills this frame's indirect buffer
+  void recordCull(VkCommandBuffer commandBuffer, uint32_t frameIndex,
+                  const GpuSceneDraw &gpuSceneDraw);
+  // Inside the render pass: draws whatever recordCull let through
+  void recordGpuSceneDraw(VkCommandBuffer commandBuffer, uint32_t frameIndex,
+                          const GpuSceneDraw &gpuSceneDraw);
 
-  static PipelineConfigInfo defaultPipelineConfigInfo(uint32_t width,
-                                                      uint32_t height);
+  static PipelineConfigInfo defaultPipelineConfigInfo();
 
   void bindCommandBufferToGraphicsPipelilne(VkCommandBuffer commandBuffer);
 
   void createDescriptorSetLayout();
   void createDescriptorSets();
+
+private:
+  // Fills in pipelines as far as it gets before a failure
+  void createPipelineVariants(const PipelineConfigInfo &pipelineConfig,
+                              GraphicsPipelineSet &pipelines);
 };
 
 } // namespace ve
\ No newline at end of file
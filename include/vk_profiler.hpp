@@ -0,0 +1,131 @@
+#pragma once
+
+#include "vk_device.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace ve {
+
+// What the GPU spent on one named scope of a finished frame
+struct ProfileScopeResult {
+  std::string name;
+  double gpuMs = 0.0;
+
+  // Only filled in for scopes begun with withStatistics, and only when the
+  // device supports pipelineStatisticsQuery
+  bool hasStatistics = false;
+  uint64_t inputAssemblyVertices = 0;
+  uint64_t inputAssemblyPrimitives = 0;
+  uint64_t vertexShaderInvocations = 0;
+  uint64_t clippingPrimitives = 0;
+  uint64_t fragmentShaderInvocations = 0;
+};
+
+// GPU profiler built on timestamp and pipeline statistics queries.
+//
+// Scopes are recorded into a command buffer with beginScope/endScope which
+// write a timestamp on each side. Every frame in flight has its own query
+// pools, so by the time a frame slot comes around again (its fence has been
+// waited on) the results of its last use are already there and reading them
+// back never stalls. Results therefore lag MAX_FRAMES_IN_FLIGHT frames behind
+class VkEngineProfiler {
+public:
+  // Scopes per frame, each one takes two timestamp queries
+  static const uint32_t MAX_SCOPES = 32;
+
+  // Print averages every this many frames of results
+  static const uint32_t REPORT_INTERVAL = 500;
+
+  // Counters collected for withStatistics scopes, in this order
+  static const VkQueryPipelineStatisticFlags STATISTICS =
+      VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+      VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+      VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+      VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+      VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+  static const uint32_t STATISTIC_COUNT = 5;
+
+  // Queries of one frame slot
+  struct FrameQueries {
+    VkQueryPool timestampPool = VK_NULL_HANDLE;
+    VkQueryPool statisticsPool = VK_NULL_HANDLE;
+
+    std::vector<std::string> scopeNames;
+    // Index into statisticsPool, -1 when the scope has no statistics query
+    std::vector<int32_t> scopeStatistics;
+    uint32_t statisticsCount = 0;
+
+    // Stays false until the slot has been recorded into once
+    bool recorded = false;
+  };
+
+  // Totals since the last report
+  struct ScopeTotals {
+    double gpuMsTotal = 0.0;
+    double gpuMsMax = 0.0;
+    uint32_t samples = 0;
+  };
+
+  VkEngineDevice &engineDevice;
+
+  // false when the graphics queue can't write timestamps, every call below
+  // is then a no-op
+  bool enabled = false;
+  bool statisticsEnabled = false;
+
+  // Mask for timestampValidBits, the top bits of a timestamp are garbage
+  uint64_t timestampMask = ~0ull;
+
+  std::vector<FrameQueries> frames;
+  uint32_t recordingFrame = 0;
+
+  // Only one pipeline statistics query can be active at a time, nested
+  // withStatistics scopes just get timestamps
+  bool statisticsActive = false;
+
+  // Scopes of the most recent frame whose results came back
+  std::vector<ProfileScopeResult> lastResults;
+
+  std::unordered_map<std::string, ScopeTotals> scopeTotals;
+  // first seen order, so the report is stable
+  std::vector<std::string> scopeOrder;
+  uint32_t framesCollected = 0;
+
+  VkEngineProfiler(VkEngineDevice &eDevice);
+  ~VkEngineProfiler();
+
+  // deleting copy constructors
+  VkEngineProfiler(const VkEngineProfiler &) = delete;
+  void operator=(const VkEngineProfiler &) = delete;
+
+  // Call at the start of the frame's command buffer, outside any render
+  // pass, after the frame's fence was waited on. Collects the results this
+  // slot produced last time and resets its queries
+  void beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+
+  // Returns the scope id to pass to endScope
+  uint32_t beginScope(VkCommandBuffer commandBuffer, const std::string &name,
+                      bool withStatistics = false);
+  void endScope(VkCommandBuffer commandBuffer, uint32_t scope);
+
+  // Statistics of the query currently running, secondary command buffers
+  // executed inside it have to inherit exactly these
+  VkQueryPipelineStatisticFlags activeStatistics() const;
+
+  // Latest result for a scope, false if it hasn't come back yet
+  bool getScopeResult(const std::string &name,
+                      ProfileScopeResult &result) const;
+
+  void report();
+
+private:
+  void collectResults(FrameQueries &frame);
+};
+
+} // namespace ve
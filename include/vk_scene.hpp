@@ -0,0 +1,146 @@
+#pragma once
+
+#include "vk_device.hpp"
+#include "vk_model.hpp"
+#include "vk_thread_pool.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+namespace ve {
+
+// Handle to an entity, stays valid when the scene reorders its arrays
+using SceneEntity = uint32_t;
+
+// Transform hierarchy for everything drawn with the model, stored data
+// oriented: every per entity value lives in its own contiguous array, indexed
+// by slot.
+//
+// Slots are kept in depth first pre-order, so a parent always comes before
+// its children and every subtree is the contiguous run of slots
+// [slot, slot + subtreeSize[slot]). Propagating transforms is then a linear
+// walk, and a changed entity only touches its own subtree.
+//
+// Changing a local transform marks the entity dirty. update() only walks the
+// subtrees of dirty entities, splitting them across the worker threads when
+// there are enough, so its cost is linear in what changed rather than in the
+// size of the scene. writeInstances likewise only copies the world matrices
+// that changed since a frame slot was last written.
+//
+// Entities are created with a parent and never reparented or destroyed. New
+// entities are appended, the next update() re-sorts the arrays into
+// pre-order
+class VkEngineScene {
+public:
+  static const SceneEntity NO_ENTITY = UINT32_MAX;
+
+  // Below this many dirty entities threading costs more than it saves
+  static const uint32_t PARALLEL_MIN_ENTITIES = 4096;
+  // Least entities per task when updating in parallel
+  static const uint32_t TASK_ENTITIES = 1024;
+
+  // Print update stats every this many updates
+  static const uint32_t REPORT_INTERVAL = 500;
+
+  // Run of slots [first, end) whose world matrices were recomputed
+  struct SlotRange {
+    uint32_t first;
+    uint32_t end;
+  };
+
+  // What a frame slot's instance region holds, so only what changed since
+  // has to be copied into it
+  struct FrameInstances {
+    InstanceData *destination = nullptr;
+    uint32_t count = 0;
+    uint64_t updateIndex = 0;
+  };
+
+  VkEngineThreadPool &threadPool;
+
+  // Indexed by entity
+  std::vector<uint32_t> entitySlot;
+  std::vector<SceneEntity> entityParent;
+
+  // Indexed by slot
+  std::vector<SceneEntity> slotEntity;
+  // Slot of the parent, NO_ENTITY for roots
+  std::vector<uint32_t> parent;
+  std::vector<uint32_t> subtreeSize;
+  std::vector<glm::vec3> translation;
+  std::vector<glm::quat> rotation;
+  std::vector<glm::vec3> scale;
+  std::vector<glm::vec4> color;
+  std::vector<uint32_t> textureIndex;
+  std::vector<glm::mat4> world;
+  std::vector<uint8_t> dirty;
+
+  // Slots changed since the last update, unsorted
+  std::vector<uint32_t> dirtySlots;
+  // Set by createEntity, the slots aren't in pre-order until rebuilt
+  bool hierarchyChanged = false;
+
+  // Ranges recomputed by the last MAX_FRAMES_IN_FLIGHT updates, indexed by
+  // update number
+  std::vector<std::vector<SlotRange>> changedRanges;
+  uint64_t updateCount = 0;
+  std::vector<FrameInstances> frameInstances;
+
+  // Stats since the last report
+  uint64_t entitiesUpdated = 0;
+  double updateMs = 0.0;
+  uint32_t updatesMeasured = 0;
+
+  VkEngineScene(VkEngineThreadPool &pool);
+
+  // deleting copy constructors
+  VkEngineScene(const VkEngineScene &) = delete;
+  void operator=(const VkEngineScene &) = delete;
+
+  // parent has to exist already, so the hierarchy can't have cycles
+  SceneEntity createEntity(SceneEntity parentEntity = NO_ENTITY);
+  uint32_t entityCount() const;
+
+  void setTranslation(SceneEntity entity, const glm::vec3 &value);
+  void setRotation(SceneEntity entity, const glm::quat &value);
+  void setScale(SceneEntity entity, const glm::vec3 &value);
+  // Written out by writeInstances along with the world matrix
+  void setColor(SceneEntity entity, const glm::vec4 &value);
+  // Bindless texture slot, written out the same way
+  void setTextureIndex(SceneEntity entity, uint32_t value);
+
+  // Valid after update()
+  const glm::mat4 &worldMatrix(SceneEntity entity) const;
+  const glm::vec4 &entityColor(SceneEntity entity) const;
+  uint32_t entityTextureIndex(SceneEntity entity) const;
+
+  // Recomputes the world matrices of every dirty entity and its descendants
+  void update();
+
+  // Writes every entity's InstanceData to destination in slot
+  // order, which has to have room for entityCount() instances. When the same
+  // destination was written for frameIndex within the last
+  // MAX_FRAMES_IN_FLIGHT updates only the slots changed since are copied
+  void writeInstances(uint32_t frameIndex, InstanceData *destination);
+
+  void report();
+
+private:
+  void markDirty(uint32_t slot);
+  glm::mat4 localMatrix(uint32_t slot) const;
+  void updateRange(const SlotRange &range);
+  void rebuildOrder();
+  void writeInstanceRange(InstanceData *destination,
+                          const SlotRange &range) const;
+};
+
+} // namespace ve
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace ve {
+
+// Turns GLSL sources into shader modules, compiling each distinct one once.
+//
+// Built with VE_SHADERC (see the Makefiles) sources are compiled in engine
+// through shaderc. Every compile is keyed by a hash of the source, the text
+// of everything it #includes, the defines, the stage, the compiler's version
+// and its options, and the result is kept in cacheDirectory under that key.
+// A launch only compiles what changed since it was cached, and editing an
+// include recompiles everything that uses it. Without VE_SHADERC the
+// precompiled <source>.spv is loaded instead (see compileshader.bat).
+//
+// Modules are shared: the same key always gets the same module, and
+// different keys that compile to identical SPIR-V share one too. Owned by
+// VkEngineDevice and destroyed in cleanup(), callers never destroy them, so
+// every shader reload keeps the old version of the edited shaders around
+// until then. Thread safe, reloads build pipelines on the watcher thread
+class VkEngineShaderCache {
+public:
+  // Bump when something that changes the output isn't part of the key
+  static const uint32_t CACHE_FORMAT_VERSION = 1;
+  // Deeper than any real include chain, stops include cycles
+  static const uint32_t MAX_INCLUDE_DEPTH = 16;
+
+  // NAME, VALUE pairs, VALUE may be empty
+  using Defines = std::vector<std::pair<std::string, std::string>>;
+
+  struct SharedModule {
+    VkShaderModule module;
+    // Compared on a hash match, so a collision never hands out wrong code
+    std::vector<uint32_t> code;
+  };
+
+  VkDevice logicalDevice = VK_NULL_HANDLE;
+  std::string cacheDirectory = "shader_cache";
+
+  std::mutex mutex;
+  // By cache key, a hit only costs reading and hashing the sources
+  std::unordered_map<uint64_t, VkShaderModule> keyModules;
+  // By hash of the SPIR-V
+  std::unordered_multimap<uint64_t, SharedModule> codeModules;
+
+  // Stats
+  uint32_t compiled = 0;
+  uint32_t diskHits = 0;
+  uint32_t memoryHits = 0;
+  uint32_t modulesCreated = 0;
+  uint32_t modulesShared = 0;
+
+  VkEngineShaderCache() = default;
+  ~VkEngineShaderCache() = default;
+
+  // deleting copy constructors
+  VkEngineShaderCache(const VkEngineShaderCache &) = delete;
+  void operator=(const VkEngineShaderCache &) = delete;
+
+  void init(VkDevice device);
+  // No pipeline can still be getting created from the modules
+  void cleanup();
+
+  // True when this build compiles GLSL itself
+  static bool hasCompiler();
+  // Whether getModule can load sourcePath: the source when compiling, its
+  // .spv otherwise
+  bool isAvailable(const std::string &sourcePath) const;
+  // The stage comes from the extension (.vert, .frag or .comp). Throws with
+  // the compiler's messages when the source doesn't compile
+  VkShaderModule getModule(const std::string &sourcePath,
+                           const Defines &defines = {});
+
+private:
+  uint64_t cacheKey(const std::string &sourcePath, const std::string &source,
+                    const Defines &defines);
+  // Folds every file source #includes into hash, recursively
+  uint64_t hashIncludes(const std::string &path, const std::string &source,
+                        uint64_t hash, uint32_t depth);
+  std::string cachePath(uint64_t key) const;
+  bool loadCached(uint64_t key, std::vector<uint32_t> &code);
+  void storeCached(uint64_t key, const std::vector<uint32_t> &code);
+  std::vector<uint32_t> compile(const std::string &sourcePath,
+                                const std::string &source,
+                                const Defines &defines);
+  // Returns the module holding exactly code, creating it if there's none
+  VkShaderModule shareModule(std::vector<uint32_t> code);
+};
+
+} // namespace ve
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace ve {
+
+// Watches a directory of GLSL sources for changes on its own thread, so the
+// render loop never waits on the compiler.
+//
+// On Linux the thread sleeps in inotify (IN_CLOSE_WRITE, plus IN_MOVED_TO
+// for editors that save through a rename). Elsewhere it compares the
+// sources' modification times every POLL_INTERVAL_MS. Saves arriving within
+// SETTLE_MS of each other are handled as one batch. With a compilerCommand
+// each source is first compiled into the .spv next to it, the same way
+// compileshader.bat does, and sources that fail are dropped. Builds that
+// compile in engine (VkEngineShaderCache) leave it empty. onCompiled then
+// gets the sources, still on the watcher thread, which is where
+// VkEnginePipeline builds the replacement pipelines
+class VkEngineShaderWatcher {
+public:
+  using CompiledCallback =
+      std::function<void(const std::vector<std::string> &sourcePaths)>;
+
+  static const uint32_t POLL_INTERVAL_MS = 250;
+  static const uint32_t SETTLE_MS = 50;
+
+  std::string shaderDirectory;
+  // Run as <compilerCommand> <source> -o <source>.spv, empty to skip
+  std::string compilerCommand;
+  CompiledCallback onCompiled;
+
+  std::thread watcher;
+  std::atomic<bool> stopping{false};
+
+  // inotify instance, -1 when polling
+  int inotifyFd = -1;
+  // Polling fallback, last seen write time of every source
+  std::unordered_map<std::string, std::filesystem::file_time_type> writeTimes;
+
+  // Stats
+  std::atomic<uint32_t> compiled{0};
+  std::atomic<uint32_t> failed{0};
+
+  VkEngineShaderWatcher() = default;
+  ~VkEngineShaderWatcher();
+
+  // deleting copy constructors
+  VkEngineShaderWatcher(const VkEngineShaderWatcher &) = delete;
+  void operator=(const VkEngineShaderWatcher &) = delete;
+
+  void start(const std::string &directory, const std::string &compiler,
+             CompiledCallback callback);
+  // Joins the thread, a batch being compiled is finished first
+  void stop();
+  bool running() const;
+
+  // .vert and .frag, the stages the graphics pipelines are built from
+  static bool isShaderSource(const std::string &fileName);
+
+  void report();
+
+private:
+  void watchLoop();
+  // Blocks until sources changed or stop() was called, returns their paths
+  std::set<std::string> waitForChanges();
+  std::set<std::string> waitForInotify();
+  // One pass over the directory, returns the sources whose write time moved
+  std::set<std::string> scanWriteTimes();
+  bool compile(const std::string &sourcePath);
+};
+
+} // namespace ve
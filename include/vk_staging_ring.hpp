@@ -0,0 +1,71 @@
+#pragma once
+
+#include "vk_allocator.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <stdexcept>
+#include <vulkan/vulkan.h>
+
+namespace ve {
+
+// One persistently mapped, host coherent buffer that every upload stages
+// through, instead of a VkBuffer + allocation per upload.
+//
+// Positions (head/tail) only ever grow, the byte offset into the buffer is
+// position % capacity. Allocations that would straddle the end skip ahead to
+// the start of the buffer. Space is handed back in submission order once the
+// upload batch that read it has signaled its timeline value
+class VkEngineStagingRing {
+public:
+  static const VkDeviceSize DEFAULT_SIZE = 32ull * 1024 * 1024;
+
+  // Everything up to end was read by the batch that signals signalValue
+  struct Region {
+    uint64_t end;
+    uint64_t signalValue;
+  };
+
+  VkEngineAllocator &allocator;
+
+  VkBuffer buffer;
+  VkEngineAllocation memory;
+  VkDeviceSize capacity;
+
+  // Next free position and oldest position still in use by the GPU
+  uint64_t head = 0;
+  uint64_t tail = 0;
+
+  std::deque<Region> submittedRegions;
+
+  // Stats
+  uint64_t bytesStaged = 0;
+  uint32_t wraps = 0;
+
+  VkEngineStagingRing(VkEngineAllocator &engineAllocator,
+                      VkDeviceSize size = DEFAULT_SIZE);
+  ~VkEngineStagingRing();
+
+  // deleting copy constructors
+  VkEngineStagingRing(const VkEngineStagingRing &) = delete;
+  void operator=(const VkEngineStagingRing &) = delete;
+
+  // alignment has to be a power of two. Returns false if the ring is too full
+  // right now, the caller has to wait for a batch and reclaim()
+  bool allocate(VkDeviceSize size, VkDeviceSize alignment,
+                VkDeviceSize &outOffset);
+
+  void *mappedAt(VkDeviceSize offset);
+
+  // True if something was allocated since the last submit()
+  bool hasUnsubmitted();
+
+  // Tags everything allocated since the last submit with signalValue
+  void submit(uint64_t signalValue);
+
+  // Frees the regions of every batch up to completedValue
+  void reclaim(uint64_t completedValue);
+};
+
+} // namespace ve
@@ -13,9 +13,14 @@ public:
   VkEngineDevice &engineDevice;
   VkModel &inputModel;
 
-  VkSwapchainKHR swapChain;
+  VkSwapchainKHR swapChain = VK_NULL_HANDLE;
   std::vector<VkImage> swapChainImages;
 
+  // Backing memory for swapChainImages when they are offscreen images we
+  // created ourselves in headless mode
+  std::vector<VkEngineAllocation> offscreenImagesMemory;
+  uint32_t nextOffscreenImage = 0;
+
   VkFormat swapChainImageFormat;
   VkExtent2D swapChainExtent;
 
@@ -39,12 +44,39 @@ public:
   // For each image in the swap chain
   std::vector<VkFence> imagesInFlight;
 
-  VkEngineSwapChain(VkEngineDevice &eDevice, VkModel &model);
+  // Used when the surface supports it, VK_PRESENT_MODE_MAX_ENUM_KHR picks
+  // MAILBOX if available and FIFO otherwise. Read on every (re)creation, so
+  // changing it and recreating the swap chain switches modes at runtime
+  VkPresentModeKHR preferredPresentMode = VK_PRESENT_MODE_MAX_ENUM_KHR;
+  // Images to ask for, clamped to what the surface allows. 0 asks for one
+  // more than the minimum
+  uint32_t preferredImageCount = 0;
+  // What the current swap chain was created with
+  VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+
+  VkEngineSwapChain(VkEngineDevice &eDevice, VkModel &model,
+                    VkPresentModeKHR presentModeRequest,
+                    uint32_t imageCountRequest);
   ~VkEngineSwapChain();
 
+  // Passes the current swapChain, if any, as oldSwapchain, so the
+  // presentation engine can hand its resources over to the new one
   void createSwapChain();
-
-  VkImageView createImageView(VkImage image, VkFormat format);
+  // Hands the swap chain, its image views, framebuffers and offscreen
+  // images to the device's deletion queue, frames in flight can still be
+  // rendering into them. swapChain itself keeps the old handle for the next
+  // createSwapChain
+  void retireSwapChain();
+  void createOffscreenImages();
+  void destroyOffscreenImages();
+
+  // Wrap vkAcquireNextImageKHR/vkQueuePresentKHR so the headless path can
+  // cycle through offscreen images without a presentation engine
+  VkResult acquireNextImage(uint32_t currentFrame, uint32_t *imageIndex);
+  VkResult presentImage(uint32_t currentFrame, uint32_t imageIndex);
+
+  VkImageView createImageView(VkImage image, VkFormat format,
+                              uint32_t mipLevels = 1);
   void createImageViews();
   void createTextureImageView();
 
@@ -56,6 +88,8 @@ public:
   VkSurfaceFormatKHR chooseSwapSurfaceFormat(
       const std::vector<VkSurfaceFormatKHR> &availableFormats);
 
+  static const char *presentModeName(VkPresentModeKHR mode);
+
   VkPresentModeKHR chooseSwapPresentMode(
       const std::vector<VkPresentModeKHR> &availablePresentModes);
 
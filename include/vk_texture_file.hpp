@@ -0,0 +1,74 @@
+#pragma once
+
+#include "vk_mipmap.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace ve {
+
+// .vtex, written by tools/texture_cooker and loaded by VkModel.
+//
+// TextureFileHeader, then mipLevels TextureFileLevel entries, then the data of
+// every level (level 0 first) in the layout vkCmdCopyBufferToImage expects:
+// tightly packed texels for RGBA8, rows of 4x4 blocks for BCn
+enum class TextureFileFormat : uint32_t {
+  RGBA8 = 0,
+  BC1 = 1, // RGB, 8 bytes per block
+  BC3 = 2, // RGBA, BC1 color + 8 byte alpha block
+  BC7 = 3, // RGBA, 16 bytes per block, best quality
+};
+
+static const uint32_t TEXTURE_FILE_MAGIC = 0x58455456; // "VTEX"
+static const uint32_t TEXTURE_FILE_VERSION = 1;
+
+struct TextureFileHeader {
+  uint32_t magic = TEXTURE_FILE_MAGIC;
+  uint32_t version = TEXTURE_FILE_VERSION;
+  TextureFileFormat format = TextureFileFormat::RGBA8;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t mipLevels = 0;
+};
+
+struct TextureFileLevel {
+  // offset is relative to the start of the level data
+  uint64_t offset;
+  uint64_t size;
+  uint32_t width;
+  uint32_t height;
+};
+
+struct TextureFile {
+  TextureFileHeader header;
+  std::vector<TextureFileLevel> levels;
+  std::vector<uint8_t> data;
+};
+
+// Always the sRGB variant, textures are authored as sRGB colour
+VkFormat textureFileVkFormat(TextureFileFormat format);
+
+// Width/height of a block in texels, 1 for uncompressed
+uint32_t textureFileBlockSize(TextureFileFormat format);
+
+// Bytes per block (per texel for uncompressed)
+uint32_t textureFileBlockBytes(TextureFileFormat format);
+
+const char *textureFileFormatName(TextureFileFormat format);
+
+// Bytes one level takes, whole blocks for BCn
+uint64_t textureFileLevelSize(TextureFileFormat format, uint32_t width,
+                              uint32_t height);
+
+// Returns false if the file doesn't exist or isn't a valid .vtex, including
+// level entries that don't match the header or point outside the file
+bool loadTextureFile(const std::string &filePath, TextureFile &texture);
+
+void saveTextureFile(const std::string &filePath, const TextureFile &texture);
+
+} // namespace ve
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ve {
+
+// Fixed set of worker threads for splitting per frame CPU work (command
+// recording, culling, ...) across cores.
+//
+// dispatch hands out taskCount tasks to whichever worker is free and blocks
+// until all of them are done. Tasks only get their own index, anything they
+// write to has to be split up by task
+class VkEngineThreadPool {
+public:
+  using Task = std::function<void(uint32_t task)>;
+
+  std::vector<std::thread> workers;
+
+  std::mutex mutex;
+  std::condition_variable workAvailable;
+  std::condition_variable workDone;
+
+  // Current dispatch, only changed while no worker is running tasks
+  const Task *job = nullptr;
+  uint32_t taskCount = 0;
+  std::atomic<uint32_t> nextTask{0};
+  std::atomic<uint32_t> tasksFinished{0};
+
+  // Bumped by every dispatch so sleeping workers know there is new work
+  uint64_t generation = 0;
+  // Workers that woke up for the current dispatch and haven't gone back to
+  // sleep yet
+  uint32_t activeWorkers = 0;
+  bool stopping = false;
+
+  // First exception a task threw, rethrown by dispatch on the calling thread
+  std::exception_ptr taskError;
+
+  // 0 picks one less than the number of hardware threads, leaving one for
+  // the main thread
+  VkEngineThreadPool(uint32_t threadCount = 0);
+  ~VkEngineThreadPool();
+
+  // deleting copy constructors
+  VkEngineThreadPool(const VkEngineThreadPool &) = delete;
+  void operator=(const VkEngineThreadPool &) = delete;
+
+  // Number of threads tasks run on, always at least 1
+  uint32_t workerCount() const;
+
+  // Runs task(i) for every i < count and returns once all are done. With no
+  // worker threads the tasks run on the calling thread
+  void dispatch(uint32_t count, const Task &task);
+
+private:
+  void workerLoop();
+  void runTasks();
+};
+
+} // namespace ve
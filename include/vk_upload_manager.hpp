@@ -0,0 +1,130 @@
+#pragma once
+
+#include "vk_device.hpp"
+#include "vk_staging_ring.hpp"
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace ve {
+
+// Batches buffer and image uploads into one command buffer and submits them
+// on the device's transfer queue, instead of a submit + vkQueueWaitIdle per
+// copy.
+//
+// Every flush() signals a timeline semaphore with a new value. A resource is
+// usable once the semaphore reaches the value its upload was flushed with,
+// either check isComplete() on the CPU or let appendWait() make the next
+// graphics submit wait for it on the GPU
+class VkEngineUploadManager {
+public:
+  // A submitted command buffer, freed once the timeline semaphore passes
+  // signalValue
+  struct UploadBatch {
+    VkCommandBuffer commandBuffer;
+    VkCommandPool commandPool;
+    uint64_t signalValue;
+  };
+
+  VkEngineDevice &engineDevice;
+
+  // All upload data is copied through here, space is reclaimed as batches
+  // finish
+  VkEngineStagingRing stagingRing;
+  // Offsets into the ring satisfy the transfer queue's and image copy
+  // alignment rules
+  VkDeviceSize stagingAlignment = 16;
+  // Uploads bigger than this are split so they never need the whole ring
+  VkDeviceSize maxChunkSize;
+
+  // On the transfer family, separate from the device's graphics command pool
+  VkCommandPool commandPool;
+  // For work that has to run on the graphics queue (mipmap blits), submitted
+  // after the transfer batch it depends on
+  VkCommandPool graphicsCommandPool;
+
+  VkSemaphore timelineSemaphore;
+  // Value the next flush() will signal
+  uint64_t nextSignalValue = 1;
+  // Highest value known to have been reached, saves querying the semaphore
+  uint64_t completedValue = 0;
+
+  // Batch being recorded, VK_NULL_HANDLE until the first upload after a flush
+  VkCommandBuffer recordingCommandBuffer = VK_NULL_HANDLE;
+  VkCommandBuffer recordingGraphicsCommandBuffer = VK_NULL_HANDLE;
+
+  std::vector<UploadBatch> inFlightBatches;
+
+  // Stats
+  uint32_t uploadsRecorded = 0;
+  uint32_t batchesSubmitted = 0;
+  // Times an upload had to wait for the GPU to free ring space
+  uint32_t stagingStalls = 0;
+
+  VkEngineUploadManager(VkEngineDevice &eDevice);
+  ~VkEngineUploadManager();
+
+  // deleting copy constructors
+  VkEngineUploadManager(const VkEngineUploadManager &) = delete;
+  void operator=(const VkEngineUploadManager &) = delete;
+
+  void createCommandPools();
+  void createTimelineSemaphore();
+
+  // Copies data into dstBuffer at dstOffset. data can be freed straight away.
+  // Large uploads are split into several copies
+  void uploadBuffer(const void *data, VkDeviceSize size, VkBuffer dstBuffer,
+                    VkDeviceSize dstOffset = 0);
+
+  // Copies tightly packed texels into one mip level of image, which has to
+  // be in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL. blockSize is the texel block
+  // edge of compressed formats (4 for BCn)
+  void uploadImage(const void *data, VkDeviceSize size, VkImage image,
+                   uint32_t width, uint32_t height, uint32_t mipLevel = 0,
+                   uint32_t blockSize = 1);
+
+  // Recorded on the transfer queue. Supports UNDEFINED -> TRANSFER_DST and
+  // TRANSFER_DST -> SHADER_READ_ONLY
+  void transitionImageLayout(VkImage image, uint32_t baseMipLevel,
+                             uint32_t levelCount, VkImageLayout oldLayout,
+                             VkImageLayout newLayout);
+
+  // Fills levels 1..mipLevels-1 from level 0 with linear blits on the
+  // graphics queue. Every level has to be in TRANSFER_DST and level 0 already
+  // uploaded, all levels end up SHADER_READ_ONLY
+  void generateMipmaps(VkImage image, uint32_t width, uint32_t height,
+                       uint32_t mipLevels);
+
+  // Submits everything recorded since the last flush, returns the timeline
+  // value that signals when it's done. Returns the last value again if
+  // nothing was recorded
+  uint64_t flush();
+
+  bool isComplete(uint64_t value);
+  void wait(uint64_t value);
+
+  // Frees command buffers and staging ring space of finished batches
+  void collect();
+
+  // Adds a timeline wait to a graphics submit if any flushed upload hasn't
+  // finished yet, waitValues needs an entry for every wait semaphore
+  void appendWait(std::vector<VkSemaphore> &waitSemaphores,
+                  std::vector<VkPipelineStageFlags> &waitStages,
+                  std::vector<uint64_t> &waitValues);
+
+  VkCommandBuffer getRecordingCommandBuffer();
+  VkCommandBuffer getRecordingGraphicsCommandBuffer();
+  // Submits one recorded command buffer after every earlier batch, on either
+  // queue, and returns the value it signals
+  uint64_t submitBatch(VkQueue queue, VkCommandPool pool,
+                       VkCommandBuffer commandBuffer);
+
+  // Returns an offset into the staging ring, flushing and waiting for older
+  // batches if the ring is full
+  VkDeviceSize allocateStaging(VkDeviceSize size);
+};
+
+} // namespace ve
@@ -15,7 +15,10 @@ public:
   int height;
   std::string windowName;
 
-  VkWindow(int w, int h, std::string name);
+  // When headless no GLFW window is created and window stays nullptr
+  bool headless;
+
+  VkWindow(int w, int h, std::string name, bool isHeadless);
   ~VkWindow();
 
   // deleting copy constructors
@@ -0,0 +1,21 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// Same as simple_shader.frag, but the texture is picked per instance out of
+// one big array instead of being bound to binding 1
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) flat in uint fragTextureIndex;
+
+layout(location = 0) out vec4 outColor;
+
+// VkEngineBindlessTextures, partially bound so only written slots are valid
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+
+void main() {
+    // Neighbouring instances can use different textures, so the index isn't
+    // uniform across the invocations of a draw
+    vec3 texel = texture(textures[nonuniformEXT(fragTextureIndex)], fragTexCoord).rgb;
+    outColor = vec4(fragColor * texel, 1.0);
+}
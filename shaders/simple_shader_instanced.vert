@@ -0,0 +1,31 @@
+#version 450
+
+// Same as simple_shader.vert, but the model matrix and a tint come from a
+// per instance vertex binding so one draw can place many copies
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+} ubo;
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec2 inTexCoord;
+
+// binding 1, VK_VERTEX_INPUT_RATE_INSTANCE. A mat4 takes four locations
+layout(location = 3) in mat4 instanceModel;
+layout(location = 7) in vec4 instanceColor;
+// Slot in the bindless texture array, only read by simple_shader_bindless.frag
+layout(location = 8) in uint instanceTexture;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out uint fragTextureIndex;
+
+void main() {
+    gl_Position = ubo.proj * ubo.view * instanceModel * vec4(inPosition, 0.0, 1.0);
+    fragColor = inColor * instanceColor.rgb;
+    fragTexCoord = inTexCoord;
+    fragTextureIndex = instanceTexture;
+}
@@ -0,0 +1,31 @@
+#version 450
+
+// Same as simple_shader.vert, but the model matrix is pushed with every draw
+// (DrawPushConstants) so all draws of a frame can share one uniform
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+} ubo;
+
+layout(push_constant) uniform DrawPushConstants {
+    mat4 model;
+    uint textureIndex;
+} push;
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec2 inTexCoord;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+// Only read by simple_shader_bindless.frag
+layout(location = 2) flat out uint fragTextureIndex;
+
+void main() {
+    gl_Position = ubo.proj * ubo.view * push.model * vec4(inPosition, 0.0, 1.0);
+    fragColor = inColor;
+    fragTexCoord = inTexCoord;
+    fragTextureIndex = push.textureIndex;
+}
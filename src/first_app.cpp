@@ -2,39 +2,420 @@
 
 namespace ve {
 
-FirstApp::FirstApp() {
+FirstApp::FirstApp(EngineConfig engineConfig) : config{engineConfig} {
+  configureFramePacing();
+
+  // Before any objects exist, they pick their textures from these
+  if (config.bindless) {
+    if (vkEnginePipeline.hasBindless()) {
+      createBindlessTextures();
+      vkEnginePipeline.useBindless = true;
+    } else {
+      std::cout << "--bindless needs descriptor indexing and the bindless "
+                   "shader, using the model texture only\n";
+    }
+  }
+
+  if (config.gpuCullObjectCount > 0) {
+    if (vkEnginePipeline.hasGpuCulling()) {
+      createGpuScene();
+      drawMode = DrawMode::GpuCulled;
+    } else {
+      std::cout << "--gpu-cull needs the cull and instanced shaders, "
+                   "drawIndirectCount and drawIndirectFirstInstance, drawing "
+                   "copies instead\n";
+    }
+  } else if (config.instanced) {
+    if (vkEnginePipeline.hasInstancing()) {
+      drawMode = DrawMode::Instanced;
+    } else {
+      std::cout << "--instanced needs the instanced shader, drawing copies "
+                   "one by one\n";
+    }
+  } else if (config.pushConstants) {
+    if (vkEnginePipeline.hasPushConstants()) {
+      drawMode = DrawMode::PushConstants;
+      vkEnginePipeline.usePushConstants = true;
+    } else {
+      std::cout << "--push-constants needs the push constant shader, using "
+                   "a uniform per copy\n";
+    }
+  }
+
+  // Every separate draw takes a uniform slot, instanced and pushed copies
+  // don't. The instancing benchmark never draws with a uniform per copy
+  bool benchInstancing = config.benchInstancingCount > 0;
+  uint32_t maxDraws = drawMode == DrawMode::Uniforms && !benchInstancing
+                          ? VkModel::MAX_UNIFORMS_PER_FRAME
+                          : VkModel::MAX_INSTANCES_PER_FRAME;
+  drawCount = benchInstancing ? config.benchInstancingCount : config.drawCount;
+  if (drawCount > maxDraws) {
+    std::cout << "Clamping the copy count to " << maxDraws << "\n";
+    drawCount = maxDraws;
+  }
+  createCopyScene();
+
+  if (config.hotReload) {
+    // Compiles and builds pipelines on the watcher thread, drawFrame only
+    // swaps the finished set in. The shader cache compiles by itself when
+    // it can, then no external compiler is needed
+    std::string compiler =
+        VkEngineShaderCache::hasCompiler() ? "" : config.shaderCompiler;
+    vkShaderWatcher.start(
+        "shaders", compiler,
+        [this](const std::vector<std::string> &sourcePaths) {
+          vkEnginePipeline.buildPendingPipelines(sourcePaths);
+        });
+  }
+  if (config.headless) {
+    return;
+  }
   glfwSetWindowUserPointer(vkEngineDevice.vkWindow.window, this);
   glfwSetFramebufferSizeCallback(vkEngineDevice.vkWindow.window,
                                  framebufferResizeCallback);
 }
 FirstApp::~FirstApp() {}
+
+void FirstApp::createBindlessTextures() {
+  // Slot 0 is the model's own texture, the rest are checkerboards in the
+  // primary and secondary colors
+  materialTextures.push_back(vkBindless.addTexture(
+      vkEngineSwapChain.textureImageView, vkEngineSwapChain.textureSampler));
+  for (uint32_t i = 1; i <= BINDLESS_CHECKER_TEXTURES; i++) {
+    glm::vec4 color{static_cast<float>(i & 1), static_cast<float>(i >> 1 & 1),
+                    static_cast<float>(i >> 2 & 1), 1.0f};
+    materialTextures.push_back(
+        vkBindless.createCheckerTexture(64, color, glm::vec4(1.0f)));
+  }
+  std::cout << "Bindless: " << materialTextures.size() << " textures\n";
+}
+
+uint32_t FirstApp::materialTexture(uint32_t index) const {
+  if (materialTextures.empty()) {
+    return 0;
+  }
+  return materialTextures[index % materialTextures.size()];
+}
+
+void FirstApp::createCopyScene() {
+  // With more than one copy they are shrunk down into a grid covering the
+  // same area as the single model
+  uint32_t columns = static_cast<uint32_t>(
+      std::ceil(std::sqrt(static_cast<float>(drawCount))));
+  float cellSize = 2.0f / columns;
+
+  copyEntities.resize(drawCount);
+  copyLeaders.resize(drawCount);
+  spinningLeaders.clear();
+  for (uint32_t i = 0; i < drawCount; i++) {
+    uint32_t column = i % columns;
+    uint32_t row = i / columns;
+
+    // Every COPY_GROUP_SIZE copies along a row are children of the first of
+    // them, so turning that one swings the whole group around it
+    uint32_t groupPosition = column % COPY_GROUP_SIZE;
+    copyLeaders[i] = i - groupPosition;
+    SceneEntity copy;
+    if (groupPosition == 0) {
+      copy = vkScene.createEntity();
+      if (columns > 1) {
+        vkScene.setTranslation(
+            copy, glm::vec3(-1.0f + cellSize * (column + 0.5f),
+                            -1.0f + cellSize * (row + 0.5f), 0.0f));
+        vkScene.setScale(copy, glm::vec3(cellSize));
+      }
+      // Only every other row moves, the scene skips the still subtrees
+      if (row % 2 == 0) {
+        spinningLeaders.push_back(copy);
+      }
+    } else {
+      // In the leader's space, where a cell is 1 across
+      copy = vkScene.createEntity(copyEntities[copyLeaders[i]]);
+      vkScene.setTranslation(
+          copy, glm::vec3(static_cast<float>(groupPosition), 0.0f, 0.0f));
+    }
+    // Fade the tint across the grid so the copies can be told apart
+    float t = drawCount > 1 ? static_cast<float>(i) / (drawCount - 1) : 0.0f;
+    vkScene.setColor(copy,
+                     glm::vec4(1.0f - 0.5f * t, 1.0f, 0.5f + 0.5f * t, 1.0f));
+    // Neighbouring copies get different textures, still one instanced draw
+    vkScene.setTextureIndex(copy, materialTexture(i));
+    copyEntities[i] = copy;
+  }
+}
+
+void FirstApp::createGpuScene() {
+  uint32_t objectCount =
+      std::min(config.gpuCullObjectCount, VkEngineGpuScene::MAX_OBJECTS);
+  uint32_t columns = static_cast<uint32_t>(
+      std::ceil(std::sqrt(static_cast<float>(objectCount))));
+  float halfExtent = 0.5f * GPU_SCENE_SPACING * (columns - 1);
+
+  // A flat grid centred on the origin, far bigger than the view so most of
+  // it is culled every frame
+  std::vector<InstanceData> objects(objectCount);
+  for (uint32_t i = 0; i < objectCount; i++) {
+    glm::vec3 position{GPU_SCENE_SPACING * (i % columns) - halfExtent,
+                       GPU_SCENE_SPACING * (i / columns) - halfExtent, 0.0f};
+    objects[i].model = glm::translate(glm::mat4(1.0f), position);
+    float t = static_cast<float>(i % columns) / columns;
+    objects[i].color = glm::vec4(1.0f - 0.5f * t, 1.0f, 0.5f + 0.5f * t, 1.0f);
+    objects[i].textureIndex = materialTexture(i);
+  }
+
+  vkGpuScene.setObjects(objects);
+}
+
+void FirstApp::configureFramePacing() {
+  if (config.framesInFlight > 0) {
+    vkFramePacer.setFramesInFlight(config.framesInFlight);
+  }
+  if (config.fpsCap > 0) {
+    vkFramePacer.frameCapMs = 1000.0 / config.fpsCap;
+  }
+  if (config.lowLatency) {
+    // The GPU frame time comes from the profiler's timestamps
+    if (vkProfiler.enabled) {
+      vkFramePacer.lowLatency = true;
+    } else {
+      std::cout << "--low-latency needs timestamp queries, frames aren't "
+                   "delayed\n";
+    }
+  }
+}
+
+double FirstApp::gpuFrameMs() const {
+  ProfileScopeResult result;
+  if (!vkProfiler.getScopeResult("frame", result)) {
+    return 0.0;
+  }
+  return result.gpuMs;
+}
+
 void FirstApp::run() {
   std::cout << "In Run\n";
 
+  if (config.benchInstancingCount > 0) {
+    runInstancingBenchmark();
+    return;
+  }
+
+  if (config.benchCullingCount > 0) {
+    runCullingBenchmark();
+    return;
+  }
+
+  if (config.headless) {
+    runHeadless();
+    return;
+  }
+
   while (!vkWindow.shouldClose()) {
+    // Any frame cap or low latency sleep happens before input is read
+    vkFramePacer.throttle(gpuFrameMs());
     glfwPollEvents();
     drawFrame();
   }
 
   vkDeviceWaitIdle(vkEngineDevice.logicalDevice);
+  vkFramePacer.report();
+  vkProfiler.report();
+  vkParallelRecorder.report();
+  vkScene.report();
+  vkShaderWatcher.report();
+}
+
+void FirstApp::runHeadless() {
+  std::cout << "Rendering " << config.headlessFrameCount
+            << " headless frames\n";
+
+  auto startTime = std::chrono::high_resolution_clock::now();
+
+  for (uint32_t frame = 0; frame < config.headlessFrameCount; frame++) {
+    vkFramePacer.throttle(gpuFrameMs());
+    drawFrame();
+  }
+  vkDeviceWaitIdle(vkEngineDevice.logicalDevice);
+  vkFramePacer.report();
+  vkProfiler.report();
+  vkParallelRecorder.report();
+  vkScene.report();
+  vkShaderWatcher.report();
+
+  auto endTime = std::chrono::high_resolution_clock::now();
+  double seconds =
+      std::chrono::duration<double, std::chrono::seconds::period>(endTime -
+                                                                  startTime)
+          .count();
+
+  std::cout << "Headless: " << config.headlessFrameCount << " frames in "
+            << seconds << "s, "
+            << (seconds > 0.0 ? config.headlessFrameCount / seconds : 0.0)
+            << " fps, "
+            << (config.headlessFrameCount > 0
+                    ? (seconds * 1000.0) / config.headlessFrameCount
+                    : 0.0)
+            << " ms/frame\n";
+}
+
+void FirstApp::runInstancingBenchmark() {
+  if (!vkEnginePipeline.hasInstancing()) {
+    std::cout << "Instancing benchmark needs "
+              << vkEnginePipeline.instancedVertexCodeFilePath << "\n";
+    return;
+  }
+
+  std::cout << "Instancing benchmark: " << drawCount << " copies, "
+            << BENCH_FRAMES << " frames per mode\n";
+
+  // Both instance modes read the same InstanceData, so the only difference
+  // is the number of draw calls. Pushed draws are as many draws, without
+  // the per draw descriptor rebind
+  benchmarkDrawMode(DrawMode::SeparateInstances, "separate draws");
+  if (vkEnginePipeline.hasPushConstants()) {
+    benchmarkDrawMode(DrawMode::PushConstants, "pushed draws");
+  }
+  benchmarkDrawMode(DrawMode::Instanced, "one instanced draw");
+}
+
+void FirstApp::benchmarkDrawMode(DrawMode mode, const char *name) {
+  drawMode = mode;
+  vkEnginePipeline.usePushConstants = mode == DrawMode::PushConstants;
+
+  double frameMsTotal = 0.0;
+  double recordMsTotal = 0.0;
+  double gpuMsTotal = 0.0;
+  uint32_t gpuSamples = 0;
+
+  for (uint32_t frame = 0; frame < BENCH_WARMUP_FRAMES + BENCH_FRAMES;
+       frame++) {
+    if (!config.headless) {
+      glfwPollEvents();
+    }
+
+    // Cached secondaries would hide the per draw recording cost, re-record
+    // everything like a fully dynamic scene would
+    vkEnginePipeline.markCommandsDirty();
+
+    auto frameStart = std::chrono::high_resolution_clock::now();
+    drawFrame();
+    double frameMs =
+        std::chrono::duration<double, std::chrono::milliseconds::period>(
+            std::chrono::high_resolution_clock::now() - frameStart)
+            .count();
+
+    if (frame < BENCH_WARMUP_FRAMES) {
+      continue;
+    }
+    frameMsTotal += frameMs;
+    recordMsTotal += lastRecordMs;
+
+    // Lags a few frames behind, all of them are in the same mode by then
+    ProfileScopeResult mainPass;
+    if (frame >= BENCH_WARMUP_FRAMES + VkEngineDevice::MAX_FRAMES_IN_FLIGHT &&
+        vkProfiler.getScopeResult("main pass", mainPass)) {
+      gpuMsTotal += mainPass.gpuMs;
+      gpuSamples++;
+    }
+  }
+  vkDeviceWaitIdle(vkEngineDevice.logicalDevice);
+
+  std::cout << "  " << name << ": " << frameMsTotal / BENCH_FRAMES
+            << " ms/frame, " << recordMsTotal / BENCH_FRAMES
+            << " ms CPU recording";
+  if (gpuSamples > 0) {
+    std::cout << ", " << gpuMsTotal / gpuSamples << " ms GPU main pass";
+  }
+  std::cout << "\n";
+}
+
+void FirstApp::runCullingBenchmark() {
+  uint32_t objectCount = config.benchCullingCount;
+
+  // Random boxes scattered through a volume much bigger than the frustum, so
+  // all of the early outs get exercised
+  std::mt19937 random{1234};
+  std::uniform_real_distribution<float> position{-200.0f, 200.0f};
+  std::uniform_real_distribution<float> size{0.25f, 4.0f};
+  std::vector<CullBounds> bounds(objectCount);
+  for (auto &object : bounds) {
+    object.center = glm::vec3(position(random), position(random),
+                              position(random));
+    object.extents = glm::vec3(size(random), size(random), size(random));
+    object.radius = glm::length(object.extents);
+  }
+  vkCuller.setObjects(bounds);
+
+  glm::mat4 view =
+      glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(1.0f, 0.3f, 0.2f),
+                  glm::vec3(0.0f, 0.0f, 1.0f));
+  glm::mat4 proj = glm::perspective(glm::radians(60.0f),
+                                    WIDTH / (float)HEIGHT, 0.1f, 150.0f);
+  glm::vec4 planes[6];
+  VkEngineCuller::extractFrustumPlanes(proj * view, planes);
+
+  std::cout << "Culling benchmark: " << objectCount << " objects, "
+            << BENCH_CULL_REPEATS << " culls per kernel, "
+            << vkThreadPool.workerCount() << " worker threads\n";
+
+  std::vector<uint32_t> visible;
+  uint32_t baselineVisible = 0;
+  double baselineSeconds = 0.0;
+
+  auto benchmark = [&](VkEngineCuller::Kernel kernel, bool parallel) {
+    if (!VkEngineCuller::kernelSupported(kernel)) {
+      return;
+    }
+    // Warm up the caches and the worker threads
+    vkCuller.cullWith(kernel, planes, parallel, visible);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (uint32_t i = 0; i < BENCH_CULL_REPEATS; i++) {
+      vkCuller.cullWith(kernel, planes, parallel, visible);
+    }
+    double seconds =
+        std::chrono::duration<double, std::chrono::seconds::period>(
+            std::chrono::high_resolution_clock::now() - start)
+            .count();
+
+    uint32_t visibleCount = static_cast<uint32_t>(visible.size());
+    if (baselineSeconds == 0.0) {
+      baselineVisible = visibleCount;
+      baselineSeconds = seconds;
+    }
+
+    std::cout << "  " << VkEngineCuller::kernelName(kernel)
+              << (parallel ? " threaded" : "") << ": "
+              << objectCount * (BENCH_CULL_REPEATS / seconds) / 1e6
+              << " M objects/s, " << baselineSeconds / seconds
+              << "x scalar, " << visibleCount << " visible";
+    if (visibleCount != baselineVisible) {
+      std::cout << " (MISMATCH, scalar found " << baselineVisible << ")";
+    }
+    std::cout << "\n";
+  };
+
+  // Scalar glm first, everything else is compared against it
+  benchmark(VkEngineCuller::Kernel::Scalar, false);
+  benchmark(VkEngineCuller::Kernel::Sse, false);
+  benchmark(VkEngineCuller::Kernel::Avx2, false);
+  benchmark(vkCuller.kernel, true);
 }
 
 void FirstApp::drawFrame() {
-  // Wait for frame to be signalled before returning
-  // Remember fences need to be initialzed since they are unsignaled state by
-  // default
-  vkWaitForFences(vkEngineDevice.logicalDevice, 1,
-                  &vkEngineSwapChain.inFlightFences[currentFrame], VK_TRUE,
-                  UINT64_MAX);
+  // Only blocks if the GPU is still on the frame that last used this slot
+  vkFramePacer.waitForFrame();
+  uint32_t currentFrame = vkFramePacer.currentFrame;
+  vkEnginePipeline.resetFrameDescriptors(currentFrame);
+  // Reloaded shaders take effect at a frame boundary, nothing recorded yet
+  vkEnginePipeline.swapPendingPipelines();
 
   uint32_t imageIndex;
 
   // First get the next free image on the swapchain that is not being rendered
   // to The semaphore will let us know
-  VkResult result = vkAcquireNextImageKHR(
-      vkEngineDevice.logicalDevice, vkEngineSwapChain.swapChain, UINT64_MAX,
-      vkEngineSwapChain.imageAvailableSemaphore[currentFrame], VK_NULL_HANDLE,
-      &imageIndex);
+  VkResult result =
+      vkEngineSwapChain.acquireNextImage(currentFrame, &imageIndex);
 
   if (result == VK_ERROR_OUT_OF_DATE_KHR) {
     vkEnginePipeline.recreateSwapChain();
@@ -43,90 +424,82 @@ void FirstApp::drawFrame() {
     throw std::runtime_error("Failed to acquire swapchain image");
   }
 
-  updateUniformBuffer(imageIndex);
+  auto recordStart = std::chrono::high_resolution_clock::now();
 
-  // If a fence for this swap chain image has been created already, we have to
-  // wait for it before rendering to it in case it's currently being rendered
-  // to, since we might acquire the image out of order
+  // This frame's fence has signaled so its region of the uniform ring is free
+  updateUniformBuffer(currentFrame);
 
-  if (vkEngineSwapChain.imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
-    vkWaitForFences(vkEngineDevice.logicalDevice, 1,
-                    &vkEngineSwapChain.imagesInFlight[imageIndex], VK_TRUE,
-                    UINT64_MAX);
-  }
+  vkFramePacer.waitForImage(imageIndex);
+
+  // This frame slot's previous submission is done so its command buffer can
+  // be re-recorded
+  vkEnginePipeline.recordCommandBuffer(
+      imageIndex, currentFrame, drawCalls,
+      drawMode == DrawMode::GpuCulled ? &gpuSceneDraw : nullptr);
 
-  // After waiting set the current image's fence to the current frame fence
-  vkEngineSwapChain.imagesInFlight[imageIndex] =
-      vkEngineSwapChain.inFlightFences[currentFrame];
+  lastRecordMs =
+      std::chrono::duration<double, std::chrono::milliseconds::period>(
+          std::chrono::high_resolution_clock::now() - recordStart)
+          .count();
 
   // Create the command buffer to submit it to the queue
   VkSubmitInfo submitInfo{};
   submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
   // which semaphore to wait on before execution begins
-  VkSemaphore waitSemaphores[] = {
-      vkEngineSwapChain.imageAvailableSemaphore[currentFrame]};
-
+  std::vector<VkSemaphore> waitSemaphores;
   // which stage to wait on before execution beings
-  VkPipelineStageFlags waitStages[] = {
-      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+  std::vector<VkPipelineStageFlags> waitStages;
+  // only read for timeline semaphores, binary ones ignore their entry
+  std::vector<uint64_t> waitValues;
+
+  // Offscreen images are never acquired from a presentation engine so there is
+  // nothing to wait on when headless
+  if (!vkEngineDevice.headless) {
+    waitSemaphores.push_back(
+        vkEngineSwapChain.imageAvailableSemaphore[currentFrame]);
+    waitStages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+    waitValues.push_back(0);
+  }
+
+  // Waits on the GPU for uploads that haven't landed yet instead of stalling
+  // the CPU, does nothing once they're done
+  vkUploadManager.appendWait(waitSemaphores, waitStages, waitValues);
 
-  submitInfo.waitSemaphoreCount = 1;
-  submitInfo.pWaitSemaphores = waitSemaphores;
-  submitInfo.pWaitDstStageMask = waitStages;
+  VkTimelineSemaphoreSubmitInfo timelineInfo{};
+  timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+  timelineInfo.waitSemaphoreValueCount =
+      static_cast<uint32_t>(waitValues.size());
+  timelineInfo.pWaitSemaphoreValues = waitValues.data();
+  submitInfo.pNext = &timelineInfo;
+
+  submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+  submitInfo.pWaitSemaphores = waitSemaphores.data();
+  submitInfo.pWaitDstStageMask = waitStages.data();
 
   // which command buffer to submit for execution
-  // should submit the command buffer that binds the swap chain image we just
-  // acquired as color attachment the imageIndex we got from acquiring the next
-  // free image
+  // one per frame in flight, recorded above against the framebuffer of the
+  // swap chain image we just acquired
   submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &vkEnginePipeline.commandBuffers[imageIndex];
+  submitInfo.pCommandBuffers = &vkEnginePipeline.commandBuffers[currentFrame];
 
   // specify which sempahre to signal once command buffer has finished execution
   VkSemaphore signalSemaphores[] = {
       vkEngineSwapChain.renderFinishedSemaphore[currentFrame]};
-  submitInfo.signalSemaphoreCount = 1;
+  submitInfo.signalSemaphoreCount = vkEngineDevice.headless ? 0 : 1;
   submitInfo.pSignalSemaphores = signalSemaphores;
 
-  // then we reset that fence to the unsignalled state for next loop
-  // called here and not at the start of loop because we need to set image fence
-  // to frame fence
-  // Usually best to fall before actually using the fence
-  vkResetFences(vkEngineDevice.logicalDevice, 1,
-                &vkEngineSwapChain.inFlightFences[currentFrame]);
-
   // Can take array of submitinfo structs for efficieny
   if (vkQueueSubmit(vkEngineDevice.graphicsQueue, 1, &submitInfo,
-                    vkEngineSwapChain.inFlightFences[currentFrame]) !=
-      VK_SUCCESS) {
+                    vkFramePacer.beginSubmit()) != VK_SUCCESS) {
     throw std::runtime_error("failed to submit draw command buffer!");
   }
 
   // Next we submit the result back to the swap chain to have it eventually show
   // up on screen
 
-  VkPresentInfoKHR presentInfo{};
-  presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-
-  // which semaphore to wait on before presentation, same as specified above for
-  // command buffer to signal when it has finished
-  presentInfo.waitSemaphoreCount = 1;
-  presentInfo.pWaitSemaphores = signalSemaphores;
-
-  // which swapChain to present images to and the index of the image for each
-  // swap chain
-  VkSwapchainKHR swapChains[] = {vkEngineSwapChain.swapChain};
-  presentInfo.swapchainCount = 1;
-  presentInfo.pSwapchains = swapChains;
-  presentInfo.pImageIndices = &imageIndex;
-
-  // Allows you to specify array of VkResult values to check every individual
-  // swap chain not necessary for single swapchain, we can just check for reture
-  // value of present function
-  presentInfo.pResults = nullptr; // Optional
-
-  // submits request to present and image to the swap chain
-  result = vkQueuePresentKHR(vkEngineDevice.presentQueue, &presentInfo);
+  // Skips presentation entirely when headless
+  result = vkEngineSwapChain.presentImage(currentFrame, imageIndex);
   if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR ||
       frameBufferResized) {
     frameBufferResized = false;
@@ -135,11 +508,12 @@ void FirstApp::drawFrame() {
     throw std::runtime_error("failed to present swap chain image");
   }
 
-  // this waits for the present queue to be idle before submitting to it again
-  vkQueueWaitIdle(vkEngineDevice.presentQueue);
+  // No vkQueueWaitIdle here, the CPU goes straight on to the next frame while
+  // the GPU is still busy with this one
+  vkFramePacer.endFrame();
 
-  // update the current frame so it goes to the next one
-  currentFrame = (currentFrame + 1) % VkEngineDevice::MAX_FRAMES_IN_FLIGHT;
+  // Release staging memory of uploads that have finished
+  vkUploadManager.collect();
 }
 
 void FirstApp::framebufferResizeCallback(GLFWwindow *window, int width,
@@ -150,7 +524,7 @@ void FirstApp::framebufferResizeCallback(GLFWwindow *window, int width,
   app->frameBufferResized = true;
 }
 
-void FirstApp::updateUniformBuffer(uint32_t currentImage) {
+void FirstApp::updateUniformBuffer(uint32_t frameIndex) {
   static auto startTime = std::chrono::high_resolution_clock::now();
   auto currentTime = std::chrono::high_resolution_clock::now();
 
@@ -158,27 +532,170 @@ void FirstApp::updateUniformBuffer(uint32_t currentImage) {
                    currentTime - startTime)
                    .count();
 
-  UniformBufferObject ubo{};
+  vkModel.beginUniformFrame(frameIndex);
+  vkModel.beginInstanceFrame(frameIndex);
+  drawCalls.clear();
+
+  float aspect = vkEngineSwapChain.swapChainExtent.width /
+                 (float)vkEngineSwapChain.swapChainExtent.height;
 
-  ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f),
-                          glm::vec3(0.0f, 0.0f, 1.0f));
-  ubo.view =
+  if (drawMode == DrawMode::GpuCulled) {
+    updateGpuScene(frameIndex, time, aspect);
+    return;
+  }
+
+  glm::mat4 view =
       glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f),
                   glm::vec3(0.0f, 0.0f, 1.0f));
 
-  ubo.proj =
-      glm::perspective(glm::radians(45.0f),
-                       vkEngineSwapChain.swapChainExtent.width /
-                           (float)vkEngineSwapChain.swapChainExtent.height,
-                       0.1f, 10.0f);
-
-  void *data;
-  vkMapMemory(vkEngineDevice.logicalDevice,
-              vkModel.uniformBuffersMemory[currentImage], 0, sizeof(ubo), 0,
-              &data);
-  memcpy(data, &ubo, sizeof(ubo));
-  vkUnmapMemory(vkEngineDevice.logicalDevice,
-                vkModel.uniformBuffersMemory[currentImage]);
+  glm::mat4 proj =
+      glm::perspective(glm::radians(45.0f), aspect, 0.1f, 10.0f);
+
+  // Only the spinning leaders are touched, their groups follow through the
+  // hierarchy and the scene only recomputes those subtrees
+  glm::quat spin = glm::angleAxis(time * glm::radians(90.0f),
+                                  glm::vec3(0.0f, 0.0f, 1.0f));
+  for (SceneEntity leader : spinningLeaders) {
+    vkScene.setRotation(leader, spin);
+  }
+  vkScene.update();
+
+  updateVisibleCopies(proj * view);
+
+  if (drawMode == DrawMode::Uniforms) {
+    for (uint32_t i : visibleCopies) {
+      // Written straight into the persistently mapped ring, no map/unmap
+      DrawCall drawCall{};
+      UniformBufferObject *ubo = static_cast<UniformBufferObject *>(
+          vkModel.allocateUniform(frameIndex, sizeof(UniformBufferObject),
+                                  drawCall.uniformOffset));
+
+      ubo->model = vkScene.worldMatrix(copyEntities[i]);
+      ubo->view = view;
+      ubo->proj = proj;
+
+      drawCalls.push_back(drawCall);
+    }
+    return;
+  }
+
+  // The other modes share one uniform for view/proj, the model matrix of
+  // every copy is pushed or goes into the instance buffer
+  DrawCall drawCall{};
+  UniformBufferObject *ubo = static_cast<UniformBufferObject *>(
+      vkModel.allocateUniform(frameIndex, sizeof(UniformBufferObject),
+                              drawCall.uniformOffset));
+  ubo->model = glm::mat4(1.0f);
+  ubo->view = view;
+  ubo->proj = proj;
+
+  if (drawMode == DrawMode::PushConstants) {
+    for (uint32_t i : visibleCopies) {
+      SceneEntity copy = copyEntities[i];
+      drawCall.push.model = vkScene.worldMatrix(copy);
+      drawCall.push.textureIndex = vkScene.entityTextureIndex(copy);
+      drawCalls.push_back(drawCall);
+    }
+    return;
+  }
+
+  uint32_t visibleCount = static_cast<uint32_t>(visibleCopies.size());
+  if (visibleCount == 0) {
+    return;
+  }
+
+  InstanceData *instances = vkModel.allocateInstances(
+      frameIndex, visibleCount, drawCall.firstInstance);
+  if (!config.cpuCull) {
+    // Every copy in the scene's slot order (parents before their children),
+    // which lets it copy over only what changed since this frame slot was
+    // last written. Nothing is culled, so the order doesn't matter
+    vkScene.writeInstances(frameIndex, instances);
+  } else {
+    for (uint32_t v = 0; v < visibleCount; v++) {
+      SceneEntity copy = copyEntities[visibleCopies[v]];
+      instances[v].model = vkScene.worldMatrix(copy);
+      instances[v].color = vkScene.entityColor(copy);
+      instances[v].textureIndex = vkScene.entityTextureIndex(copy);
+    }
+  }
+
+  if (drawMode == DrawMode::Instanced) {
+    drawCall.instanceCount = visibleCount;
+    drawCalls.push_back(drawCall);
+    return;
+  }
+
+  uint32_t firstInstance = drawCall.firstInstance;
+  for (uint32_t i = 0; i < visibleCount; i++) {
+    drawCall.instanceCount = 1;
+    drawCall.firstInstance = firstInstance + i;
+    drawCalls.push_back(drawCall);
+  }
+}
+
+void FirstApp::updateGpuScene(uint32_t frameIndex, float time, float aspect) {
+  // Circles over the grid looking down at an angle, so the visible set keeps
+  // changing
+  float radius = 0.25f * GPU_SCENE_SPACING *
+                 std::sqrt(static_cast<float>(vkGpuScene.objectCount));
+  glm::vec3 target{radius * std::cos(time * 0.2f),
+                   radius * std::sin(time * 0.2f), 0.0f};
+  glm::vec3 eye = target + glm::vec3(-10.0f, -10.0f, 8.0f);
+
+  glm::mat4 view = glm::lookAt(eye, target, glm::vec3(0.0f, 0.0f, 1.0f));
+  glm::mat4 proj = glm::perspective(glm::radians(45.0f), aspect, 0.1f, 100.0f);
+
+  UniformBufferObject *ubo = static_cast<UniformBufferObject *>(
+      vkModel.allocateUniform(frameIndex, sizeof(UniformBufferObject),
+                              gpuSceneDraw.uniformOffset));
+  ubo->model = glm::mat4(1.0f);
+  ubo->view = view;
+  ubo->proj = proj;
+
+  // Culled against the same matrices the vertex shader draws with
+  CullParams *cullParams = static_cast<CullParams *>(vkModel.allocateUniform(
+      frameIndex, sizeof(CullParams), gpuSceneDraw.cullParamsOffset));
+  VkEngineCuller::extractFrustumPlanes(proj * view, cullParams->planes);
+  cullParams->objectCount = vkGpuScene.objectCount;
+}
+
+void FirstApp::updateVisibleCopies(const glm::mat4 &viewProj) {
+  if (!config.cpuCull) {
+    visibleCopies.resize(drawCount);
+    for (uint32_t i = 0; i < drawCount; i++) {
+      visibleCopies[i] = i;
+    }
+    return;
+  }
+
+  // Leaders spin in place and the rest of a group circles its leader, so a
+  // sphere around the leader reaching past the copy holds at any angle and
+  // the bounds are set once per count
+  if (culledCopyCount != drawCount) {
+    float localRadius = 0.0f;
+    for (const auto &vertex : vkModel.vertices) {
+      localRadius = std::max(localRadius, glm::length(vertex.pos));
+    }
+
+    std::vector<CullBounds> bounds(drawCount);
+    for (uint32_t i = 0; i < drawCount; i++) {
+      const glm::mat4 &world = vkScene.worldMatrix(copyEntities[i]);
+      const glm::mat4 &leaderWorld =
+          vkScene.worldMatrix(copyEntities[copyLeaders[i]]);
+      float copyRadius = localRadius * glm::length(glm::vec3(world[0]));
+      float orbitRadius =
+          glm::length(glm::vec3(world[3]) - glm::vec3(leaderWorld[3]));
+      bounds[i].center = glm::vec3(leaderWorld[3]);
+      bounds[i].radius = orbitRadius + copyRadius;
+      // Flat and turning about z, whatever the angle it stays in the plane
+      bounds[i].extents = glm::vec3(bounds[i].radius, bounds[i].radius, 0.0f);
+    }
+    vkCuller.setObjects(bounds);
+    culledCopyCount = drawCount;
+  }
+
+  vkCuller.cull(viewProj, visibleCopies);
 }
 
 } // namespace ve
\ No newline at end of file
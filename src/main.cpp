@@ -1,8 +1,116 @@
 #include "main.hpp"
 
-int main() {
+// std::stoul throws on text and quietly wraps negative numbers, and this
+// runs before main's try, so a bad value ends the program here with a
+// message instead
+static uint32_t parseCount(const std::string &option, const char *value,
+                           uint32_t minimum = 0) {
+  std::string text = value;
+  try {
+    size_t parsed = 0;
+    unsigned long count = std::stoul(text, &parsed);
+    if (parsed == text.size() && text.find('-') == std::string::npos &&
+        count >= minimum && count <= std::numeric_limits<uint32_t>::max()) {
+      return static_cast<uint32_t>(count);
+    }
+  } catch (const std::exception &) {
+  }
+  std::cerr << "Invalid value for " << option << ": " << text << "\n";
+  std::exit(EXIT_FAILURE);
+}
+
+// --headless         render offscreen without a window or swapchain
+// --frames <count>   number of frames to render when headless, at least 1
+// --serialize        wait for the GPU after every frame (no frames in flight)
+// --frames-in-flight <count>
+//                    frames queued ahead of the GPU, 1 to 3
+// --present-mode <immediate|mailbox|fifo|fifo-relaxed>
+//                    swap chain present mode, if the surface supports it
+// --swap-images <count>
+//                    swap chain images to ask for
+// --fps-cap <fps>    cap the frame rate
+// --low-latency      start each frame as late as the measured GPU time
+//                    allows, so input is read just before it's needed
+// --draws <count>    number of copies of the model to draw each frame
+// --record-threads <count>
+//                    worker threads recording command buffers (0 = auto)
+// --instanced        draw the copies with one instanced draw
+// --bench-instancing <count>
+//                    compare count separate draws with one instanced draw
+// --gpu-cull <count> draw a grid of count objects culled on the GPU
+// --cpu-cull         frustum cull the copies on the CPU before drawing
+// --bench-culling <count>
+//                    time the CPU culling kernels on count random objects
+// --bindless         give the instanced copies their own textures, sampled
+//                    from one descriptor indexed array
+// --push-constants   draw the copies one by one, pushing each model matrix
+// --hot-reload       recompile and reload shaders when their source is saved
+// --shader-compiler <path>
+//                    GLSL compiler used by --hot-reload (default glslc),
+//                    unused when the engine compiles shaders itself
+ve::EngineConfig parseArgs(int argc, char **argv) {
+  ve::EngineConfig config{};
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--headless") {
+      config.headless = true;
+    } else if (arg == "--serialize") {
+      config.serializeFrames = true;
+    } else if (arg == "--frames-in-flight" && i + 1 < argc) {
+      config.framesInFlight = parseCount(arg, argv[++i]);
+    } else if (arg == "--present-mode" && i + 1 < argc) {
+      std::string mode = argv[++i];
+      if (mode == "immediate") {
+        config.presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+      } else if (mode == "mailbox") {
+        config.presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+      } else if (mode == "fifo") {
+        config.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+      } else if (mode == "fifo-relaxed") {
+        config.presentMode = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+      } else {
+        std::cerr << "Unknown present mode: " << mode << "\n";
+      }
+    } else if (arg == "--swap-images" && i + 1 < argc) {
+      config.swapChainImages = parseCount(arg, argv[++i]);
+    } else if (arg == "--fps-cap" && i + 1 < argc) {
+      config.fpsCap = parseCount(arg, argv[++i]);
+    } else if (arg == "--low-latency") {
+      config.lowLatency = true;
+    } else if (arg == "--frames" && i + 1 < argc) {
+      config.headlessFrameCount = parseCount(arg, argv[++i], 1);
+    } else if (arg == "--draws" && i + 1 < argc) {
+      config.drawCount = parseCount(arg, argv[++i]);
+    } else if (arg == "--record-threads" && i + 1 < argc) {
+      config.recordThreads = parseCount(arg, argv[++i]);
+    } else if (arg == "--instanced") {
+      config.instanced = true;
+    } else if (arg == "--bench-instancing" && i + 1 < argc) {
+      config.benchInstancingCount = parseCount(arg, argv[++i]);
+    } else if (arg == "--gpu-cull" && i + 1 < argc) {
+      config.gpuCullObjectCount = parseCount(arg, argv[++i]);
+    } else if (arg == "--cpu-cull") {
+      config.cpuCull = true;
+    } else if (arg == "--bench-culling" && i + 1 < argc) {
+      config.benchCullingCount = parseCount(arg, argv[++i]);
+    } else if (arg == "--bindless") {
+      config.bindless = true;
+    } else if (arg == "--push-constants") {
+      config.pushConstants = true;
+    } else if (arg == "--hot-reload") {
+      config.hotReload = true;
+    } else if (arg == "--shader-compiler" && i + 1 < argc) {
+      config.shaderCompiler = argv[++i];
+    } else {
+      std::cerr << "Unknown argument: " << arg << "\n";
+    }
+  }
+  return config;
+}
+
+int main(int argc, char **argv) {
   std::cout << "Starting App Tho\n";
-  ve::FirstApp app;
+  ve::FirstApp app{parseArgs(argc, argv)};
 
   try {
     app.run();
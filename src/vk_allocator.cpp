@@ -0,0 +1,310 @@
+#include "vk_allocator.hpp"
+
+namespace ve {
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+bool VkEngineMemoryBlock::allocate(VkDeviceSize allocSize,
+                                   VkDeviceSize alignment,
+                                   VkDeviceSize &outOffset) {
+  // First fit, the padding needed for alignment stays in the free list
+  for (size_t i = 0; i < freeRanges.size(); i++) {
+    FreeRange range = freeRanges[i];
+    VkDeviceSize alignedOffset = alignUp(range.offset, alignment);
+    VkDeviceSize padding = alignedOffset - range.offset;
+
+    if (padding + allocSize > range.size) {
+      continue;
+    }
+
+    VkDeviceSize tailOffset = alignedOffset + allocSize;
+    VkDeviceSize tailSize = range.size - padding - allocSize;
+
+    freeRanges.erase(freeRanges.begin() + i);
+    if (tailSize > 0) {
+      freeRanges.insert(freeRanges.begin() + i, {tailOffset, tailSize});
+    }
+    if (padding > 0) {
+      freeRanges.insert(freeRanges.begin() + i, {range.offset, padding});
+    }
+
+    outOffset = alignedOffset;
+    allocationCount++;
+    return true;
+  }
+  return false;
+}
+
+void VkEngineMemoryBlock::free(VkDeviceSize offset, VkDeviceSize allocSize) {
+  // Find where this range goes so the list stays sorted
+  size_t i = 0;
+  while (i < freeRanges.size() && freeRanges[i].offset < offset) {
+    i++;
+  }
+  freeRanges.insert(freeRanges.begin() + i, {offset, allocSize});
+
+  // merge with the next range
+  if (i + 1 < freeRanges.size() &&
+      freeRanges[i].offset + freeRanges[i].size == freeRanges[i + 1].offset) {
+    freeRanges[i].size += freeRanges[i + 1].size;
+    freeRanges.erase(freeRanges.begin() + i + 1);
+  }
+  // merge with the previous range
+  if (i > 0 && freeRanges[i - 1].offset + freeRanges[i - 1].size ==
+                   freeRanges[i].offset) {
+    freeRanges[i - 1].size += freeRanges[i].size;
+    freeRanges.erase(freeRanges.begin() + i);
+  }
+  allocationCount--;
+}
+
+void VkEngineAllocator::init(VkPhysicalDevice physical, VkDevice device) {
+  physicalDevice = physical;
+  logicalDevice = device;
+
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+  VkPhysicalDeviceProperties properties{};
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  bufferImageGranularity = properties.limits.bufferImageGranularity;
+
+  std::cout << "Allocator: " << memProperties.memoryTypeCount
+            << " memory types, bufferImageGranularity "
+            << bufferImageGranularity << " maxMemoryAllocationCount "
+            << properties.limits.maxMemoryAllocationCount << "\n";
+}
+
+void VkEngineAllocator::cleanup() {
+  printStats();
+  for (uint32_t type = 0; type < VK_MAX_MEMORY_TYPES; type++) {
+    for (int kind = 0; kind < 2; kind++) {
+      for (auto &block : blocks[type][kind]) {
+        if (block->allocationCount > 0) {
+          std::cout << "Allocator: leaked " << block->allocationCount
+                    << " allocations in memory type " << type << "\n";
+        }
+        if (block->mappedData != nullptr) {
+          vkUnmapMemory(logicalDevice, block->memory);
+        }
+        vkFreeMemory(logicalDevice, block->memory, nullptr);
+      }
+      blocks[type][kind].clear();
+    }
+  }
+}
+
+uint32_t VkEngineAllocator::findMemoryType(uint32_t typeFilter,
+                                           VkMemoryPropertyFlags properties) {
+  uint64_t key = (static_cast<uint64_t>(typeFilter) << 32) | properties;
+  auto cached = memoryTypeCache.find(key);
+  if (cached != memoryTypeCache.end()) {
+    return cached->second;
+  }
+
+  for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+    // typeFiler specifies the bit field of memory types that are suitable
+    // can find index of suitable memory by iterating over all memoryTypes and
+    // checking if the bit is set to 1
+
+    // need to also look at special features of the memory, like being able to
+    // map so we can write to it from CPU so look for a bitwise match
+
+    if (typeFilter & (1 << i) && (memProperties.memoryTypes[i].propertyFlags &
+                                  properties) == properties) {
+      memoryTypeCache[key] = i;
+      return i;
+    }
+  }
+  throw std::runtime_error("Failed to find memory type!");
+}
+
+VkEngineAllocation
+VkEngineAllocator::allocate(const VkMemoryRequirements &memRequirements,
+                            VkMemoryPropertyFlags properties, bool linear) {
+  std::lock_guard<std::mutex> lock(allocatorMutex);
+
+  uint32_t memoryTypeIndex =
+      findMemoryType(memRequirements.memoryTypeBits, properties);
+  auto &pool = blocks[memoryTypeIndex][linear ? 0 : 1];
+
+  VkEngineAllocation allocation{};
+  allocation.size = memRequirements.size;
+
+  for (auto &block : pool) {
+    if (block->allocate(memRequirements.size, memRequirements.alignment,
+                        allocation.offset)) {
+      allocation.block = block.get();
+      break;
+    }
+  }
+
+  if (allocation.block == nullptr) {
+    // Nothing had room, grab a new block. Resources bigger than the default
+    // block size get a block of their own
+    auto block = std::make_unique<VkEngineMemoryBlock>();
+    block->size =
+        std::max(DEFAULT_BLOCK_SIZE,
+                 alignUp(memRequirements.size, bufferImageGranularity));
+    block->memoryTypeIndex = memoryTypeIndex;
+
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = block->size;
+    allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+    if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &block->memory) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate device memory block!");
+    }
+
+    // Keep host visible blocks mapped, mapping the same memory twice isn't
+    // allowed so every sub allocation shares this one mapping
+    if (memProperties.memoryTypes[memoryTypeIndex].propertyFlags &
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+      if (vkMapMemory(logicalDevice, block->memory, 0, block->size, 0,
+                      &block->mappedData) != VK_SUCCESS) {
+        vkFreeMemory(logicalDevice, block->memory, nullptr);
+        throw std::runtime_error("failed to map device memory block!");
+      }
+    }
+    deviceMemoryAllocations++;
+
+    block->freeRanges.push_back({0, block->size});
+    if (!block->allocate(memRequirements.size, memRequirements.alignment,
+                         allocation.offset)) {
+      throw std::runtime_error("failed to sub allocate from new block!");
+    }
+    allocation.block = block.get();
+    pool.push_back(std::move(block));
+  }
+
+  allocation.memory = allocation.block->memory;
+  if (allocation.block->mappedData != nullptr) {
+    allocation.mappedData =
+        static_cast<char *>(allocation.block->mappedData) + allocation.offset;
+  }
+  liveAllocations++;
+  return allocation;
+}
+
+void VkEngineAllocator::free(VkEngineAllocation &allocation) {
+  if (allocation.block == nullptr) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(allocatorMutex);
+
+  VkEngineMemoryBlock *block = allocation.block;
+  block->free(allocation.offset, allocation.size);
+  liveAllocations--;
+
+  // Give empty blocks back to the driver, but keep the first one of each pool
+  // around so alloc/free churn doesn't hit vkAllocateMemory every time
+  if (block->allocationCount == 0) {
+    uint32_t memoryTypeIndex = block->memoryTypeIndex;
+    for (int kind = 0; kind < 2; kind++) {
+      auto &pool = blocks[memoryTypeIndex][kind];
+      for (size_t i = 1; i < pool.size(); i++) {
+        if (pool[i].get() == block) {
+          if (block->mappedData != nullptr) {
+            vkUnmapMemory(logicalDevice, block->memory);
+          }
+          vkFreeMemory(logicalDevice, block->memory, nullptr);
+          deviceMemoryAllocations--;
+          // block is gone after this
+          pool.erase(pool.begin() + i);
+          allocation = VkEngineAllocation{};
+          return;
+        }
+      }
+    }
+  }
+
+  allocation = VkEngineAllocation{};
+}
+
+void VkEngineAllocator::createBuffer(VkDeviceSize size,
+                                     VkBufferUsageFlags usage,
+                                     VkMemoryPropertyFlags properties,
+                                     VkBuffer &buffer,
+                                     VkEngineAllocation &allocation) {
+  VkBufferCreateInfo bufferInfo{};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = size;
+  bufferInfo.usage = usage;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  if ((usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT) &&
+      concurrentQueueFamilies.size() > 1) {
+    // Filled by the transfer queue, read by the graphics queue
+    bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    bufferInfo.queueFamilyIndexCount =
+        static_cast<uint32_t>(concurrentQueueFamilies.size());
+    bufferInfo.pQueueFamilyIndices = concurrentQueueFamilies.data();
+  }
+
+  if (vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &buffer) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create buffer!");
+  }
+
+  // After this buffer has been created, but doesn't have memory inside
+  // First step of allocating memory to buffer requires querying its memory
+  // requirements
+  VkMemoryRequirements memRequirements;
+  vkGetBufferMemoryRequirements(logicalDevice, buffer, &memRequirements);
+
+  allocation = allocate(memRequirements, properties, true);
+  vkBindBufferMemory(logicalDevice, buffer, allocation.memory,
+                     allocation.offset);
+}
+
+void VkEngineAllocator::destroyBuffer(VkBuffer buffer,
+                                      VkEngineAllocation &allocation) {
+  vkDestroyBuffer(logicalDevice, buffer, nullptr);
+  free(allocation);
+}
+
+void VkEngineAllocator::createImage(const VkImageCreateInfo &imageInfo,
+                                    VkMemoryPropertyFlags properties,
+                                    VkImage &image,
+                                    VkEngineAllocation &allocation) {
+  if (vkCreateImage(logicalDevice, &imageInfo, nullptr, &image) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create image!");
+  }
+
+  VkMemoryRequirements memRequirements;
+  vkGetImageMemoryRequirements(logicalDevice, image, &memRequirements);
+
+  allocation = allocate(memRequirements, properties,
+                        imageInfo.tiling == VK_IMAGE_TILING_LINEAR);
+  vkBindImageMemory(logicalDevice, image, allocation.memory, allocation.offset);
+}
+
+void VkEngineAllocator::destroyImage(VkImage image,
+                                     VkEngineAllocation &allocation) {
+  vkDestroyImage(logicalDevice, image, nullptr);
+  free(allocation);
+}
+
+void VkEngineAllocator::printStats() {
+  VkDeviceSize reserved = 0;
+  VkDeviceSize freeBytes = 0;
+  for (uint32_t type = 0; type < VK_MAX_MEMORY_TYPES; type++) {
+    for (int kind = 0; kind < 2; kind++) {
+      for (auto &block : blocks[type][kind]) {
+        reserved += block->size;
+        for (auto &range : block->freeRanges) {
+          freeBytes += range.size;
+        }
+      }
+    }
+  }
+  std::cout << "Allocator: " << deviceMemoryAllocations
+            << " vkAllocateMemory blocks, " << liveAllocations
+            << " live allocations, " << (reserved - freeBytes) / 1024
+            << " KB used of " << reserved / 1024 << " KB\n";
+}
+
+} // namespace ve
@@ -0,0 +1,237 @@
+#include "vk_bindless.hpp"
+
+namespace ve {
+
+VkEngineBindlessTextures::VkEngineBindlessTextures(
+    VkEngineDevice &eDevice, VkEngineUploadManager &uploader)
+    : engineDevice{eDevice}, uploadManager{uploader} {
+  if (!engineDevice.descriptorIndexing) {
+    std::cout << "No descriptor indexing, bindless textures disabled\n";
+    return;
+  }
+  createDescriptorSetLayout();
+  createDescriptorSet();
+  createSampler();
+}
+
+VkEngineBindlessTextures::~VkEngineBindlessTextures() {
+  for (auto &texture : ownedTextures) {
+    vkDestroyImageView(engineDevice.logicalDevice, texture.view, nullptr);
+    engineDevice.allocator.destroyImage(texture.image, texture.memory);
+  }
+  // all no-ops on VK_NULL_HANDLE when disabled
+  vkDestroySampler(engineDevice.logicalDevice, sampler, nullptr);
+  vkDestroyDescriptorPool(engineDevice.logicalDevice, descriptorPool, nullptr);
+  // descriptorSetLayout belongs to the device's layout cache
+}
+
+bool VkEngineBindlessTextures::enabled() const {
+  return descriptorSet != VK_NULL_HANDLE;
+}
+
+void VkEngineBindlessTextures::createDescriptorSetLayout() {
+  VkDescriptorSetLayoutBinding texturesBinding{};
+  texturesBinding.binding = 0;
+  texturesBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  texturesBinding.descriptorCount = MAX_TEXTURES;
+  texturesBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  texturesBinding.pImmutableSamplers = nullptr;
+
+  // PARTIALLY_BOUND: slots past textureCount are never written.
+  // UPDATE_AFTER_BIND: addTexture doesn't invalidate command buffers the set
+  // is already bound in. UNUSED_WHILE_PENDING: it can do so while they are
+  // executing, they only read the slots that existed when they were recorded
+  VkDescriptorBindingFlags bindingFlags =
+      VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+      VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+      VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+
+  VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{};
+  bindingFlagsInfo.sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+  bindingFlagsInfo.bindingCount = 1;
+  bindingFlagsInfo.pBindingFlags = &bindingFlags;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.pNext = &bindingFlagsInfo;
+  layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+  layoutInfo.bindingCount = 1;
+  layoutInfo.pBindings = &texturesBinding;
+
+  descriptorSetLayout = engineDevice.layoutCache.createLayout(layoutInfo);
+}
+
+void VkEngineBindlessTextures::createDescriptorSet() {
+  VkDescriptorPoolSize poolSize{};
+  poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSize.descriptorCount = MAX_TEXTURES;
+
+  // Update after bind layouts can only be allocated from a pool made for
+  // them, so this set doesn't come from the device's descriptor allocator
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  poolInfo.maxSets = 1;
+
+  if (vkCreateDescriptorPool(engineDevice.logicalDevice, &poolInfo, nullptr,
+                             &descriptorPool) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create bindless descriptor pool!");
+  }
+
+  // One set shared by every frame in flight, it's only ever appended to
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &descriptorSetLayout;
+
+  if (vkAllocateDescriptorSets(engineDevice.logicalDevice, &allocInfo,
+                               &descriptorSet) != VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate bindless descriptor set!");
+  }
+}
+
+void VkEngineBindlessTextures::createSampler() {
+  // The generated textures are small and hard edged, nearest keeps the
+  // checkers crisp
+  VkSamplerCreateInfo samplerInfo{};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_NEAREST;
+  samplerInfo.minFilter = VK_FILTER_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerInfo.anisotropyEnable = VK_FALSE;
+  samplerInfo.maxAnisotropy = 1.0f;
+  samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+  samplerInfo.unnormalizedCoordinates = VK_FALSE;
+  samplerInfo.compareEnable = VK_FALSE;
+  samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.minLod = 0.0f;
+  samplerInfo.maxLod = 0.0f;
+
+  if (vkCreateSampler(engineDevice.logicalDevice, &samplerInfo, nullptr,
+                      &sampler) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create bindless texture sampler!");
+  }
+}
+
+uint32_t VkEngineBindlessTextures::addTexture(VkImageView view,
+                                              VkSampler viewSampler) {
+  if (!enabled()) {
+    throw std::runtime_error("bindless textures aren't supported!");
+  }
+  if (textureCount >= MAX_TEXTURES) {
+    throw std::runtime_error("bindless texture array is full!");
+  }
+
+  VkDescriptorImageInfo imageInfo{};
+  imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  imageInfo.imageView = view;
+  imageInfo.sampler = viewSampler;
+
+  VkWriteDescriptorSet descriptorWrite{};
+  descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrite.dstSet = descriptorSet;
+  descriptorWrite.dstBinding = 0;
+  descriptorWrite.dstArrayElement = textureCount;
+  descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  descriptorWrite.descriptorCount = 1;
+  descriptorWrite.pImageInfo = &imageInfo;
+
+  vkUpdateDescriptorSets(engineDevice.logicalDevice, 1, &descriptorWrite, 0,
+                         nullptr);
+
+  return textureCount++;
+}
+
+uint32_t VkEngineBindlessTextures::createCheckerTexture(
+    uint32_t size, const glm::vec4 &colorA, const glm::vec4 &colorB) {
+  if (!enabled()) {
+    throw std::runtime_error("bindless textures aren't supported!");
+  }
+
+  auto packColor = [](const glm::vec4 &color) {
+    uint32_t packed = 0;
+    for (int channel = 0; channel < 4; channel++) {
+      float value = std::min(std::max(color[channel], 0.0f), 1.0f);
+      packed |= static_cast<uint32_t>(value * 255.0f + 0.5f) << (8 * channel);
+    }
+    return packed;
+  };
+  uint32_t texelA = packColor(colorA);
+  uint32_t texelB = packColor(colorB);
+
+  // 8 x 8 squares, little endian so the bytes come out RGBA
+  uint32_t squareSize = size >= 8 ? size / 8 : 1;
+  std::vector<uint32_t> texels(size * size);
+  for (uint32_t y = 0; y < size; y++) {
+    for (uint32_t x = 0; x < size; x++) {
+      bool even = ((x / squareSize) + (y / squareSize)) % 2 == 0;
+      texels[y * size + x] = even ? texelA : texelB;
+    }
+  }
+
+  VkImageCreateInfo imageInfo{};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.extent.width = size;
+  imageInfo.extent.height = size;
+  imageInfo.extent.depth = 1;
+  imageInfo.mipLevels = 1;
+  imageInfo.arrayLayers = 1;
+  imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  imageInfo.usage =
+      VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  if (engineDevice.uploadQueueFamilies.size() > 1) {
+    // Written on the transfer queue and sampled on the graphics queue
+    imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    imageInfo.queueFamilyIndexCount =
+        static_cast<uint32_t>(engineDevice.uploadQueueFamilies.size());
+    imageInfo.pQueueFamilyIndices = engineDevice.uploadQueueFamilies.data();
+  }
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+  OwnedTexture texture{};
+  engineDevice.allocator.createImage(imageInfo,
+                                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                     texture.image, texture.memory);
+
+  uploadManager.transitionImageLayout(texture.image, 0, 1,
+                                      VK_IMAGE_LAYOUT_UNDEFINED,
+                                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+  uploadManager.uploadImage(texels.data(), texels.size() * sizeof(uint32_t),
+                            texture.image, size, size);
+  uploadManager.transitionImageLayout(texture.image, 0, 1,
+                                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  uploadManager.flush();
+
+  VkImageViewCreateInfo viewInfo{};
+  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.image = texture.image;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = imageInfo.format;
+  viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  viewInfo.subresourceRange.baseMipLevel = 0;
+  viewInfo.subresourceRange.levelCount = 1;
+  viewInfo.subresourceRange.baseArrayLayer = 0;
+  viewInfo.subresourceRange.layerCount = 1;
+
+  if (vkCreateImageView(engineDevice.logicalDevice, &viewInfo, nullptr,
+                        &texture.view) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create bindless texture image view!");
+  }
+  ownedTextures.push_back(texture);
+
+  return addTexture(texture.view, sampler);
+}
+
+} // namespace ve
@@ -0,0 +1,262 @@
+#include "vk_culling.hpp"
+
+namespace ve {
+
+VkEngineCuller::VkEngineCuller(VkEngineThreadPool &pool) : threadPool{pool} {
+  if (kernelSupported(Kernel::Avx2)) {
+    kernel = Kernel::Avx2;
+  } else if (kernelSupported(Kernel::Sse)) {
+    kernel = Kernel::Sse;
+  }
+}
+
+bool VkEngineCuller::kernelSupported(Kernel cullKernel) {
+  switch (cullKernel) {
+  case Kernel::Scalar:
+    return true;
+#ifdef VE_CULLING_X86
+  case Kernel::Sse:
+    return __builtin_cpu_supports("sse2");
+  case Kernel::Avx2:
+    return __builtin_cpu_supports("avx2");
+#endif
+  default:
+    return false;
+  }
+}
+
+const char *VkEngineCuller::kernelName(Kernel cullKernel) {
+  switch (cullKernel) {
+  case Kernel::Sse:
+    return "SSE";
+  case Kernel::Avx2:
+    return "AVX2";
+  default:
+    return "scalar";
+  }
+}
+
+void VkEngineCuller::setObjects(const std::vector<CullBounds> &bounds) {
+  objectCount = static_cast<uint32_t>(bounds.size());
+  uint32_t paddedCount = (objectCount + LANES - 1) / LANES * LANES;
+
+  centerX.assign(paddedCount, 0.0f);
+  centerY.assign(paddedCount, 0.0f);
+  centerZ.assign(paddedCount, 0.0f);
+  // Padding objects have a radius no plane distance can make up for, so
+  // they are culled by the first plane
+  radius.assign(paddedCount, -FLT_MAX);
+  extentX.assign(paddedCount, 0.0f);
+  extentY.assign(paddedCount, 0.0f);
+  extentZ.assign(paddedCount, 0.0f);
+
+  for (uint32_t i = 0; i < objectCount; i++) {
+    setObject(i, bounds[i]);
+  }
+}
+
+void VkEngineCuller::setObject(uint32_t index, const CullBounds &bounds) {
+  centerX[index] = bounds.center.x;
+  centerY[index] = bounds.center.y;
+  centerZ[index] = bounds.center.z;
+  radius[index] = bounds.radius;
+  extentX[index] = bounds.extents.x;
+  extentY[index] = bounds.extents.y;
+  extentZ[index] = bounds.extents.z;
+}
+
+void VkEngineCuller::extractFrustumPlanes(const glm::mat4 &viewProj,
+                                          glm::vec4 planes[6]) {
+  // Gribb/Hartmann: each plane is the last row of the matrix plus or minus
+  // one of the others. glm is column major, so row i is m[0][i] .. m[3][i]
+  glm::vec4 rows[4];
+  for (int i = 0; i < 4; i++) {
+    rows[i] = glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i],
+                        viewProj[3][i]);
+  }
+
+  planes[0] = rows[3] + rows[0]; // left
+  planes[1] = rows[3] - rows[0]; // right
+  planes[2] = rows[3] + rows[1]; // bottom
+  planes[3] = rows[3] - rows[1]; // top
+  planes[4] = rows[3] + rows[2]; // near, glm's default -1..1 depth range
+  planes[5] = rows[3] - rows[2]; // far
+
+  for (int i = 0; i < 6; i++) {
+    planes[i] /= glm::length(glm::vec3(planes[i]));
+  }
+}
+
+uint32_t VkEngineCuller::cull(const glm::mat4 &viewProj,
+                              std::vector<uint32_t> &visible) {
+  glm::vec4 planes[6];
+  extractFrustumPlanes(viewProj, planes);
+  return cullWith(kernel, planes, true, visible);
+}
+
+uint32_t VkEngineCuller::cullWith(Kernel cullKernel,
+                                  const glm::vec4 planes[6], bool parallel,
+                                  std::vector<uint32_t> &visible) {
+  visible.clear();
+  uint32_t paddedCount = static_cast<uint32_t>(radius.size());
+  if (paddedCount == 0) {
+    return 0;
+  }
+
+  if (!parallel || objectCount < PARALLEL_MIN_OBJECTS) {
+    cullRange(cullKernel, planes, 0, paddedCount, visible);
+    return static_cast<uint32_t>(visible.size());
+  }
+
+  uint32_t taskCount = (paddedCount + TASK_OBJECTS - 1) / TASK_OBJECTS;
+  if (taskVisible.size() < taskCount) {
+    taskVisible.resize(taskCount);
+  }
+
+  threadPool.dispatch(taskCount, [&](uint32_t task) {
+    uint32_t first = task * TASK_OBJECTS;
+    uint32_t count = paddedCount - first;
+    if (count > TASK_OBJECTS) {
+      count = TASK_OBJECTS;
+    }
+    taskVisible[task].clear();
+    cullRange(cullKernel, planes, first, count, taskVisible[task]);
+  });
+
+  // Tasks cover consecutive ranges, so joining them in task order keeps the
+  // indices sorted
+  for (uint32_t task = 0; task < taskCount; task++) {
+    visible.insert(visible.end(), taskVisible[task].begin(),
+                   taskVisible[task].end());
+  }
+  return static_cast<uint32_t>(visible.size());
+}
+
+void VkEngineCuller::cullRange(Kernel cullKernel, const glm::vec4 planes[6],
+                               uint32_t first, uint32_t count,
+                               std::vector<uint32_t> &visible) const {
+  switch (cullKernel) {
+#ifdef VE_CULLING_X86
+  case Kernel::Sse:
+    cullRangeSse(planes, first, count, visible);
+    break;
+  case Kernel::Avx2:
+    cullRangeAvx2(planes, first, count, visible);
+    break;
+#endif
+  default:
+    cullRangeScalar(planes, first, count, visible);
+    break;
+  }
+}
+
+// The kernels all compute the same thing in the same order, so they agree
+// to the bit:
+//   distance = dot(normal, center) + w
+//   boxRadius = dot(abs(normal), extents)
+//   visible while distance + min(radius, boxRadius) >= 0 for every plane
+
+void VkEngineCuller::cullRangeScalar(const glm::vec4 planes[6],
+                                     uint32_t first, uint32_t count,
+                                     std::vector<uint32_t> &visible) const {
+  for (uint32_t i = first; i < first + count; i++) {
+    glm::vec3 center{centerX[i], centerY[i], centerZ[i]};
+    glm::vec3 extents{extentX[i], extentY[i], extentZ[i]};
+
+    bool inside = true;
+    for (int p = 0; p < 6 && inside; p++) {
+      glm::vec3 normal{planes[p]};
+      float distance = glm::dot(normal, center) + planes[p].w;
+      float boxRadius = glm::dot(glm::abs(normal), extents);
+      inside = distance + std::min(radius[i], boxRadius) >= 0.0f;
+    }
+    if (inside) {
+      visible.push_back(i);
+    }
+  }
+}
+
+#ifdef VE_CULLING_X86
+
+void VkEngineCuller::cullRangeSse(const glm::vec4 planes[6], uint32_t first,
+                                  uint32_t count,
+                                  std::vector<uint32_t> &visible) const {
+  for (uint32_t i = first; i < first + count; i += 4) {
+    __m128 cx = _mm_loadu_ps(&centerX[i]);
+    __m128 cy = _mm_loadu_ps(&centerY[i]);
+    __m128 cz = _mm_loadu_ps(&centerZ[i]);
+    __m128 r = _mm_loadu_ps(&radius[i]);
+    __m128 ex = _mm_loadu_ps(&extentX[i]);
+    __m128 ey = _mm_loadu_ps(&extentY[i]);
+    __m128 ez = _mm_loadu_ps(&extentZ[i]);
+
+    int mask = 0xF;
+    for (int p = 0; p < 6 && mask != 0; p++) {
+      const glm::vec4 &plane = planes[p];
+      __m128 distance = _mm_add_ps(
+          _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), cx),
+                                _mm_mul_ps(_mm_set1_ps(plane.y), cy)),
+                     _mm_mul_ps(_mm_set1_ps(plane.z), cz)),
+          _mm_set1_ps(plane.w));
+      __m128 boxRadius = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(std::abs(plane.x)), ex),
+                     _mm_mul_ps(_mm_set1_ps(std::abs(plane.y)), ey)),
+          _mm_mul_ps(_mm_set1_ps(std::abs(plane.z)), ez));
+      __m128 inside =
+          _mm_cmpge_ps(_mm_add_ps(distance, _mm_min_ps(r, boxRadius)),
+                       _mm_setzero_ps());
+      mask &= _mm_movemask_ps(inside);
+    }
+
+    while (mask != 0) {
+      visible.push_back(i + __builtin_ctz(mask));
+      mask &= mask - 1;
+    }
+  }
+}
+
+// Built for AVX2 regardless of the compiler flags, only called after
+// kernelSupported checked the CPU has it
+__attribute__((target("avx2"))) void
+VkEngineCuller::cullRangeAvx2(const glm::vec4 planes[6], uint32_t first,
+                              uint32_t count,
+                              std::vector<uint32_t> &visible) const {
+  for (uint32_t i = first; i < first + count; i += 8) {
+    __m256 cx = _mm256_loadu_ps(&centerX[i]);
+    __m256 cy = _mm256_loadu_ps(&centerY[i]);
+    __m256 cz = _mm256_loadu_ps(&centerZ[i]);
+    __m256 r = _mm256_loadu_ps(&radius[i]);
+    __m256 ex = _mm256_loadu_ps(&extentX[i]);
+    __m256 ey = _mm256_loadu_ps(&extentY[i]);
+    __m256 ez = _mm256_loadu_ps(&extentZ[i]);
+
+    int mask = 0xFF;
+    for (int p = 0; p < 6 && mask != 0; p++) {
+      const glm::vec4 &plane = planes[p];
+      __m256 distance = _mm256_add_ps(
+          _mm256_add_ps(
+              _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.x), cx),
+                            _mm256_mul_ps(_mm256_set1_ps(plane.y), cy)),
+              _mm256_mul_ps(_mm256_set1_ps(plane.z), cz)),
+          _mm256_set1_ps(plane.w));
+      __m256 boxRadius = _mm256_add_ps(
+          _mm256_add_ps(
+              _mm256_mul_ps(_mm256_set1_ps(std::abs(plane.x)), ex),
+              _mm256_mul_ps(_mm256_set1_ps(std::abs(plane.y)), ey)),
+          _mm256_mul_ps(_mm256_set1_ps(std::abs(plane.z)), ez));
+      __m256 inside =
+          _mm256_cmp_ps(_mm256_add_ps(distance, _mm256_min_ps(r, boxRadius)),
+                        _mm256_setzero_ps(), _CMP_GE_OQ);
+      mask &= _mm256_movemask_ps(inside);
+    }
+
+    while (mask != 0) {
+      visible.push_back(i + __builtin_ctz(mask));
+      mask &= mask - 1;
+    }
+  }
+}
+
+#endif
+
+} // namespace ve
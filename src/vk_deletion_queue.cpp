@@ -0,0 +1,97 @@
+#include "vk_deletion_queue.hpp"
+
+namespace ve {
+
+void VkEngineDeletionQueue::init(VkDevice device,
+                                 VkEngineAllocator &memoryAllocator) {
+  logicalDevice = device;
+  allocator = &memoryAllocator;
+}
+
+void VkEngineDeletionQueue::cleanup() {
+  while (!frameDeletions.empty()) {
+    runFront(frameDeletions);
+  }
+  while (!timelineDeletions.empty()) {
+    runFront(timelineDeletions);
+  }
+  std::cout << "Deletion queue: " << destroyed << " of " << pushed
+            << " deferred deletions run\n";
+}
+
+void VkEngineDeletionQueue::push(std::function<void()> destroy) {
+  frameDeletions.push_back({VK_NULL_HANDLE, frameSerial, std::move(destroy)});
+  pushed++;
+}
+
+void VkEngineDeletionQueue::pushAfterTimeline(VkSemaphore timeline,
+                                              uint64_t value,
+                                              std::function<void()> destroy) {
+  timelineDeletions.push_back({timeline, value, std::move(destroy)});
+  pushed++;
+}
+
+void VkEngineDeletionQueue::destroyBuffer(
+    VkBuffer buffer, VkEngineAllocation allocation) {
+  VkEngineAllocator *memoryAllocator = allocator;
+  push([memoryAllocator, buffer, allocation]() mutable {
+    memoryAllocator->destroyBuffer(buffer, allocation);
+  });
+}
+
+void VkEngineDeletionQueue::destroyImage(VkImage image,
+                                         VkEngineAllocation allocation) {
+  VkEngineAllocator *memoryAllocator = allocator;
+  push([memoryAllocator, image, allocation]() mutable {
+    memoryAllocator->destroyImage(image, allocation);
+  });
+}
+
+void VkEngineDeletionQueue::destroyImageView(VkImageView imageView) {
+  VkDevice device = logicalDevice;
+  push([device, imageView]() {
+    vkDestroyImageView(device, imageView, nullptr);
+  });
+}
+
+void VkEngineDeletionQueue::destroyPipeline(VkPipeline pipeline) {
+  VkDevice device = logicalDevice;
+  push([device, pipeline]() { vkDestroyPipeline(device, pipeline, nullptr); });
+}
+
+void VkEngineDeletionQueue::collect(uint64_t finishedSerial) {
+  if (finishedSerial > completedSerial) {
+    completedSerial = finishedSerial;
+  }
+  while (!frameDeletions.empty() &&
+         frameDeletions.front().value <= completedSerial) {
+    runFront(frameDeletions);
+  }
+
+  // Timeline values aren't ordered across semaphores, every entry is checked
+  // but the counter is only queried once per run of the same semaphore
+  VkSemaphore queried = VK_NULL_HANDLE;
+  uint64_t reached = 0;
+  for (size_t i = 0; i < timelineDeletions.size();) {
+    Deletion &deletion = timelineDeletions[i];
+    if (deletion.timeline != queried) {
+      vkGetSemaphoreCounterValue(logicalDevice, deletion.timeline, &reached);
+      queried = deletion.timeline;
+    }
+    if (deletion.value <= reached) {
+      deletion.destroy();
+      destroyed++;
+      timelineDeletions.erase(timelineDeletions.begin() + i);
+    } else {
+      i++;
+    }
+  }
+}
+
+void VkEngineDeletionQueue::runFront(std::deque<Deletion> &deletions) {
+  deletions.front().destroy();
+  deletions.pop_front();
+  destroyed++;
+}
+
+} // namespace ve
@@ -0,0 +1,219 @@
+#include "vk_descriptors.hpp"
+
+namespace ve {
+
+void VkEngineDescriptorAllocator::init(
+    VkDevice device, uint32_t initialSetsPerPool,
+    const std::vector<PoolSizeRatio> &poolRatios) {
+  logicalDevice = device;
+  setsPerPool = initialSetsPerPool;
+  ratios = poolRatios;
+}
+
+void VkEngineDescriptorAllocator::cleanup() {
+  // Destroying a pool frees every set allocated from it
+  for (auto pool : readyPools) {
+    vkDestroyDescriptorPool(logicalDevice, pool, nullptr);
+  }
+  for (auto pool : fullPools) {
+    vkDestroyDescriptorPool(logicalDevice, pool, nullptr);
+  }
+  vkDestroyDescriptorPool(logicalDevice, currentPool, nullptr);
+  readyPools.clear();
+  fullPools.clear();
+  currentPool = VK_NULL_HANDLE;
+}
+
+VkDescriptorPool VkEngineDescriptorAllocator::createPool(uint32_t setCount) {
+  std::vector<VkDescriptorPoolSize> poolSizes(ratios.size());
+  for (size_t i = 0; i < ratios.size(); i++) {
+    poolSizes[i].type = ratios[i].type;
+    poolSizes[i].descriptorCount = std::max(
+        1u, static_cast<uint32_t>(ratios[i].ratio * setCount));
+  }
+
+  // No FREE_DESCRIPTOR_SET_BIT, sets only go back all at once on reset,
+  // which lets the driver allocate linearly
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.flags = 0;
+  poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+  poolInfo.pPoolSizes = poolSizes.data();
+  poolInfo.maxSets = setCount;
+
+  VkDescriptorPool pool;
+  if (vkCreateDescriptorPool(logicalDevice, &poolInfo, nullptr, &pool) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create descriptor pool!");
+  }
+  poolsCreated++;
+  return pool;
+}
+
+VkDescriptorPool VkEngineDescriptorAllocator::grabPool() {
+  if (!readyPools.empty()) {
+    VkDescriptorPool pool = readyPools.back();
+    readyPools.pop_back();
+    return pool;
+  }
+
+  VkDescriptorPool pool = createPool(setsPerPool);
+  // Geometric growth keeps the number of pools logarithmic in the sets
+  // needed at peak
+  setsPerPool *= 2;
+  if (setsPerPool > MAX_SETS_PER_POOL) {
+    setsPerPool = MAX_SETS_PER_POOL;
+  }
+  return pool;
+}
+
+VkDescriptorSet
+VkEngineDescriptorAllocator::allocate(VkDescriptorSetLayout layout) {
+  if (currentPool == VK_NULL_HANDLE) {
+    currentPool = grabPool();
+  }
+
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = currentPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &layout;
+
+  VkDescriptorSet descriptorSet;
+  VkResult result =
+      vkAllocateDescriptorSets(logicalDevice, &allocInfo, &descriptorSet);
+  if (result == VK_ERROR_OUT_OF_POOL_MEMORY ||
+      result == VK_ERROR_FRAGMENTED_POOL) {
+    // Full, retire it until the next reset and retry once in another pool
+    fullPools.push_back(currentPool);
+    poolsFilled++;
+    currentPool = grabPool();
+    allocInfo.descriptorPool = currentPool;
+    result =
+        vkAllocateDescriptorSets(logicalDevice, &allocInfo, &descriptorSet);
+  }
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate descriptor set!");
+  }
+
+  setsAllocated++;
+  return descriptorSet;
+}
+
+void VkEngineDescriptorAllocator::reset() {
+  for (auto pool : fullPools) {
+    vkResetDescriptorPool(logicalDevice, pool, 0);
+    readyPools.push_back(pool);
+  }
+  fullPools.clear();
+  if (currentPool != VK_NULL_HANDLE) {
+    vkResetDescriptorPool(logicalDevice, currentPool, 0);
+  }
+  resets++;
+}
+
+void VkEngineDescriptorAllocator::report(const char *name) {
+  std::cout << "Descriptors (" << name << "): " << setsAllocated
+            << " sets allocated, " << poolsCreated << " pools created, "
+            << poolsFilled << " filled up, " << resets << " resets\n";
+}
+
+bool VkEngineDescriptorLayoutCache::LayoutBinding::operator==(
+    const LayoutBinding &other) const {
+  return binding == other.binding && type == other.type &&
+         count == other.count && stages == other.stages &&
+         bindingFlags == other.bindingFlags;
+}
+
+bool VkEngineDescriptorLayoutCache::LayoutKey::operator==(
+    const LayoutKey &other) const {
+  return flags == other.flags && bindings == other.bindings;
+}
+
+size_t VkEngineDescriptorLayoutCache::LayoutKeyHash::operator()(
+    const LayoutKey &key) const {
+  // boost::hash_combine over every field
+  size_t hash = std::hash<uint32_t>()(key.flags);
+  auto combine = [&hash](uint32_t value) {
+    hash ^= std::hash<uint32_t>()(value) + 0x9e3779b9 + (hash << 6) +
+            (hash >> 2);
+  };
+  for (const LayoutBinding &binding : key.bindings) {
+    combine(binding.binding);
+    combine(static_cast<uint32_t>(binding.type));
+    combine(binding.count);
+    combine(binding.stages);
+    combine(binding.bindingFlags);
+  }
+  return hash;
+}
+
+void VkEngineDescriptorLayoutCache::init(VkDevice device) {
+  logicalDevice = device;
+}
+
+void VkEngineDescriptorLayoutCache::cleanup() {
+  std::cout << "Descriptor layouts: " << layouts.size() << " created, "
+            << hits << " cache hits\n";
+  for (auto &entry : layouts) {
+    vkDestroyDescriptorSetLayout(logicalDevice, entry.second, nullptr);
+  }
+  layouts.clear();
+}
+
+VkDescriptorSetLayout VkEngineDescriptorLayoutCache::createLayout(
+    const VkDescriptorSetLayoutCreateInfo &layoutInfo) {
+  // Binding flags are the only extension struct any layout here uses
+  const VkDescriptorSetLayoutBindingFlagsCreateInfo *bindingFlagsInfo =
+      nullptr;
+  if (layoutInfo.pNext != nullptr) {
+    auto chained =
+        static_cast<const VkDescriptorSetLayoutBindingFlagsCreateInfo *>(
+            layoutInfo.pNext);
+    VkStructureType flagsType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    if (chained->sType != flagsType || chained->pNext != nullptr) {
+      throw std::runtime_error("unsupported descriptor set layout pNext!");
+    }
+    bindingFlagsInfo = chained;
+  }
+
+  LayoutKey key{};
+  key.flags = layoutInfo.flags;
+  key.bindings.resize(layoutInfo.bindingCount);
+  for (uint32_t i = 0; i < layoutInfo.bindingCount; i++) {
+    const VkDescriptorSetLayoutBinding &binding = layoutInfo.pBindings[i];
+    if (binding.pImmutableSamplers != nullptr) {
+      throw std::runtime_error("immutable samplers can't be cached!");
+    }
+    key.bindings[i].binding = binding.binding;
+    key.bindings[i].type = binding.descriptorType;
+    key.bindings[i].count = binding.descriptorCount;
+    key.bindings[i].stages = binding.stageFlags;
+    key.bindings[i].bindingFlags =
+        bindingFlagsInfo != nullptr && bindingFlagsInfo->bindingCount > 0
+            ? bindingFlagsInfo->pBindingFlags[i]
+            : 0;
+  }
+  std::sort(key.bindings.begin(), key.bindings.end(),
+            [](const LayoutBinding &a, const LayoutBinding &b) {
+              return a.binding < b.binding;
+            });
+
+  auto cached = layouts.find(key);
+  if (cached != layouts.end()) {
+    hits++;
+    return cached->second;
+  }
+
+  VkDescriptorSetLayout layout;
+  if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr,
+                                  &layout) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create descriptor set layout!");
+  }
+  misses++;
+  layouts.emplace(std::move(key), layout);
+  return layout;
+}
+
+} // namespace ve
@@ -3,16 +3,30 @@
 namespace ve {
 VkEngineDevice::VkEngineDevice(VkWindow &window) : vkWindow{window} {
   // vkWindow = window;
+  headless = vkWindow.headless;
+  if (headless) {
+    // Offscreen rendering never presents so don't require swapchain support
+    deviceExtensions.clear();
+  }
   createInstance();
   setupDebugMessenger();
   createSurface();
   pickPhysicalDevice();
   createLogicalDevice();
+  allocator.init(physicalDevice, logicalDevice);
+  allocator.concurrentQueueFamilies = uploadQueueFamilies;
+  deletionQueue.init(logicalDevice, allocator);
+  createDescriptorAllocators();
   createCommandPool();
+  createPipelineCache();
+  shaderCache.init(logicalDevice);
 }
 VkEngineDevice::~VkEngineDevice() {
 
   std::cout << "Cleaning up VkEngineDevice Init\n";
+  // Can hold anything down to the swap chain, so it goes before the rest
+  deletionQueue.cleanup();
+
   if (enableValidationLayers) {
     // Can remove this line to trigger validation layer error
     DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
@@ -20,9 +34,21 @@ VkEngineDevice::~VkEngineDevice() {
 
   vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
 
+  savePipelineCache();
+  vkDestroyPipelineCache(logicalDevice, pipelineCache, nullptr);
+
+  descriptorAllocator.report("device");
+  descriptorAllocator.cleanup();
+  layoutCache.cleanup();
+  shaderCache.cleanup();
+
+  allocator.cleanup();
+
   // have to destroy logical device first it seems
   vkDestroyDevice(logicalDevice, nullptr);
-  vkDestroySurfaceKHR(instance, surface, nullptr);
+  if (surface != VK_NULL_HANDLE) {
+    vkDestroySurfaceKHR(instance, surface, nullptr);
+  }
   vkDestroyInstance(instance, nullptr);
 }
 
@@ -117,6 +143,16 @@ bool VkEngineDevice::checkValidationLayerSupport() {
 
 std::vector<const char *> VkEngineDevice::getRequiredVkExtensions() {
 
+  // GLFW is never initialized when headless, and no surface extensions are
+  // needed without a window
+  if (headless) {
+    std::vector<const char *> requiredVkExtensions;
+    if (enableValidationLayers) {
+      requiredVkExtensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+    }
+    return requiredVkExtensions;
+  }
+
   uint32_t glfwExtensionCount = 0;
   const char **glfwExtensions;
 
@@ -248,6 +284,12 @@ bool VkEngineDevice::isDeviceSuitable(VkPhysicalDevice device) {
 
   QueueFamilyIndices indices = findQueueFamilies(device);
 
+  if (headless) {
+    return indices.graphicsFamily.has_value() &&
+           checkDeviceExtensionSupport(device) &&
+           deviceFeatures.samplerAnisotropy;
+  }
+
   bool swapChainAdequate = false;
   SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
   swapChainAdequate = !swapChainSupport.formats.empty() &&
@@ -302,6 +344,14 @@ QueueFamilyIndices VkEngineDevice::findQueueFamilies(VkPhysicalDevice device) {
       std::cout << "Graphics Queue Index: " << i << " Can create queuecount"
                 << queueFamilies[i].queueCount << "\n";
     }
+    // Nothing gets presented when headless, so the "present" queue is just the
+    // graphics queue
+    if (headless) {
+      if (indices.graphicsFamily.has_value()) {
+        indices.presentFamily = indices.graphicsFamily;
+      }
+      continue;
+    }
     // Find if the device supports window system and present images to the
     // surface we created
     VkBool32 presentSupport = false;
@@ -314,6 +364,22 @@ QueueFamilyIndices VkEngineDevice::findQueueFamilies(VkPhysicalDevice device) {
                 << queueFamilies[i].queueCount << "\n";
     }
   }
+
+  // Look for a family that can only do transfers, that is usually a separate
+  // DMA engine that copies while the graphics queue keeps rendering. Fall
+  // back to one without graphics, then to the graphics family itself
+  for (uint32_t i = 0; i < queueFamilies.size(); i++) {
+    VkQueueFlags flags = queueFamilies[i].queueFlags;
+    if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+      if (!indices.transferFamily.has_value() ||
+          !(flags & VK_QUEUE_COMPUTE_BIT)) {
+        indices.transferFamily = i;
+      }
+    }
+  }
+  if (!indices.transferFamily.has_value()) {
+    indices.transferFamily = indices.graphicsFamily;
+  }
   return indices;
 }
 
@@ -326,17 +392,18 @@ void VkEngineDevice::createLogicalDevice() {
 
   // set will only contain unique values
   std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(),
-                                            indices.presentFamily.value()};
+                                            indices.presentFamily.value(),
+                                            indices.transferFamily.value()};
 
   // create device queue
   // Assigns priorty to queues to influence scheduling of comand buffer
   // execution
   float queuePriority = 1.0f;
-  for (int i = 0; i < uniqueQueueFamilies.size(); i++) {
+  for (uint32_t queueFamily : uniqueQueueFamilies) {
 
     VkDeviceQueueCreateInfo queueCreateInfo{};
     queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    queueCreateInfo.queueFamilyIndex = i;
+    queueCreateInfo.queueFamilyIndex = queueFamily;
     queueCreateInfo.queueCount = 1;
 
     queueCreateInfo.pQueuePriorities = &queuePriority;
@@ -349,6 +416,26 @@ void VkEngineDevice::createLogicalDevice() {
   // enable anisotropy
   deviceFeatures.samplerAnisotropy = VK_TRUE;
 
+  // Cooked .vtex textures are BCn, only used when the device can sample them
+  VkPhysicalDeviceFeatures supportedFeatures{};
+  vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+  textureCompressionBC = supportedFeatures.textureCompressionBC == VK_TRUE;
+  deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+
+  // Optional GPU profiler counters
+  pipelineStatisticsQuery =
+      supportedFeatures.pipelineStatisticsQuery == VK_TRUE;
+  deviceFeatures.pipelineStatisticsQuery =
+      supportedFeatures.pipelineStatisticsQuery;
+  inheritedQueries = supportedFeatures.inheritedQueries == VK_TRUE;
+  deviceFeatures.inheritedQueries = supportedFeatures.inheritedQueries;
+
+  // GPU culled draws carry the object index in firstInstance
+  drawIndirectFirstInstance =
+      supportedFeatures.drawIndirectFirstInstance == VK_TRUE;
+  deviceFeatures.drawIndirectFirstInstance =
+      supportedFeatures.drawIndirectFirstInstance;
+
   VkDeviceCreateInfo createInfo{};
   createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 
@@ -372,6 +459,40 @@ void VkEngineDevice::createLogicalDevice() {
   // Query vk12 features
   VkPhysicalDeviceVulkan12Features vk12Features{};
   vk12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  // Upload completion is tracked with a timeline semaphore, core in 1.2
+  vk12Features.timelineSemaphore = VK_TRUE;
+
+  // Optional 1.2 features, only turned on when the device has them
+  VkPhysicalDeviceVulkan12Features supportedVk12Features{};
+  supportedVk12Features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  VkPhysicalDeviceFeatures2 supportedFeatures2{};
+  supportedFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  supportedFeatures2.pNext = &supportedVk12Features;
+  vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures2);
+
+  // GPU culled draws are issued with vkCmdDrawIndexedIndirectCount
+  drawIndirectCount = supportedVk12Features.drawIndirectCount == VK_TRUE;
+  vk12Features.drawIndirectCount = supportedVk12Features.drawIndirectCount;
+
+  // Bindless textures, all or nothing
+  descriptorIndexing =
+      supportedVk12Features.runtimeDescriptorArray == VK_TRUE &&
+      supportedVk12Features.descriptorBindingPartiallyBound == VK_TRUE &&
+      supportedVk12Features.descriptorBindingSampledImageUpdateAfterBind ==
+          VK_TRUE &&
+      supportedVk12Features.descriptorBindingUpdateUnusedWhilePending ==
+          VK_TRUE &&
+      supportedVk12Features.shaderSampledImageArrayNonUniformIndexing ==
+          VK_TRUE;
+  if (descriptorIndexing) {
+    vk12Features.runtimeDescriptorArray = VK_TRUE;
+    vk12Features.descriptorBindingPartiallyBound = VK_TRUE;
+    vk12Features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    vk12Features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+    vk12Features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+  }
+
   createInfo.pNext = &vk12Features;
 
   if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &logicalDevice) !=
@@ -385,6 +506,33 @@ void VkEngineDevice::createLogicalDevice() {
   // Now create the present queue
   vkGetDeviceQueue(logicalDevice, indices.presentFamily.value(), 0,
                    &presentQueue);
+
+  vkGetDeviceQueue(logicalDevice, indices.transferFamily.value(), 0,
+                   &transferQueue);
+
+  graphicsFamilyIndex = indices.graphicsFamily.value();
+  transferFamilyIndex = indices.transferFamily.value();
+
+  // nanoseconds per timestamp tick, needed to turn query results into time
+  VkPhysicalDeviceProperties properties{};
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  timestampPeriod = properties.limits.timestampPeriod;
+
+  uint32_t queueFamilyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
+                                           nullptr);
+  std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
+                                           queueFamilies.data());
+  timestampValidBits = queueFamilies[graphicsFamilyIndex].timestampValidBits;
+  transferImageGranularity =
+      queueFamilies[transferFamilyIndex].minImageTransferGranularity;
+  uploadQueueFamilies = {graphicsFamilyIndex};
+  if (transferFamilyIndex != graphicsFamilyIndex) {
+    uploadQueueFamilies.push_back(transferFamilyIndex);
+    std::cout << "Uploading on dedicated transfer queue family "
+              << transferFamilyIndex << "\n";
+  }
 }
 
 SwapChainSupportDetails
@@ -415,6 +563,9 @@ VkEngineDevice::querySwapChainSupport(VkPhysicalDevice device) {
   return details;
 }
 void VkEngineDevice::createSurface() {
+  if (headless) {
+    return;
+  }
   if (glfwCreateWindowSurface(instance, vkWindow.window, nullptr, &surface) !=
       VK_SUCCESS) {
     throw std::runtime_error("failed to create window surface!");
@@ -426,6 +577,7 @@ void VkEngineDevice::createCommandPool() {
   VkCommandPoolCreateInfo poolInfo{};
   poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
   poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+  // Frame command buffers come from VkEnginePipeline's per frame pools
   poolInfo.flags = 0; // Optional
   if (vkCreateCommandPool(logicalDevice, &poolInfo, nullptr, &commandPool) !=
       VK_SUCCESS) {
@@ -433,4 +585,108 @@ void VkEngineDevice::createCommandPool() {
   }
 }
 
-} // namespace ve
+void VkEngineDevice::createDescriptorAllocators() {
+  // Roughly what the engine's sets hold: a dynamic uniform and a texture
+  // for drawing, four storage buffers for culling
+  descriptorAllocator.init(
+      logicalDevice, 64,
+      {{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1.0f},
+       {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1.0f},
+       {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1.0f},
+       {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4.0f}});
+  layoutCache.init(logicalDevice);
+}
+
+void VkEngineDevice::createPipelineCache() {
+  std::vector<char> cacheData;
+
+  std::ifstream file{pipelineCachePath, std::ios::ate | std::ios::binary};
+  if (file.is_open()) {
+    size_t fileSize = static_cast<size_t>(file.tellg());
+    cacheData.resize(fileSize);
+    file.seekg(0);
+    file.read(cacheData.data(), fileSize);
+    file.close();
+
+    if (!isPipelineCacheCompatible(cacheData)) {
+      // Different GPU or driver, the data is useless so start from empty
+      std::cout << "Pipeline cache " << pipelineCachePath
+                << " is from another device or driver, ignoring it\n";
+      cacheData.clear();
+    }
+  }
+
+  VkPipelineCacheCreateInfo cacheInfo{};
+  cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  cacheInfo.initialDataSize = cacheData.size();
+  cacheInfo.pInitialData = cacheData.empty() ? nullptr : cacheData.data();
+
+  if (vkCreatePipelineCache(logicalDevice, &cacheInfo, nullptr,
+                            &pipelineCache) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create pipeline cache!");
+  }
+
+  pipelineCacheLoaded = !cacheData.empty();
+  std::cout << "Pipeline cache: "
+            << (pipelineCacheLoaded ? "loaded " : "starting cold, ")
+            << cacheData.size() << " bytes\n";
+}
+
+bool VkEngineDevice::isPipelineCacheCompatible(
+    const std::vector<char> &cacheData) {
+  // Drivers are supposed to reject bad data themselves, but not all of them do
+  // so check the header the spec guarantees at the start of the blob
+  VkPipelineCacheHeaderVersionOne header{};
+  if (cacheData.size() < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, cacheData.data(), sizeof(header));
+
+  VkPhysicalDeviceProperties properties{};
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+  return header.headerSize >= sizeof(header) &&
+         header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+         header.vendorID == properties.vendorID &&
+         header.deviceID == properties.deviceID &&
+         memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID,
+                VK_UUID_SIZE) == 0;
+}
+
+void VkEngineDevice::savePipelineCache() {
+  size_t dataSize = 0;
+  if (vkGetPipelineCacheData(logicalDevice, pipelineCache, &dataSize,
+                             nullptr) != VK_SUCCESS ||
+      dataSize == 0) {
+    return;
+  }
+
+  std::vector<char> cacheData(dataSize);
+  if (vkGetPipelineCacheData(logicalDevice, pipelineCache, &dataSize,
+                             cacheData.data()) != VK_SUCCESS) {
+    std::cerr << "failed to read pipeline cache data\n";
+    return;
+  }
+
+  // Write to a temp file and rename it over the old cache so a crash or a
+  // full disk mid write never leaves a truncated cache behind
+  std::string tempPath = pipelineCachePath + ".tmp";
+  std::ofstream file{tempPath, std::ios::binary | std::ios::trunc};
+  file.write(cacheData.data(), dataSize);
+  file.close();
+  if (!file) {
+    std::cerr << "failed to write pipeline cache " << tempPath << "\n";
+    return;
+  }
+
+  std::error_code error;
+  std::filesystem::rename(tempPath, pipelineCachePath, error);
+  if (error) {
+    std::cerr << "failed to replace pipeline cache: " << error.message()
+              << "\n";
+    return;
+  }
+  std::cout << "Pipeline cache: saved " << dataSize << " bytes\n";
+}
+
+} // namespace ve
\ No newline at end of file
@@ -0,0 +1,181 @@
+#include "vk_frame_pacer.hpp"
+
+namespace ve {
+
+VkEngineFramePacer::VkEngineFramePacer(VkEngineDevice &eDevice,
+                                       VkEngineSwapChain &eSwapChain,
+                                       bool serialize)
+    : engineDevice{eDevice}, engineSwapChain{eSwapChain},
+      serializeFrames{serialize} {}
+
+VkEngineFramePacer::~VkEngineFramePacer() {}
+
+static double millisecondsSince(VkEngineFramePacer::Clock::time_point start) {
+  return std::chrono::duration<double, std::chrono::milliseconds::period>(
+             VkEngineFramePacer::Clock::now() - start)
+      .count();
+}
+
+static VkEngineFramePacer::Clock::duration toDuration(double milliseconds) {
+  return std::chrono::duration_cast<VkEngineFramePacer::Clock::duration>(
+      std::chrono::duration<double, std::chrono::milliseconds::period>(
+          milliseconds));
+}
+
+void VkEngineFramePacer::setFramesInFlight(uint32_t count) {
+  uint32_t maxFrames = VkEngineDevice::MAX_FRAMES_IN_FLIGHT;
+  if (count < 1 || count > maxFrames) {
+    std::cout << "Frames in flight has to be 1 to " << maxFrames << "\n";
+    count = count < 1 ? 1 : maxFrames;
+  }
+  framesInFlight = count;
+  // Slots past the new count stay unused, their fences stay signaled
+  currentFrame = currentFrame % framesInFlight;
+}
+
+void VkEngineFramePacer::throttle(double gpuFrameMs) {
+  auto sleepStart = Clock::now();
+
+  if (frameCapMs > 0.0) {
+    if (nextFrameTime > sleepStart) {
+      std::this_thread::sleep_until(nextFrameTime);
+    } else {
+      // Fell behind, don't burst frames to catch up
+      nextFrameTime = sleepStart;
+    }
+    nextFrameTime += toDuration(frameCapMs);
+  }
+
+  if (lowLatency && gpuFrameMs > 0.0) {
+    gpuMsAverage = gpuMsAverage == 0.0
+                       ? gpuFrameMs
+                       : gpuMsAverage + AVERAGE_WEIGHT *
+                                            (gpuFrameMs - gpuMsAverage);
+    // Wake up so this frame's CPU work ends just as the GPU runs out of
+    // work. Only ever sleeps when GPU bound, a CPU bound frame is already
+    // submitted late enough
+    Clock::time_point wakeTime =
+        predictedGpuDone - toDuration(cpuMsAverage + LOW_LATENCY_MARGIN_MS);
+    if (wakeTime > Clock::now()) {
+      std::this_thread::sleep_until(wakeTime);
+    }
+  }
+
+  throttleTimeTotal += millisecondsSince(sleepStart);
+  cpuFrameStart = Clock::now();
+  throttled = true;
+}
+
+void VkEngineFramePacer::waitForFrame() {
+  if (hasLastFrame) {
+    frameTimeTotal += millisecondsSince(lastFrameStart);
+    framesMeasured++;
+  }
+  lastFrameStart = Clock::now();
+  hasLastFrame = true;
+
+  // Count how many other frames the GPU still has queued while the CPU starts
+  // on this one, with pipelining working this should sit close to
+  // framesInFlight - 1
+  for (uint32_t i = 0; i < VkEngineDevice::MAX_FRAMES_IN_FLIGHT; i++) {
+    if (i != currentFrame &&
+        vkGetFenceStatus(engineDevice.logicalDevice,
+                         engineSwapChain.inFlightFences[i]) == VK_NOT_READY) {
+      gpuFramesQueuedTotal++;
+    }
+  }
+
+  // Wait for frame to be signalled before returning
+  // Remember fences need to be initialzed since they are unsignaled state by
+  // default
+  auto waitStart = Clock::now();
+  vkWaitForFences(engineDevice.logicalDevice, 1,
+                  &engineSwapChain.inFlightFences[currentFrame], VK_TRUE,
+                  UINT64_MAX);
+  waitTimeTotal += millisecondsSince(waitStart);
+
+  // Frees whatever was only waiting for this slot's last frame
+  engineDevice.deletionQueue.collect(submittedSerials[currentFrame]);
+}
+
+void VkEngineFramePacer::waitForImage(uint32_t imageIndex) {
+  // If a fence for this swap chain image has been created already, we have to
+  // wait for it before rendering to it in case it's currently being rendered
+  // to, since we might acquire the image out of order
+  if (engineSwapChain.imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
+    auto waitStart = Clock::now();
+    vkWaitForFences(engineDevice.logicalDevice, 1,
+                    &engineSwapChain.imagesInFlight[imageIndex], VK_TRUE,
+                    UINT64_MAX);
+    waitTimeTotal += millisecondsSince(waitStart);
+  }
+
+  // After waiting set the current image's fence to the current frame fence
+  engineSwapChain.imagesInFlight[imageIndex] =
+      engineSwapChain.inFlightFences[currentFrame];
+}
+
+VkFence VkEngineFramePacer::beginSubmit() {
+  // reset here and not when waiting, if the frame bails out early (swap chain
+  // recreated) the fence has to stay signaled or the next wait hangs
+  vkResetFences(engineDevice.logicalDevice, 1,
+                &engineSwapChain.inFlightFences[currentFrame]);
+  submittedSerials[currentFrame] = engineDevice.deletionQueue.frameSerial;
+
+  if (throttled) {
+    double cpuMs = millisecondsSince(cpuFrameStart);
+    cpuMsAverage += AVERAGE_WEIGHT * (cpuMs - cpuMsAverage);
+    // The GPU starts on this frame once it's done with the ones before
+    Clock::time_point now = Clock::now();
+    predictedGpuDone =
+        std::max(predictedGpuDone, now) + toDuration(gpuMsAverage);
+  }
+  return engineSwapChain.inFlightFences[currentFrame];
+}
+
+void VkEngineFramePacer::endFrame() {
+  if (serializeFrames) {
+    auto waitStart = Clock::now();
+    vkQueueWaitIdle(engineDevice.presentQueue);
+    waitTimeTotal += millisecondsSince(waitStart);
+  }
+
+  // update the current frame so it goes to the next one
+  currentFrame = (currentFrame + 1) % framesInFlight;
+  engineDevice.deletionQueue.frameSerial++;
+
+  if (framesMeasured >= REPORT_INTERVAL) {
+    report();
+  }
+}
+
+void VkEngineFramePacer::report() {
+  if (framesMeasured == 0) {
+    return;
+  }
+
+  double frameMs = frameTimeTotal / framesMeasured;
+  double waitMs = waitTimeTotal / framesMeasured;
+  double throttleMs = throttleTimeTotal / framesMeasured;
+
+  // Whatever part of the frame the CPU wasn't blocked on the GPU or asleep
+  // in throttle was spent recording while the GPU worked on earlier frames
+  double overlap =
+      frameMs > 0.0 ? 100.0 * (1.0 - (waitMs + throttleMs) / frameMs) : 0.0;
+
+  std::cout << "FramePacer: " << frameMs << " ms/frame, " << waitMs
+            << " ms waiting on GPU, " << throttleMs << " ms throttled, "
+            << overlap << "% CPU/GPU overlap, "
+            << static_cast<double>(gpuFramesQueuedTotal) / framesMeasured
+            << " of " << framesInFlight - 1 << " frames queued on GPU"
+            << (serializeFrames ? " (serialized)" : "")
+            << (lowLatency ? " (low latency)" : "") << "\n";
+
+  frameTimeTotal = 0.0;
+  waitTimeTotal = 0.0;
+  throttleTimeTotal = 0.0;
+  gpuFramesQueuedTotal = 0;
+  framesMeasured = 0;
+}
+
+} // namespace ve
@@ -0,0 +1,185 @@
+#include "vk_gpu_scene.hpp"
+
+namespace ve {
+
+VkEngineGpuScene::VkEngineGpuScene(VkEngineDevice &eDevice,
+                                   VkEngineUploadManager &uploader,
+                                   VkModel &model)
+    : engineDevice{eDevice}, uploadManager{uploader}, engineModel{model} {
+  createCullDescriptorSetLayout();
+}
+
+VkEngineGpuScene::~VkEngineGpuScene() {
+  // The layout belongs to the device
+  destroyBuffers();
+}
+
+void VkEngineGpuScene::destroyBuffers() {
+  if (objectCount == 0) {
+    return;
+  }
+  VkEngineAllocator &allocator = engineDevice.allocator;
+  allocator.destroyBuffer(instanceBuffer, instanceBufferMemory);
+  allocator.destroyBuffer(boundsBuffer, boundsBufferMemory);
+  allocator.destroyBuffer(drawArgsBuffer, drawArgsBufferMemory);
+  for (size_t i = 0; i < indirectBuffers.size(); i++) {
+    allocator.destroyBuffer(indirectBuffers[i], indirectBufferMemory[i]);
+    allocator.destroyBuffer(countBuffers[i], countBufferMemory[i]);
+  }
+}
+
+void VkEngineGpuScene::retireBuffers() {
+  if (objectCount == 0) {
+    return;
+  }
+  // Frames in flight can still be culling and drawing from these
+  VkEngineDeletionQueue &deletionQueue = engineDevice.deletionQueue;
+  deletionQueue.destroyBuffer(instanceBuffer, instanceBufferMemory);
+  deletionQueue.destroyBuffer(boundsBuffer, boundsBufferMemory);
+  deletionQueue.destroyBuffer(drawArgsBuffer, drawArgsBufferMemory);
+  for (size_t i = 0; i < indirectBuffers.size(); i++) {
+    deletionQueue.destroyBuffer(indirectBuffers[i], indirectBufferMemory[i]);
+    deletionQueue.destroyBuffer(countBuffers[i], countBufferMemory[i]);
+  }
+  objectCount = 0;
+}
+
+bool VkEngineGpuScene::empty() const { return objectCount == 0; }
+
+void VkEngineGpuScene::setObjects(const std::vector<InstanceData> &instances) {
+  if (instances.empty() || instances.size() > MAX_OBJECTS) {
+    throw std::runtime_error("GPU scene object count out of range!");
+  }
+  retireBuffers();
+  objectCount = static_cast<uint32_t>(instances.size());
+
+  // Every object is a copy of the model, so they share one local bounding
+  // radius that is scaled by each object's transform
+  float localRadius = 0.0f;
+  for (const auto &vertex : engineModel.vertices) {
+    localRadius = std::max(localRadius, glm::length(vertex.pos));
+  }
+
+  std::vector<glm::vec4> bounds(objectCount);
+  std::vector<ObjectDrawArgs> drawArgs(objectCount);
+  for (uint32_t i = 0; i < objectCount; i++) {
+    const glm::mat4 &model = instances[i].model;
+    float scale = std::max(glm::length(glm::vec3(model[0])),
+                           std::max(glm::length(glm::vec3(model[1])),
+                                    glm::length(glm::vec3(model[2]))));
+    bounds[i] = glm::vec4(glm::vec3(model[3]), localRadius * scale);
+
+    drawArgs[i].indexCount =
+        static_cast<uint32_t>(engineModel.indices.size());
+    drawArgs[i].firstIndex = 0;
+    drawArgs[i].vertexOffset = 0;
+    drawArgs[i].pad = 0;
+  }
+
+  VkEngineAllocator &allocator = engineDevice.allocator;
+
+  VkDeviceSize instanceSize = sizeof(InstanceData) * objectCount;
+  allocator.createBuffer(
+      instanceSize,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, instanceBuffer,
+      instanceBufferMemory);
+  uploadManager.uploadBuffer(instances.data(), instanceSize, instanceBuffer);
+
+  VkDeviceSize boundsSize = sizeof(glm::vec4) * objectCount;
+  allocator.createBuffer(
+      boundsSize,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, boundsBuffer, boundsBufferMemory);
+  uploadManager.uploadBuffer(bounds.data(), boundsSize, boundsBuffer);
+
+  VkDeviceSize drawArgsSize = sizeof(ObjectDrawArgs) * objectCount;
+  allocator.createBuffer(
+      drawArgsSize,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, drawArgsBuffer,
+      drawArgsBufferMemory);
+  uploadManager.uploadBuffer(drawArgs.data(), drawArgsSize, drawArgsBuffer);
+
+  // Worst case every object is visible
+  indirectBuffers.resize(VkEngineDevice::MAX_FRAMES_IN_FLIGHT);
+  indirectBufferMemory.resize(VkEngineDevice::MAX_FRAMES_IN_FLIGHT);
+  countBuffers.resize(VkEngineDevice::MAX_FRAMES_IN_FLIGHT);
+  countBufferMemory.resize(VkEngineDevice::MAX_FRAMES_IN_FLIGHT);
+  for (size_t i = 0; i < indirectBuffers.size(); i++) {
+    allocator.createBuffer(sizeof(VkDrawIndexedIndirectCommand) * objectCount,
+                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                               VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                           indirectBuffers[i], indirectBufferMemory[i]);
+    // TRANSFER_DST for the vkCmdFillBuffer that clears it every frame
+    allocator.createBuffer(sizeof(uint32_t),
+                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                               VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                               VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                           countBuffers[i], countBufferMemory[i]);
+  }
+
+  // The first frame's graphics submit waits for this on the GPU
+  uploadValue = uploadManager.flush();
+
+  std::cout << "GPU scene: " << objectCount << " objects, "
+            << (instanceSize + boundsSize + drawArgsSize) / 1024
+            << " KB of object data\n";
+}
+
+void VkEngineGpuScene::createCullDescriptorSetLayout() {
+  std::vector<VkDescriptorSetLayoutBinding> bindings(5);
+
+  // CullParams, from the uniform ring
+  bindings[0].binding = 0;
+  bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  bindings[0].descriptorCount = 1;
+  bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  // bounds, draw args, indirect commands, draw count
+  for (uint32_t i = 1; i < 5; i++) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+  layoutInfo.pBindings = bindings.data();
+
+  cullDescriptorSetLayout = engineDevice.layoutCache.createLayout(layoutInfo);
+}
+
+void VkEngineGpuScene::writeCullDescriptorSet(VkDescriptorSet set,
+                                              uint32_t frameIndex) {
+  // offset is supplied at bind time as a dynamic offset
+  VkDescriptorBufferInfo bufferInfos[5] = {
+      {engineModel.uniformBuffer, 0, sizeof(CullParams)},
+      {boundsBuffer, 0, VK_WHOLE_SIZE},
+      {drawArgsBuffer, 0, VK_WHOLE_SIZE},
+      {indirectBuffers[frameIndex], 0, VK_WHOLE_SIZE},
+      {countBuffers[frameIndex], 0, VK_WHOLE_SIZE}};
+
+  VkWriteDescriptorSet descriptorWrites[5] = {};
+  for (uint32_t binding = 0; binding < 5; binding++) {
+    VkWriteDescriptorSet &write = descriptorWrites[binding];
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = set;
+    write.dstBinding = binding;
+    write.dstArrayElement = 0;
+    write.descriptorType = binding == 0
+                               ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC
+                               : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.descriptorCount = 1;
+    write.pBufferInfo = &bufferInfos[binding];
+  }
+
+  vkUpdateDescriptorSets(engineDevice.logicalDevice, 5, descriptorWrites, 0,
+                         nullptr);
+}
+
+} // namespace ve
@@ -0,0 +1,172 @@
+#include "vk_mipmap.hpp"
+
+namespace ve {
+
+uint32_t mipLevelCount(uint32_t width, uint32_t height) {
+  return static_cast<uint32_t>(
+             std::floor(std::log2(std::max(width, height)))) +
+         1;
+}
+
+bool formatSupportsLinearBlit(VkPhysicalDevice physicalDevice,
+                              VkFormat format) {
+  VkFormatProperties formatProperties;
+  vkGetPhysicalDeviceFormatProperties(physicalDevice, format,
+                                      &formatProperties);
+
+  VkFormatFeatureFlags required =
+      VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+      VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+  return (formatProperties.optimalTilingFeatures & required) == required;
+}
+
+std::vector<MipLevel> generateMipChainCpu(const uint8_t *rgba, uint32_t width,
+                                          uint32_t height) {
+  std::vector<MipLevel> levels;
+  uint32_t levelCount = mipLevelCount(width, height);
+  levels.reserve(levelCount - 1);
+
+  const uint8_t *src = rgba;
+  uint32_t srcWidth = width;
+  uint32_t srcHeight = height;
+
+  for (uint32_t i = 1; i < levelCount; i++) {
+    MipLevel level{};
+    level.width = std::max(1u, srcWidth / 2);
+    level.height = std::max(1u, srcHeight / 2);
+    level.pixels.resize(static_cast<size_t>(level.width) * level.height * 4);
+
+    downsampleBox(src, srcWidth, srcHeight, level.pixels.data(), level.width,
+                  level.height);
+    levels.push_back(std::move(level));
+
+    // Each level is built from the previous one, not from level 0
+    src = levels.back().pixels.data();
+    srcWidth = levels.back().width;
+    srcHeight = levels.back().height;
+  }
+  return levels;
+}
+
+// Linear values are kept in 14 bits so four of them still add up in 16 bits
+static const uint32_t LINEAR_MAX = 16383;
+
+struct SrgbTables {
+  // sRGB byte to linear, alpha isn't sRGB encoded and is only rescaled
+  uint16_t colorToLinear[256];
+  uint16_t alphaToLinear[256];
+  // Linear back to an sRGB byte
+  uint8_t linearToColor[LINEAR_MAX + 1];
+
+  SrgbTables() {
+    for (uint32_t i = 0; i < 256; i++) {
+      double value = i / 255.0;
+      double linear = value <= 0.04045 ? value / 12.92
+                                       : std::pow((value + 0.055) / 1.055, 2.4);
+      colorToLinear[i] =
+          static_cast<uint16_t>(std::lround(linear * LINEAR_MAX));
+      alphaToLinear[i] = static_cast<uint16_t>((i * LINEAR_MAX + 127) / 255);
+    }
+    for (uint32_t i = 0; i <= LINEAR_MAX; i++) {
+      double linear = static_cast<double>(i) / LINEAR_MAX;
+      double value = linear <= 0.0031308
+                         ? linear * 12.92
+                         : 1.055 * std::pow(linear, 1.0 / 2.4) - 0.055;
+      linearToColor[i] = static_cast<uint8_t>(std::lround(value * 255.0));
+    }
+  }
+};
+
+static const SrgbTables &srgbTables() {
+  static const SrgbTables tables;
+  return tables;
+}
+
+static void rowToLinear(const SrgbTables &tables, const uint8_t *row,
+                        uint32_t width, uint16_t *linear) {
+  for (uint32_t i = 0; i < width * 4; i += 4) {
+    linear[i] = tables.colorToLinear[row[i]];
+    linear[i + 1] = tables.colorToLinear[row[i + 1]];
+    linear[i + 2] = tables.colorToLinear[row[i + 2]];
+    linear[i + 3] = tables.alphaToLinear[row[i + 3]];
+  }
+}
+
+void downsampleBox(const uint8_t *src, uint32_t srcWidth, uint32_t srcHeight,
+                   uint8_t *dst, uint32_t dstWidth, uint32_t dstHeight) {
+  const SrgbTables &tables = srgbTables();
+  size_t srcPitch = static_cast<size_t>(srcWidth) * 4;
+
+  // The table lookups can't be vectorised with SSE2, so each pair of source
+  // rows is converted to linear first and only the averaging is SIMD
+  std::vector<uint16_t> linear0(srcPitch);
+  std::vector<uint16_t> linear1(srcPitch);
+  std::vector<uint16_t> averaged(static_cast<size_t>(dstWidth) * 4);
+
+  for (uint32_t y = 0; y < dstHeight; y++) {
+    rowToLinear(tables, src + srcPitch * std::min(2 * y, srcHeight - 1),
+                srcWidth, linear0.data());
+    rowToLinear(tables, src + srcPitch * std::min(2 * y + 1, srcHeight - 1),
+                srcWidth, linear1.data());
+    const uint16_t *row0 = linear0.data();
+    const uint16_t *row1 = linear1.data();
+    uint16_t *out = averaged.data();
+
+    uint32_t x = 0;
+#ifdef VE_MIPMAP_SSE2
+    // 4 output texels per iteration, reads 8 texels from each source row.
+    // Only while both source columns exist, odd widths finish below
+    const __m128i rounding = _mm_set1_epi16(2);
+    for (; x + 4 <= dstWidth && 2 * x + 8 <= srcWidth; x += 4) {
+      // Every register holds one horizontal pair of texels, vertical sums
+      // first
+      __m128i pair0 =
+          _mm_add_epi16(_mm_loadu_si128((const __m128i *)(row0 + 8 * x)),
+                        _mm_loadu_si128((const __m128i *)(row1 + 8 * x)));
+      __m128i pair1 =
+          _mm_add_epi16(_mm_loadu_si128((const __m128i *)(row0 + 8 * x + 8)),
+                        _mm_loadu_si128((const __m128i *)(row1 + 8 * x + 8)));
+      __m128i pair2 = _mm_add_epi16(
+          _mm_loadu_si128((const __m128i *)(row0 + 8 * x + 16)),
+          _mm_loadu_si128((const __m128i *)(row1 + 8 * x + 16)));
+      __m128i pair3 = _mm_add_epi16(
+          _mm_loadu_si128((const __m128i *)(row0 + 8 * x + 24)),
+          _mm_loadu_si128((const __m128i *)(row1 + 8 * x + 24)));
+
+      // Add neighbouring texels: low 4 lanes + high 4 lanes of each register
+      __m128i t0 = _mm_add_epi16(pair0, _mm_srli_si128(pair0, 8));
+      __m128i t1 = _mm_add_epi16(pair1, _mm_srli_si128(pair1, 8));
+      __m128i t2 = _mm_add_epi16(pair2, _mm_srli_si128(pair2, 8));
+      __m128i t3 = _mm_add_epi16(pair3, _mm_srli_si128(pair3, 8));
+
+      __m128i texels01 = _mm_unpacklo_epi64(t0, t1);
+      __m128i texels23 = _mm_unpacklo_epi64(t2, t3);
+      texels01 = _mm_srli_epi16(_mm_add_epi16(texels01, rounding), 2);
+      texels23 = _mm_srli_epi16(_mm_add_epi16(texels23, rounding), 2);
+
+      _mm_storeu_si128((__m128i *)(out + 4 * x), texels01);
+      _mm_storeu_si128((__m128i *)(out + 4 * x + 8), texels23);
+    }
+#endif
+    for (; x < dstWidth; x++) {
+      uint32_t x0 = std::min(2 * x, srcWidth - 1);
+      uint32_t x1 = std::min(2 * x + 1, srcWidth - 1);
+      for (uint32_t c = 0; c < 4; c++) {
+        uint32_t sum = row0[4 * x0 + c] + row0[4 * x1 + c] + row1[4 * x0 + c] +
+                       row1[4 * x1 + c];
+        out[4 * x + c] = static_cast<uint16_t>((sum + 2) / 4);
+      }
+    }
+
+    uint8_t *dstRow = dst + static_cast<size_t>(dstWidth) * 4 * y;
+    for (uint32_t i = 0; i < dstWidth * 4; i += 4) {
+      dstRow[i] = tables.linearToColor[out[i]];
+      dstRow[i + 1] = tables.linearToColor[out[i + 1]];
+      dstRow[i + 2] = tables.linearToColor[out[i + 2]];
+      dstRow[i + 3] = static_cast<uint8_t>(
+          (out[i + 3] * 255 + LINEAR_MAX / 2) / LINEAR_MAX);
+    }
+  }
+}
+
+} // namespace ve
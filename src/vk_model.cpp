@@ -2,7 +2,8 @@
 
 namespace ve {
 
-VkModel::VkModel(VkEngineDevice &eDevice) : engineDevice{eDevice} {
+VkModel::VkModel(VkEngineDevice &eDevice, VkEngineUploadManager &uploader)
+    : engineDevice{eDevice}, uploadManager{uploader} {
 
   // Triangle
   // vertices = {{{0.0f, -0.5f}, {1.0f, 0.0f, 0.0f}},
@@ -24,242 +25,135 @@ VkModel::VkModel(VkEngineDevice &eDevice) : engineDevice{eDevice} {
   createVertexBuffer(vertices);
   createIndexBuffer(indices);
   createUniformBuffers();
-  createDescriptorPool();
+  createInstanceBuffer();
   createTextureImage();
+
+  // All three uploads go out as a single transfer submit. Nothing waits on it
+  // here, the first frame's graphics submit waits on the GPU instead
+  uploadValue = uploadManager.flush();
 }
 
 VkModel::~VkModel() {
-  vkDestroyBuffer(engineDevice.logicalDevice, vertexBuffer, nullptr);
-  vkFreeMemory(engineDevice.logicalDevice, vertexBufferMemory, nullptr);
-
-  vkDestroyBuffer(engineDevice.logicalDevice, indexBuffer, nullptr);
-  vkFreeMemory(engineDevice.logicalDevice, indexBufferMemory, nullptr);
+  VkEngineAllocator &allocator = engineDevice.allocator;
+  allocator.destroyBuffer(vertexBuffer, vertexBufferMemory);
+  allocator.destroyBuffer(indexBuffer, indexBufferMemory);
 
-  for (size_t i = 0; i < VkEngineDevice::MAX_FRAMES_IN_FLIGHT; i++) {
-    vkDestroyBuffer(engineDevice.logicalDevice, uniformBuffers[i], nullptr);
-    vkFreeMemory(engineDevice.logicalDevice, uniformBuffersMemory[i], nullptr);
-  }
+  allocator.destroyBuffer(uniformBuffer, uniformBufferMemory);
+  allocator.destroyBuffer(instanceBuffer, instanceBufferMemory);
 
-  vkDestroyDescriptorPool(engineDevice.logicalDevice, descriptorPool, nullptr);
-
-  vkDestroyImage(engineDevice.logicalDevice, textureImage, nullptr);
-  vkFreeMemory(engineDevice.logicalDevice, textureImageMemory, nullptr);
+  allocator.destroyImage(textureImage, textureImageMemory);
 }
 
 void VkModel::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
                            VkMemoryPropertyFlags properties, VkBuffer &buffer,
-                           VkDeviceMemory &bufferMemory) {
-  VkBufferCreateInfo bufferInfo{};
-  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-  bufferInfo.size = size;
-  bufferInfo.usage = usage;
-  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-  if (vkCreateBuffer(engineDevice.logicalDevice, &bufferInfo, nullptr,
-                     &buffer) != VK_SUCCESS) {
-    throw std::runtime_error("failed to create vertex buffer!");
-  }
-
-  // After this buffer has been created, but doesn't have memory inside
-  // First step of allocating memory to buffer requires querying its memory
-  // requirements
-  VkMemoryRequirements memRequirements;
-  vkGetBufferMemoryRequirements(engineDevice.logicalDevice, buffer,
-                                &memRequirements);
-
-  VkMemoryAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize = memRequirements.size;
-  allocInfo.memoryTypeIndex =
-      findMemoryType(memRequirements.memoryTypeBits, properties);
-
-  if (vkAllocateMemory(engineDevice.logicalDevice, &allocInfo, nullptr,
-                       &bufferMemory) != VK_SUCCESS) {
-    throw std::runtime_error("failed to allocate vertex buffer memory!");
-  }
-  vkBindBufferMemory(engineDevice.logicalDevice, buffer, bufferMemory, 0);
-}
-
-VkCommandBuffer VkModel::beginSingleTimeCommands() {
-  // First need to allocate a temporary command buffer
-  //  Can create seperate command pool, but maybe at another time
-  VkCommandBufferAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  allocInfo.commandPool = engineDevice.commandPool;
-  allocInfo.commandBufferCount = 1;
-
-  VkCommandBuffer commandBuffer;
-  vkAllocateCommandBuffers(engineDevice.logicalDevice, &allocInfo,
-                           &commandBuffer);
-
-  // Begin recording to command buffer
-  VkCommandBufferBeginInfo beginInfo{};
-  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-  // telling driver about our onetime usage
-  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-  vkBeginCommandBuffer(commandBuffer, &beginInfo);
-
-  return commandBuffer;
-}
-
-void VkModel::endSingleTimeCommands(VkCommandBuffer commandBuffer) {
-  vkEndCommandBuffer(commandBuffer);
-
-  VkSubmitInfo submitInfo{};
-  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &commandBuffer;
-
-  vkQueueSubmit(engineDevice.graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-  vkQueueWaitIdle(engineDevice.graphicsQueue);
-
-  vkFreeCommandBuffers(engineDevice.logicalDevice, engineDevice.commandPool, 1,
-                       &commandBuffer);
-}
-
-void VkModel::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer,
-                         VkDeviceSize size) {
-
-  VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-  VkBufferCopy copyRegion{};
-  copyRegion.srcOffset = 0; // Optional
-  copyRegion.dstOffset = 0; // Optional
-  copyRegion.size = size;
-  vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-
-  endSingleTimeCommands(commandBuffer);
+                           VkEngineAllocation &bufferMemory) {
+  // Sub allocated from one of the allocator's blocks instead of a
+  // vkAllocateMemory per buffer
+  engineDevice.allocator.createBuffer(size, usage, properties, buffer,
+                                      bufferMemory);
 }
 
 void VkModel::createVertexBuffer(std::vector<Vertex> vertices) {
 
   VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
 
-  // Create a staging buffer as source for cpu accessible then copy over to
-  // actual bufffer
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingBufferMemory;
-  createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-               stagingBuffer, stagingBufferMemory);
-
-  void *data;
-  vkMapMemory(engineDevice.logicalDevice, stagingBufferMemory, 0, bufferSize, 0,
-              &data);
-  memcpy(data, vertices.data(), (size_t)bufferSize);
-  vkUnmapMemory(engineDevice.logicalDevice, stagingBufferMemory);
-
   createBuffer(
       bufferSize,
       VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
 
-  copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
-  vkDestroyBuffer(engineDevice.logicalDevice, stagingBuffer, nullptr);
-  vkFreeMemory(engineDevice.logicalDevice, stagingBufferMemory, nullptr);
+  // Staged and copied by the upload manager, usable once uploadValue is
+  // reached
+  uploadManager.uploadBuffer(vertices.data(), bufferSize, vertexBuffer);
 }
 
 void VkModel::createIndexBuffer(std::vector<uint16_t> indices) {
   VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingBufferMemory;
-
-  createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-               stagingBuffer, stagingBufferMemory);
-
-  void *data;
-
-  vkMapMemory(engineDevice.logicalDevice, stagingBufferMemory, 0, bufferSize, 0,
-              &data);
-  memcpy(data, indices.data(), (size_t)bufferSize);
-
-  vkUnmapMemory(engineDevice.logicalDevice, stagingBufferMemory);
   createBuffer(
       bufferSize,
       VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
 
-  copyBuffer(stagingBuffer, indexBuffer, bufferSize);
-
-  vkDestroyBuffer(engineDevice.logicalDevice, stagingBuffer, nullptr);
-  vkFreeMemory(engineDevice.logicalDevice, stagingBufferMemory, nullptr);
+  uploadManager.uploadBuffer(indices.data(), bufferSize, indexBuffer);
 }
 
 void VkModel::createUniformBuffers() {
-  VkDeviceSize bufferSize = sizeof(UniformBufferObject);
-  uniformBuffers.resize(VkEngineDevice::MAX_FRAMES_IN_FLIGHT);
-  uniformBuffersMemory.resize(VkEngineDevice::MAX_FRAMES_IN_FLIGHT);
-
-  for (size_t i = 0; i < VkEngineDevice::MAX_FRAMES_IN_FLIGHT; i++) {
-    createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 uniformBuffers[i], uniformBuffersMemory[i]);
-  }
+  // Dynamic offsets have to be multiples of minUniformBufferOffsetAlignment
+  VkPhysicalDeviceProperties properties{};
+  vkGetPhysicalDeviceProperties(engineDevice.physicalDevice, &properties);
+  VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+
+  uniformStride =
+      (sizeof(UniformBufferObject) + alignment - 1) / alignment * alignment;
+  uniformFrameSize = uniformStride * MAX_UNIFORMS_PER_FRAME;
+  uniformFrameUsed.assign(VkEngineDevice::MAX_FRAMES_IN_FLIGHT, 0);
+
+  createBuffer(uniformFrameSize * VkEngineDevice::MAX_FRAMES_IN_FLIGHT,
+               VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+               uniformBuffer, uniformBufferMemory);
 }
 
-uint32_t VkModel::findMemoryType(uint32_t typeFilter,
-                                 VkMemoryPropertyFlags properties) {
-  VkPhysicalDeviceMemoryProperties memProperties;
-
-  vkGetPhysicalDeviceMemoryProperties(engineDevice.physicalDevice,
-                                      &memProperties);
+void VkModel::beginUniformFrame(uint32_t frameIndex) {
+  uniformFrameUsed[frameIndex] = 0;
+}
 
-  for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-    // typeFiler specifies the bit field of memory types that are suitable
-    // can find index of suitable memory by iterating over all memoryTypes and
-    // checking if the bit is set to 1
+void *VkModel::allocateUniform(uint32_t frameIndex, VkDeviceSize size,
+                               uint32_t &dynamicOffset) {
+  if (size > uniformStride ||
+      uniformFrameUsed[frameIndex] + uniformStride > uniformFrameSize) {
+    throw std::runtime_error("uniform ring buffer frame region is full!");
+  }
 
-    // need to also look at special features of the memory, like being able to
-    // map so we can write to it from CPU so look for a bitwise match
+  VkDeviceSize offset =
+      uniformFrameSize * frameIndex + uniformFrameUsed[frameIndex];
+  uniformFrameUsed[frameIndex] += uniformStride;
 
-    if (typeFilter & (1 << i) && (memProperties.memoryTypes[i].propertyFlags &
-                                  properties) == properties) {
-      return i;
-    }
-  }
-  throw std::runtime_error("Failed to find memory type!");
+  dynamicOffset = static_cast<uint32_t>(offset);
+  // Memory is host coherent so no flush is needed after writing
+  return static_cast<char *>(uniformBufferMemory.mappedData) + offset;
 }
 
-void VkModel::createDescriptorPool() {
+void VkModel::createInstanceBuffer() {
+  instanceFrameUsed.assign(VkEngineDevice::MAX_FRAMES_IN_FLIGHT, 0);
 
-  std::vector<VkDescriptorPoolSize> poolSizes{};
+  // Rewritten by the CPU every frame, so host visible rather than staged
+  createBuffer(sizeof(InstanceData) * MAX_INSTANCES_PER_FRAME *
+                   VkEngineDevice::MAX_FRAMES_IN_FLIGHT,
+               VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+               instanceBuffer, instanceBufferMemory);
+}
 
-  VkDescriptorPoolSize poolSizeUBO{};
-  poolSizeUBO.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-  poolSizeUBO.descriptorCount =
-      static_cast<uint32_t>(VkEngineDevice::MAX_FRAMES_IN_FLIGHT);
-  poolSizes.push_back(poolSizeUBO);
+void VkModel::beginInstanceFrame(uint32_t frameIndex) {
+  instanceFrameUsed[frameIndex] = 0;
+}
 
-  VkDescriptorPoolSize poolSizeIMGSampler{};
-  poolSizeIMGSampler.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-  poolSizeIMGSampler.descriptorCount =
-      static_cast<uint32_t>(VkEngineDevice::MAX_FRAMES_IN_FLIGHT);
-  poolSizes.push_back(poolSizeIMGSampler);
+InstanceData *VkModel::allocateInstances(uint32_t frameIndex, uint32_t count,
+                                         uint32_t &firstInstance) {
+  if (instanceFrameUsed[frameIndex] + count > MAX_INSTANCES_PER_FRAME) {
+    throw std::runtime_error("instance buffer frame region is full!");
+  }
 
-  VkDescriptorPoolCreateInfo poolInfo{};
-  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-  poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-  poolInfo.pPoolSizes = poolSizes.data();
+  firstInstance = instanceFrameUsed[frameIndex];
+  instanceFrameUsed[frameIndex] += count;
 
-  poolInfo.maxSets =
-      static_cast<uint32_t>(VkEngineDevice::MAX_FRAMES_IN_FLIGHT);
+  InstanceData *frameInstances = reinterpret_cast<InstanceData *>(
+      static_cast<char *>(instanceBufferMemory.mappedData) +
+      instanceFrameOffset(frameIndex));
+  return frameInstances + firstInstance;
+}
 
-  if (vkCreateDescriptorPool(engineDevice.logicalDevice, &poolInfo, nullptr,
-                             &descriptorPool) != VK_SUCCESS) {
-    throw std::runtime_error("failed to create descriptor pool!");
-  }
+VkDeviceSize VkModel::instanceFrameOffset(uint32_t frameIndex) const {
+  return sizeof(InstanceData) * MAX_INSTANCES_PER_FRAME * frameIndex;
 }
 
 void VkModel::createImage(uint32_t width, uint32_t height, VkFormat format,
                           VkImageTiling tiling, VkImageUsageFlags usage,
                           VkMemoryPropertyFlags properties, VkImage &image,
-                          VkDeviceMemory &imageMemory) {
+                          VkEngineAllocation &imageMemory, uint32_t mipLevels) {
 
   VkImageCreateInfo imageInfo{};
   imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -267,7 +161,7 @@ void VkModel::createImage(uint32_t width, uint32_t height, VkFormat format,
   imageInfo.extent.width = static_cast<uint32_t>(width);
   imageInfo.extent.height = static_cast<uint32_t>(height);
   imageInfo.extent.depth = 1;
-  imageInfo.mipLevels = 1;
+  imageInfo.mipLevels = mipLevels;
   imageInfo.arrayLayers = 1;
 
   imageInfo.format = format;
@@ -288,36 +182,90 @@ void VkModel::createImage(uint32_t width, uint32_t height, VkFormat format,
   imageInfo.usage = usage;
 
   imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  if ((usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT) &&
+      engineDevice.uploadQueueFamilies.size() > 1) {
+    // Written on the transfer queue and sampled on the graphics queue
+    imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    imageInfo.queueFamilyIndexCount =
+        static_cast<uint32_t>(engineDevice.uploadQueueFamilies.size());
+    imageInfo.pQueueFamilyIndices = engineDevice.uploadQueueFamilies.data();
+  }
 
   // for multisampling, relevant for images used as attachements
   imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
   imageInfo.flags = 0; // Optional
 
-  if (vkCreateImage(engineDevice.logicalDevice, &imageInfo, nullptr, &image) !=
-      VK_SUCCESS) {
-    throw std::runtime_error("failed to create image!");
+  engineDevice.allocator.createImage(imageInfo, properties, image,
+                                     imageMemory);
+}
+
+void VkModel::createTextureImage() {
+  // Prefer the cooked, block compressed version. The jpg is still the source
+  // of truth when nothing was cooked or the device can't sample BCn
+  TextureFile cooked;
+  if (loadTextureFile("textures/texture.vtex", cooked)) {
+    VkFormat format = textureFileVkFormat(cooked.header.format);
+    if (isTextureFormatSupported(format)) {
+      createCookedTextureImage(cooked);
+      return;
+    }
+    std::cout << "Device can't sample "
+              << textureFileFormatName(cooked.header.format)
+              << ", falling back to RGBA8\n";
   }
+  createUncompressedTextureImage();
+}
 
-  VkMemoryRequirements memRequirements;
-  vkGetImageMemoryRequirements(engineDevice.logicalDevice, image,
-                               &memRequirements);
+bool VkModel::isTextureFormatSupported(VkFormat format) {
+  if (format != VK_FORMAT_R8G8B8A8_SRGB && !engineDevice.textureCompressionBC) {
+    return false;
+  }
 
-  VkMemoryAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize = memRequirements.size;
-  allocInfo.memoryTypeIndex =
-      findMemoryType(memRequirements.memoryTypeBits, properties);
+  VkFormatProperties formatProperties;
+  vkGetPhysicalDeviceFormatProperties(engineDevice.physicalDevice, format,
+                                      &formatProperties);
+  VkFormatFeatureFlags required =
+      VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+      VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+  return (formatProperties.optimalTilingFeatures & required) == required;
+}
 
-  if (vkAllocateMemory(engineDevice.logicalDevice, &allocInfo, nullptr,
-                       &imageMemory) != VK_SUCCESS) {
-    throw std::runtime_error("failed to allocate image memory!");
+void VkModel::createCookedTextureImage(const TextureFile &cooked) {
+  const TextureFileHeader &header = cooked.header;
+  textureFormat = textureFileVkFormat(header.format);
+  textureMipLevels = header.mipLevels;
+
+  createImage(header.width, header.height, textureFormat,
+              VK_IMAGE_TILING_OPTIMAL,
+              VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage,
+              textureImageMemory, textureMipLevels);
+
+  uploadManager.transitionImageLayout(textureImage, 0, textureMipLevels,
+                                      VK_IMAGE_LAYOUT_UNDEFINED,
+                                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+  // Every level was generated and encoded offline, just copy them in
+  for (uint32_t level = 0; level < textureMipLevels; level++) {
+    const TextureFileLevel &levelInfo = cooked.levels[level];
+    uploadManager.uploadImage(cooked.data.data() + levelInfo.offset,
+                              levelInfo.size, textureImage, levelInfo.width,
+                              levelInfo.height, level,
+                              textureFileBlockSize(header.format));
   }
 
-  vkBindImageMemory(engineDevice.logicalDevice, image, imageMemory, 0);
+  uploadManager.transitionImageLayout(textureImage, 0, textureMipLevels,
+                                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+  std::cout << "Texture " << header.width << "x" << header.height << " "
+            << textureFileFormatName(header.format) << ", "
+            << textureMipLevels << " mip levels, " << cooked.data.size() / 1024
+            << " KB\n";
 }
 
 // Loads an image and pushes the pixel values into a buffer
-void VkModel::createTextureImage() {
+void VkModel::createUncompressedTextureImage() {
   int texWidth, texHeight, texChannels;
   stbi_uc *pixels = stbi_load("textures/texture.jpg", &texWidth, &texHeight,
                               &texChannels, STBI_rgb_alpha);
@@ -327,117 +275,57 @@ void VkModel::createTextureImage() {
     throw std::runtime_error("failed to load texture image!");
   }
 
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingBufferMemory;
-
-  createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-               stagingBuffer, stagingBufferMemory);
-
-  void *data;
-  vkMapMemory(engineDevice.logicalDevice, stagingBufferMemory, 0, imageSize, 0,
-              &data);
-  memcpy(data, pixels, static_cast<size_t>(imageSize));
-  vkUnmapMemory(engineDevice.logicalDevice, stagingBufferMemory);
-
-  stbi_image_free(pixels);
-
-  // Now that pixel info is in the buffer, we can create a VkImage
+  // Now that pixel info is loaded, we can create a VkImage
   // Note pixels inside VkImage is referrred as Texels
 
-  createImage(
-      texWidth, texHeight, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
-      VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
-
-  transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB,
-                        VK_IMAGE_LAYOUT_UNDEFINED,
-                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-  copyBufferToImage(stagingBuffer, textureImage,
-                    static_cast<uint32_t>(texWidth),
-                    static_cast<uint32_t>(texHeight));
-
-  transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB,
-                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-
-  vkDestroyBuffer(engineDevice.logicalDevice, stagingBuffer, nullptr);
-  vkFreeMemory(engineDevice.logicalDevice, stagingBufferMemory, nullptr);
-}
-
-void VkModel::transitionImageLayout(VkImage image, VkFormat format,
-                                    VkImageLayout oldLayout,
-                                    VkImageLayout newLayout) {
-
-  VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-  VkImageMemoryBarrier barrier{};
-  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-  barrier.oldLayout = oldLayout;
-  barrier.newLayout = newLayout;
-
-  // must be set to VK_QUEUE_FAMILY_IGNORED if you don't want to transfer queue
-  // family ownership
-  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-
-  barrier.image = image;
-  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  barrier.subresourceRange.baseMipLevel = 0;
-  barrier.subresourceRange.levelCount = 1;
-  barrier.subresourceRange.baseArrayLayer = 0;
-  barrier.subresourceRange.layerCount = 1;
-
-  barrier.srcAccessMask = 0; // TODO
-  barrier.dstAccessMask = 0; // TODO
-
-  VkPipelineStageFlags sourceStage;
-  VkPipelineStageFlags destinationStage;
-
-  if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
-      newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-    barrier.srcAccessMask = 0;
-    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-    sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-    destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-  } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL &&
-             newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-    sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-    destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  // Full chain down to 1x1 so minified textures sample a level close to
+  // their on screen size instead of skipping over texels of level 0
+  textureMipLevels = mipLevelCount(static_cast<uint32_t>(texWidth),
+                                   static_cast<uint32_t>(texHeight));
+  bool gpuMipmaps = formatSupportsLinearBlit(engineDevice.physicalDevice,
+                                             VK_FORMAT_R8G8B8A8_SRGB);
+
+  // TRANSFER_SRC since every level but the last is a blit source
+  createImage(texWidth, texHeight, VK_FORMAT_R8G8B8A8_SRGB,
+              VK_IMAGE_TILING_OPTIMAL,
+              VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                  VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage,
+              textureImageMemory, textureMipLevels);
+
+  uploadManager.transitionImageLayout(textureImage, 0, textureMipLevels,
+                                      VK_IMAGE_LAYOUT_UNDEFINED,
+                                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+  // Copied into the staging ring straight away so pixels can be freed
+  uploadManager.uploadImage(pixels, imageSize, textureImage,
+                            static_cast<uint32_t>(texWidth),
+                            static_cast<uint32_t>(texHeight));
+
+  if (gpuMipmaps) {
+    uploadManager.generateMipmaps(textureImage,
+                                  static_cast<uint32_t>(texWidth),
+                                  static_cast<uint32_t>(texHeight),
+                                  textureMipLevels);
   } else {
-    throw std::invalid_argument("unsupported layout transition!");
+    std::vector<MipLevel> levels =
+        generateMipChainCpu(pixels, static_cast<uint32_t>(texWidth),
+                            static_cast<uint32_t>(texHeight));
+    for (size_t i = 0; i < levels.size(); i++) {
+      uploadManager.uploadImage(levels[i].pixels.data(),
+                                levels[i].pixels.size(), textureImage,
+                                levels[i].width, levels[i].height,
+                                static_cast<uint32_t>(i + 1));
+    }
+    uploadManager.transitionImageLayout(
+        textureImage, 0, textureMipLevels,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
   }
+  std::cout << "Texture " << texWidth << "x" << texHeight << " RGBA8, "
+            << textureMipLevels << " mip levels generated on the "
+            << (gpuMipmaps ? "GPU" : "CPU") << "\n";
 
-  vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0,
-                       nullptr, 0, nullptr, 1, &barrier);
-  endSingleTimeCommands(commandBuffer);
-}
-void VkModel::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width,
-                                uint32_t height) {
-  VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-  VkBufferImageCopy region{};
-  region.bufferOffset = 0;
-  region.bufferRowLength = 0;
-  region.bufferImageHeight = 0;
-
-  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  region.imageSubresource.mipLevel = 0;
-  region.imageSubresource.baseArrayLayer = 0;
-  region.imageSubresource.layerCount = 1;
-
-  region.imageOffset = {0, 0, 0};
-  region.imageExtent = {width, height, 1};
-
-  vkCmdCopyBufferToImage(commandBuffer, buffer, image,
-                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-  endSingleTimeCommands(commandBuffer);
+  stbi_image_free(pixels);
 }
 } // namespace ve
\ No newline at end of file
@@ -0,0 +1,152 @@
+#include "vk_parallel_recorder.hpp"
+
+namespace ve {
+
+VkEngineParallelRecorder::VkEngineParallelRecorder(VkEngineDevice &eDevice,
+                                                   VkEngineThreadPool &pool)
+    : engineDevice{eDevice}, threadPool{pool} {
+  frames.resize(VkEngineDevice::MAX_FRAMES_IN_FLIGHT);
+
+  std::cout << "Recording on " << threadPool.workerCount()
+            << " worker threads\n";
+}
+
+VkEngineParallelRecorder::~VkEngineParallelRecorder() {
+  // Destroying a pool frees the command buffer allocated from it
+  for (auto &frame : frames) {
+    for (auto &chunk : frame) {
+      vkDestroyCommandPool(engineDevice.logicalDevice, chunk.commandPool,
+                           nullptr);
+    }
+  }
+}
+
+void VkEngineParallelRecorder::createChunk(Chunk &chunk) {
+  VkCommandPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  poolInfo.queueFamilyIndex = engineDevice.graphicsFamilyIndex;
+  // No RESET_COMMAND_BUFFER_BIT, the whole pool is reset instead which lets
+  // the driver recycle its memory in one go
+  poolInfo.flags = 0;
+
+  if (vkCreateCommandPool(engineDevice.logicalDevice, &poolInfo, nullptr,
+                          &chunk.commandPool) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create chunk command pool!");
+  }
+
+  VkCommandBufferAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.commandPool = chunk.commandPool;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+  allocInfo.commandBufferCount = 1;
+
+  if (vkAllocateCommandBuffers(engineDevice.logicalDevice, &allocInfo,
+                               &chunk.commandBuffer) != VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate secondary command buffer!");
+  }
+}
+
+bool VkEngineParallelRecorder::useSecondaries(uint32_t drawCount) const {
+  // Even on one thread a big enough frame wins from reusing chunks
+  return drawCount >= CHUNK_SIZE;
+}
+
+void VkEngineParallelRecorder::invalidate() {
+  for (auto &frame : frames) {
+    for (auto &chunk : frame) {
+      chunk.valid = false;
+    }
+  }
+}
+
+void VkEngineParallelRecorder::record(
+    uint32_t frameIndex, const VkCommandBufferInheritanceInfo &inheritance,
+    const void *drawData, size_t drawSize, uint32_t drawCount,
+    const RecordFunc &recordDraws, std::vector<VkCommandBuffer> &secondaries) {
+  std::vector<Chunk> &chunks = frames[frameIndex];
+  const char *draws = static_cast<const char *>(drawData);
+
+  uint32_t chunkCount = (drawCount + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  while (chunks.size() < chunkCount) {
+    chunks.emplace_back();
+    createChunk(chunks.back());
+  }
+
+  // Dirty check on the calling thread, it's a memcmp per chunk
+  std::vector<uint32_t> dirtyChunks;
+  for (uint32_t i = 0; i < chunkCount; i++) {
+    uint32_t first = i * CHUNK_SIZE;
+    size_t bytes = std::min(CHUNK_SIZE, drawCount - first) * drawSize;
+    const Chunk &chunk = chunks[i];
+
+    if (!chunk.valid || chunk.recordedDraws.size() != bytes ||
+        memcmp(chunk.recordedDraws.data(), draws + first * drawSize, bytes) !=
+            0) {
+      dirtyChunks.push_back(i);
+    }
+  }
+  chunksRecorded += static_cast<uint32_t>(dirtyChunks.size());
+  chunksReused += chunkCount - static_cast<uint32_t>(dirtyChunks.size());
+
+  threadPool.dispatch(
+      static_cast<uint32_t>(dirtyChunks.size()),
+      [&](uint32_t task) {
+        uint32_t chunkIndex = dirtyChunks[task];
+        Chunk &chunk = chunks[chunkIndex];
+        uint32_t first = chunkIndex * CHUNK_SIZE;
+        uint32_t count = std::min(CHUNK_SIZE, drawCount - first);
+
+        // This frame slot's fence was waited on, so the GPU is done with
+        // whatever the pool held
+        vkResetCommandPool(engineDevice.logicalDevice, chunk.commandPool, 0);
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        // RENDER_PASS_CONTINUE: runs entirely inside the primary's render
+        // pass. Not ONE_TIME_SUBMIT, it gets submitted again while clean
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        beginInfo.pInheritanceInfo = &inheritance;
+
+        if (vkBeginCommandBuffer(chunk.commandBuffer, &beginInfo) !=
+            VK_SUCCESS) {
+          throw std::runtime_error("failed to begin secondary command buffer!");
+        }
+
+        recordDraws(chunk.commandBuffer, first, count);
+
+        if (vkEndCommandBuffer(chunk.commandBuffer) != VK_SUCCESS) {
+          throw std::runtime_error(
+              "failed to record secondary command buffer!");
+        }
+
+        const char *chunkDraws = draws + first * drawSize;
+        chunk.recordedDraws.assign(chunkDraws, chunkDraws + count * drawSize);
+        chunk.valid = true;
+      });
+
+  secondaries.resize(chunkCount);
+  for (uint32_t i = 0; i < chunkCount; i++) {
+    secondaries[i] = chunks[i].commandBuffer;
+  }
+
+  framesRecorded++;
+  if (framesRecorded >= REPORT_INTERVAL) {
+    report();
+  }
+}
+
+void VkEngineParallelRecorder::report() {
+  if (framesRecorded == 0) {
+    return;
+  }
+  std::cout << "Recorder: "
+            << static_cast<double>(chunksRecorded) / framesRecorded
+            << " chunks re-recorded, "
+            << static_cast<double>(chunksReused) / framesRecorded
+            << " chunks reused per frame\n";
+  chunksRecorded = 0;
+  chunksReused = 0;
+  framesRecorded = 0;
+}
+
+} // namespace ve
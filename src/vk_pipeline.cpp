@@ -7,56 +7,177 @@ VkEnginePipeline::VkEnginePipeline(VkEngineDevice &eDevice,
                                    const PipelineConfigInfo &pipelineConfig,
                                    std::string vertFilepath,
                                    std::string fragFilepath,
-                                   VkModel &inputModel)
-    : engineDevice{eDevice}, engineSwapChain{eSwapChain}, engineInputModel{
-                                                              inputModel} {
+                                   VkModel &inputModel,
+                                   VkEngineProfiler &profiler,
+                                   VkEngineParallelRecorder &recorder,
+                                   VkEngineGpuScene &gpuScene,
+                                   VkEngineBindlessTextures &bindless)
+    : engineDevice{eDevice}, engineSwapChain{eSwapChain},
+      engineInputModel{inputModel}, engineProfiler{profiler},
+      parallelRecorder{recorder}, engineGpuScene{gpuScene},
+      engineBindless{bindless} {
   vertexCodeFilePath = vertFilepath;
   fragmentCodeFilePath = fragFilepath;
 
   createDescriptorSetLayout();
   createDescriptorSets();
-  createGraphicsPipeline(pipelineConfig);
+  // Kept for rebuilding the pipelines when the shaders or the swap chain
+  // format change
+  graphicsPipelineConfig = pipelineConfig;
+  createGraphicsPipeline(graphicsPipelineConfig);
+  // Doesn't depend on the swap chain, so it's not rebuilt on resize
+  createCullPipeline();
 
   createCommandBuffers();
+  createFrameDescriptorAllocators();
 }
 
 VkEnginePipeline::~VkEnginePipeline() {
 
   std::cout << "Cleaning up VkEnginePipeline Init\n";
-  vkDestroyShaderModule(engineDevice.logicalDevice, fragShaderModule, nullptr);
-  vkDestroyShaderModule(engineDevice.logicalDevice, vertShaderModule, nullptr);
-  vkDestroyPipeline(engineDevice.logicalDevice, graphicsPipeline, nullptr);
-  vkDestroyPipelineLayout(engineDevice.logicalDevice, pipelineLayout, nullptr);
+  // Run by the device's deletion queue, after everything in flight
+  retireGraphicsPipelines();
+  // Built by a shader reload but never swapped in
+  destroyGraphicsPipelineSet(pendingPipelines);
+  vkDestroyPipeline(engineDevice.logicalDevice, cullPipeline, nullptr);
+  vkDestroyPipelineLayout(engineDevice.logicalDevice, cullPipelineLayout,
+                          nullptr);
+
+  // Frees the primary command buffers too
+  for (auto pool : frameCommandPools) {
+    vkDestroyCommandPool(engineDevice.logicalDevice, pool, nullptr);
+  }
+
+  for (uint32_t i = 0; i < VkEngineDevice::MAX_FRAMES_IN_FLIGHT; i++) {
+    frameDescriptorAllocators[i].cleanup();
+    std::string name = "frame " + std::to_string(i);
+    frameDescriptorAllocators[i].report(name.c_str());
+  }
+  // descriptorSetLayout belongs to the device's layout cache
+}
+
+void VkEnginePipeline::createGraphicsPipeline(
+    const PipelineConfigInfo &pipelineConfig) {
+  installGraphicsPipelines(buildGraphicsPipelines(pipelineConfig));
+}
+
+GraphicsPipelineSet VkEnginePipeline::buildGraphicsPipelines(
+    const PipelineConfigInfo &pipelineConfig) {
+  GraphicsPipelineSet pipelines{};
+  try {
+    createPipelineVariants(pipelineConfig, pipelines);
+  } catch (...) {
+    // Whatever was made before the failure was never used
+    destroyGraphicsPipelineSet(pipelines);
+    throw;
+  }
+  return pipelines;
+}
 
-  vkDestroyDescriptorSetLayout(engineDevice.logicalDevice, descriptorSetLayout,
-                               nullptr);
+void VkEnginePipeline::installGraphicsPipelines(
+    const GraphicsPipelineSet &pipelines) {
+  graphicsPipeline = pipelines.graphicsPipeline;
+  instancedPipeline = pipelines.instancedPipeline;
+  bindlessPipeline = pipelines.bindlessPipeline;
+  pushPipeline = pipelines.pushPipeline;
+  pushBindlessPipeline = pipelines.pushBindlessPipeline;
+  pipelineLayout = pipelines.pipelineLayout;
+  bindlessPipelineLayout = pipelines.bindlessPipelineLayout;
+  vertShaderModule = pipelines.vertShaderModule;
+  fragShaderModule = pipelines.fragShaderModule;
+  instancedVertShaderModule = pipelines.instancedVertShaderModule;
+  pushVertShaderModule = pipelines.pushVertShaderModule;
+  bindlessFragShaderModule = pipelines.bindlessFragShaderModule;
 }
 
-std::vector<char> VkEnginePipeline::readFile(std::string filePath) {
+void VkEnginePipeline::destroyGraphicsPipelineSet(
+    GraphicsPipelineSet &pipelines) {
+  VkDevice device = engineDevice.logicalDevice;
+  // no-ops on VK_NULL_HANDLE
+  VkPipeline variants[] = {pipelines.graphicsPipeline,
+                           pipelines.instancedPipeline,
+                           pipelines.bindlessPipeline, pipelines.pushPipeline,
+                           pipelines.pushBindlessPipeline};
+  for (auto pipeline : variants) {
+    vkDestroyPipeline(device, pipeline, nullptr);
+  }
+  vkDestroyPipelineLayout(device, pipelines.pipelineLayout, nullptr);
+  vkDestroyPipelineLayout(device, pipelines.bindlessPipelineLayout, nullptr);
+  // The shader modules belong to the device's shader cache
+  pipelines = GraphicsPipelineSet{};
+}
 
-  // std::ios::ate means seek the end immediatly
-  // std::ios::binary read it in as a binary
-  std::ifstream file{filePath, std::ios::ate | std::ios::binary};
+void VkEnginePipeline::buildPendingPipelines(
+    const std::vector<std::string> &sourcePaths) {
+  const std::string *usedPaths[] = {
+      &vertexCodeFilePath, &fragmentCodeFilePath, &instancedVertexCodeFilePath,
+      &pushVertexCodeFilePath, &bindlessFragmentCodeFilePath};
+  bool used = false;
+  for (const std::string &sourcePath : sourcePaths) {
+    for (const std::string *usedPath : usedPaths) {
+      used = used || sourcePath == *usedPath;
+    }
+  }
+  if (!used) {
+    return;
+  }
 
-  if (!file.is_open()) {
-    throw std::runtime_error("Failed to open file: " + filePath);
+  // Keeps the render pass alive and unchanged for the whole build
+  std::lock_guard<std::mutex> buildLock(buildMutex);
+  GraphicsPipelineSet pipelines{};
+  try {
+    pipelines = buildGraphicsPipelines(graphicsPipelineConfig);
+  } catch (const std::exception &e) {
+    std::cout << "Shader reload failed: " << e.what()
+              << ", keeping the old pipelines\n";
+    return;
   }
 
-  // tellg gets last position which is the filesize
-  size_t fileSize = static_cast<size_t>(file.tellg());
+  std::lock_guard<std::mutex> pendingLock(pendingMutex);
+  if (pipelinesPending) {
+    // Superseded before any frame swapped it in
+    destroyGraphicsPipelineSet(pendingPipelines);
+  }
+  pendingPipelines = pipelines;
+  pipelinesPending = true;
+}
 
-  std::vector<char> buffer(fileSize);
+bool VkEnginePipeline::swapPendingPipelines() {
+  // Checked without the lock first, this runs every frame
+  if (!pipelinesPending) {
+    return false;
+  }
+  GraphicsPipelineSet pipelines{};
+  {
+    std::lock_guard<std::mutex> pendingLock(pendingMutex);
+    pipelines = pendingPipelines;
+    pendingPipelines = GraphicsPipelineSet{};
+    pipelinesPending = false;
+  }
 
-  // Go to beginning
-  file.seekg(0);
-  file.read(buffer.data(), fileSize);
-  file.close();
+  // A variant the draw modes may rely on went missing, like when its shader
+  // was deleted. Better to keep drawing with the old shaders
+  if ((hasInstancing() && pipelines.instancedPipeline == VK_NULL_HANDLE) ||
+      (hasBindless() && pipelines.bindlessPipeline == VK_NULL_HANDLE) ||
+      (hasPushConstants() && pipelines.pushPipeline == VK_NULL_HANDLE)) {
+    std::cout << "Reloaded shaders lost a pipeline variant, keeping the old "
+                 "pipelines\n";
+    destroyGraphicsPipelineSet(pipelines);
+    return false;
+  }
 
-  return buffer;
+  // Frames in flight finish with the old pipelines, every frame recorded
+  // from here on binds the new ones
+  retireGraphicsPipelines();
+  installGraphicsPipelines(pipelines);
+  markCommandsDirty();
+  pipelineSwaps++;
+  std::cout << "Shaders reloaded, pipelines swapped\n";
+  return true;
 }
 
-void VkEnginePipeline::createGraphicsPipeline(
-    const PipelineConfigInfo &pipelineConfig) {
+void VkEnginePipeline::createPipelineVariants(
+    const PipelineConfigInfo &pipelineConfig, GraphicsPipelineSet &pipelines) {
 
   /*
     assert(pipelineConfig.pipelineLayout != VK_NULL_HANDLE &&
@@ -65,14 +186,11 @@ void VkEnginePipeline::createGraphicsPipeline(
            "Cannot create graphics pipeline: no renderpass in config");
            */
 
-  auto vertCode = readFile(vertexCodeFilePath);
-  auto fragCode = readFile(fragmentCodeFilePath);
-
-  std::cout << "Vertext shader Code Size:" << vertCode.size() << "\n";
-  std::cout << "Fragment shader Code Size:" << fragCode.size() << "\n";
-
-  vertShaderModule = createShaderModule(vertCode);
-  fragShaderModule = createShaderModule(fragCode);
+  // Only compiled (or read) the first time, rebuilds get the same modules
+  // back unless a source changed
+  VkEngineShaderCache &shaderCache = engineDevice.shaderCache;
+  pipelines.vertShaderModule = shaderCache.getModule(vertexCodeFilePath);
+  pipelines.fragShaderModule = shaderCache.getModule(fragmentCodeFilePath);
 
   // Create programmable shader creatInfo
 
@@ -82,7 +200,7 @@ void VkEnginePipeline::createGraphicsPipeline(
       VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
   vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
 
-  vertShaderStageInfo.module = vertShaderModule;
+  vertShaderStageInfo.module = pipelines.vertShaderModule;
   vertShaderStageInfo.pName = "main";
 
   // Frag shader
@@ -90,7 +208,7 @@ void VkEnginePipeline::createGraphicsPipeline(
   fragShaderStageInfo.sType =
       VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
   fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-  fragShaderStageInfo.module = fragShaderModule;
+  fragShaderStageInfo.module = pipelines.fragShaderModule;
   fragShaderStageInfo.pName = "main";
 
   // Contains both
@@ -118,13 +236,22 @@ void VkEnginePipeline::createGraphicsPipeline(
   //***************************************************
   // Viewport info
 
+  // Only the counts, the viewport and scissor themselves are dynamic state
+  // set by setViewportAndScissor
   VkPipelineViewportStateCreateInfo viewportStateInfo{};
   viewportStateInfo.sType =
       VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
   viewportStateInfo.viewportCount = 1;
-  viewportStateInfo.pViewports = &pipelineConfig.viewport;
+  viewportStateInfo.pViewports = nullptr;
   viewportStateInfo.scissorCount = 1;
-  viewportStateInfo.pScissors = &pipelineConfig.scissor;
+  viewportStateInfo.pScissors = nullptr;
+
+  VkPipelineDynamicStateCreateInfo dynamicStateInfo{};
+  dynamicStateInfo.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+  dynamicStateInfo.dynamicStateCount =
+      static_cast<uint32_t>(pipelineConfig.dynamicStates.size());
+  dynamicStateInfo.pDynamicStates = pipelineConfig.dynamicStates.data();
 
   // Pipeline layout
 
@@ -133,11 +260,16 @@ void VkEnginePipeline::createGraphicsPipeline(
   pipelineLayoutInfo.setLayoutCount = 1;                 // Optional
   pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout; // Optional
 
-  pipelineLayoutInfo.pushConstantRangeCount = 0;    // Optional
-  pipelineLayoutInfo.pPushConstantRanges = nullptr; // Optional
+  // Every layout below gets the same ranges, so pipelines can be switched
+  // without disturbing pushed values or bound sets
+  pipelineLayoutInfo.pushConstantRangeCount =
+      static_cast<uint32_t>(pipelineConfig.pushConstantRanges.size());
+  pipelineLayoutInfo.pPushConstantRanges =
+      pipelineConfig.pushConstantRanges.data();
 
   if (vkCreatePipelineLayout(engineDevice.logicalDevice, &pipelineLayoutInfo,
-                             nullptr, &pipelineLayout) != VK_SUCCESS) {
+                             nullptr,
+                             &pipelines.pipelineLayout) != VK_SUCCESS) {
     throw std::runtime_error("failed to create pipeline layout!");
   }
 
@@ -153,42 +285,321 @@ void VkEnginePipeline::createGraphicsPipeline(
   pipelineInfo.pMultisampleState = &pipelineConfig.multisampleInfo;
   pipelineInfo.pDepthStencilState =
       &pipelineConfig.depthStencilInfo; // Optional
-  pipelineInfo.pColorBlendState = &pipelineConfig.colorBlendInfo;
-  pipelineInfo.pDynamicState = nullptr; // Optional
-
-  pipelineInfo.layout = pipelineLayout;
+  // pAttachments points into whichever config it was made in, this one may
+  // be the copy kept for rebuilds
+  VkPipelineColorBlendStateCreateInfo colorBlendInfo =
+      pipelineConfig.colorBlendInfo;
+  colorBlendInfo.pAttachments = &pipelineConfig.colorBlendAttachment;
+  pipelineInfo.pColorBlendState = &colorBlendInfo;
+  pipelineInfo.pDynamicState = &dynamicStateInfo;
+
+  pipelineInfo.layout = pipelines.pipelineLayout;
   pipelineInfo.renderPass = engineSwapChain.renderPass;
   pipelineInfo.subpass = pipelineConfig.subpass;
 
   pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
   pipelineInfo.basePipelineIndex = -1;              // Optional
 
-  if (vkCreateGraphicsPipelines(engineDevice.logicalDevice, VK_NULL_HANDLE, 1,
-                                &pipelineInfo, nullptr,
-                                &graphicsPipeline) != VK_SUCCESS) {
+  auto startTime = std::chrono::high_resolution_clock::now();
+
+  // The device's cache turns this into a lookup when the same shaders and
+  // state were compiled before, this run or a previous one
+  if (vkCreateGraphicsPipelines(engineDevice.logicalDevice,
+                                engineDevice.pipelineCache, 1, &pipelineInfo,
+                                nullptr,
+                                &pipelines.graphicsPipeline) != VK_SUCCESS) {
     throw std::runtime_error("failed to create graphics pipeline!");
   }
+
+  double milliseconds =
+      std::chrono::duration<double, std::chrono::milliseconds::period>(
+          std::chrono::high_resolution_clock::now() - startTime)
+          .count();
+
+  const char *cacheState = "warm (in memory)";
+  if (pipelinesCreated == 0) {
+    cacheState =
+        engineDevice.pipelineCacheLoaded ? "warm (from disk)" : "cold";
+  }
+  pipelinesCreated++;
+  std::cout << "Graphics pipeline created in " << milliseconds << " ms, "
+            << cacheState << " cache\n";
+
+  // Push constant variant, only the vertex shader differs: the model matrix
+  // comes from DrawPushConstants instead of the uniform
+  if (shaderCache.isAvailable(pushVertexCodeFilePath)) {
+    pipelines.pushVertShaderModule =
+        shaderCache.getModule(pushVertexCodeFilePath);
+    shaderStages[0].module = pipelines.pushVertShaderModule;
+    if (vkCreateGraphicsPipelines(engineDevice.logicalDevice,
+                                  engineDevice.pipelineCache, 1, &pipelineInfo,
+                                  nullptr,
+                                  &pipelines.pushPipeline) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create push constant pipeline!");
+    }
+    shaderStages[0].module = pipelines.vertShaderModule;
+  } else {
+    std::cout << "No " << pushVertexCodeFilePath
+              << ", push constant draws disabled\n";
+  }
+
+  // Instanced variant, only the vertex shader and vertex input differ
+  if (!shaderCache.isAvailable(instancedVertexCodeFilePath)) {
+    std::cout << "No " << instancedVertexCodeFilePath
+              << ", instanced drawing disabled\n";
+    return;
+  }
+
+  pipelines.instancedVertShaderModule =
+      shaderCache.getModule(instancedVertexCodeFilePath);
+  shaderStages[0].module = pipelines.instancedVertShaderModule;
+
+  bindingDescriptions.push_back(InstanceData::getBindingDescription());
+  auto instanceAttributes = InstanceData::getAttributeDescriptions();
+  attributeDescriptions.insert(attributeDescriptions.end(),
+                               instanceAttributes.begin(),
+                               instanceAttributes.end());
+
+  vertexInputInfo.vertexBindingDescriptionCount =
+      static_cast<uint32_t>(bindingDescriptions.size());
+  vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
+  vertexInputInfo.vertexAttributeDescriptionCount =
+      static_cast<uint32_t>(attributeDescriptions.size());
+  vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+  if (vkCreateGraphicsPipelines(engineDevice.logicalDevice,
+                                engineDevice.pipelineCache, 1, &pipelineInfo,
+                                nullptr,
+                                &pipelines.instancedPipeline) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create instanced graphics pipeline!");
+  }
+
+  // Bindless variant of the instanced pipeline, only the fragment shader and
+  // the extra texture set differ
+  if (!engineBindless.enabled()) {
+    return;
+  }
+  if (!shaderCache.isAvailable(bindlessFragmentCodeFilePath)) {
+    std::cout << "No " << bindlessFragmentCodeFilePath
+              << ", bindless textures disabled\n";
+    return;
+  }
+
+  // Set 0 is the same as pipelineLayout's, so the two stay compatible for it
+  VkDescriptorSetLayout bindlessSetLayouts[] = {
+      descriptorSetLayout, engineBindless.descriptorSetLayout};
+  pipelineLayoutInfo.setLayoutCount = 2;
+  pipelineLayoutInfo.pSetLayouts = bindlessSetLayouts;
+
+  if (vkCreatePipelineLayout(engineDevice.logicalDevice, &pipelineLayoutInfo,
+                             nullptr,
+                             &pipelines.bindlessPipelineLayout) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create bindless pipeline layout!");
+  }
+
+  pipelines.bindlessFragShaderModule =
+      shaderCache.getModule(bindlessFragmentCodeFilePath);
+  shaderStages[1].module = pipelines.bindlessFragShaderModule;
+  pipelineInfo.layout = pipelines.bindlessPipelineLayout;
+
+  if (vkCreateGraphicsPipelines(engineDevice.logicalDevice,
+                                engineDevice.pipelineCache, 1, &pipelineInfo,
+                                nullptr,
+                                &pipelines.bindlessPipeline) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create bindless graphics pipeline!");
+  }
+
+  // And the push constant pipeline with the bindless fragment shader, which
+  // reads the texture index that was pushed. Per vertex input only, the
+  // model's attributes come first in attributeDescriptions
+  if (pipelines.pushVertShaderModule == VK_NULL_HANDLE) {
+    return;
+  }
+  shaderStages[0].module = pipelines.pushVertShaderModule;
+  vertexInputInfo.vertexBindingDescriptionCount = 1;
+  vertexInputInfo.vertexAttributeDescriptionCount =
+      static_cast<uint32_t>(Vertex::getAttributeDescriptions().size());
+
+  VkResult result = vkCreateGraphicsPipelines(
+      engineDevice.logicalDevice, engineDevice.pipelineCache, 1, &pipelineInfo,
+      nullptr, &pipelines.pushBindlessPipeline);
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("failed to create bindless push pipeline!");
+  }
 }
 
-VkShaderModule
-VkEnginePipeline::createShaderModule(const std::vector<char> &shaderCode) {
+void VkEnginePipeline::retireGraphicsPipelines() {
+  // Shader modules stay, they belong to the device's shader cache and the
+  // next build gets the unchanged ones back from it
+
+  // Frames in flight can still be drawing with the pipelines, no-ops on
+  // VK_NULL_HANDLE for the disabled variants
+  VkEngineDeletionQueue &deletionQueue = engineDevice.deletionQueue;
+  deletionQueue.destroyPipeline(graphicsPipeline);
+  deletionQueue.destroyPipeline(instancedPipeline);
+  deletionQueue.destroyPipeline(bindlessPipeline);
+  deletionQueue.destroyPipeline(pushPipeline);
+  deletionQueue.destroyPipeline(pushBindlessPipeline);
+  VkDevice device = engineDevice.logicalDevice;
+  VkPipelineLayout layouts[] = {bindlessPipelineLayout, pipelineLayout};
+  deletionQueue.push([device, layouts]() {
+    for (auto layout : layouts) {
+      vkDestroyPipelineLayout(device, layout, nullptr);
+    }
+  });
+
+  // Left null so the variants that aren't rebuilt read as disabled
+  graphicsPipeline = VK_NULL_HANDLE;
+  vertShaderModule = VK_NULL_HANDLE;
+  fragShaderModule = VK_NULL_HANDLE;
+  instancedPipeline = VK_NULL_HANDLE;
+  instancedVertShaderModule = VK_NULL_HANDLE;
+  bindlessPipeline = VK_NULL_HANDLE;
+  pushPipeline = VK_NULL_HANDLE;
+  pushBindlessPipeline = VK_NULL_HANDLE;
+  pushVertShaderModule = VK_NULL_HANDLE;
+  bindlessFragShaderModule = VK_NULL_HANDLE;
+  bindlessPipelineLayout = VK_NULL_HANDLE;
+  pipelineLayout = VK_NULL_HANDLE;
+}
 
-  VkShaderModule shaderModule;
-  VkShaderModuleCreateInfo createInfo{};
-  createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-  createInfo.codeSize = shaderCode.size();
-  createInfo.pCode = reinterpret_cast<const uint32_t *>(shaderCode.data());
+bool VkEnginePipeline::hasInstancing() const {
+  return instancedPipeline != VK_NULL_HANDLE;
+}
+
+bool VkEnginePipeline::hasBindless() const {
+  return bindlessPipeline != VK_NULL_HANDLE;
+}
+
+bool VkEnginePipeline::hasPushConstants() const {
+  return pushPipeline != VK_NULL_HANDLE;
+}
 
-  if (vkCreateShaderModule(engineDevice.logicalDevice, &createInfo, nullptr,
-                           &shaderModule) != VK_SUCCESS) {
-    throw std::runtime_error("failed to create shader module!");
+void VkEnginePipeline::createCullPipeline() {
+  VkEngineShaderCache &shaderCache = engineDevice.shaderCache;
+  if (!shaderCache.isAvailable(cullComputeFilePath)) {
+    std::cout << "No " << cullComputeFilePath
+              << ", GPU culling disabled\n";
+    return;
   }
 
-  return shaderModule;
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount = 1;
+  pipelineLayoutInfo.pSetLayouts = &engineGpuScene.cullDescriptorSetLayout;
+
+  if (vkCreatePipelineLayout(engineDevice.logicalDevice, &pipelineLayoutInfo,
+                             nullptr, &cullPipelineLayout) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create cull pipeline layout!");
+  }
+
+  VkShaderModule computeShaderModule =
+      shaderCache.getModule(cullComputeFilePath);
+
+  VkComputePipelineCreateInfo pipelineInfo{};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineInfo.stage.module = computeShaderModule;
+  pipelineInfo.stage.pName = "main";
+  pipelineInfo.layout = cullPipelineLayout;
+
+  VkResult result = vkCreateComputePipelines(
+      engineDevice.logicalDevice, engineDevice.pipelineCache, 1,
+      &pipelineInfo, nullptr, &cullPipeline);
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("failed to create cull compute pipeline!");
+  }
+}
+
+bool VkEnginePipeline::hasGpuCulling() const {
+  return cullPipeline != VK_NULL_HANDLE && hasInstancing() &&
+         engineDevice.drawIndirectCount &&
+         engineDevice.drawIndirectFirstInstance;
+}
+
+void VkEnginePipeline::recordCull(VkCommandBuffer commandBuffer,
+                                  uint32_t frameIndex,
+                                  const GpuSceneDraw &gpuSceneDraw) {
+  // The dispatch appends to the count, start it from 0
+  vkCmdFillBuffer(commandBuffer, engineGpuScene.countBuffers[frameIndex], 0,
+                  sizeof(uint32_t), 0);
+
+  VkMemoryBarrier clearBarrier{};
+  clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  clearBarrier.dstAccessMask =
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                       &clearBarrier, 0, nullptr, 0, nullptr);
+
+  // Written fresh every frame, the scene's buffers can be replaced while
+  // older frames still use the sets pointing at the previous ones
+  VkDescriptorSet cullSet = allocateFrameDescriptorSet(
+      frameIndex, engineGpuScene.cullDescriptorSetLayout);
+  engineGpuScene.writeCullDescriptorSet(cullSet, frameIndex);
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    cullPipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          cullPipelineLayout, 0, 1, &cullSet, 1,
+                          &gpuSceneDraw.cullParamsOffset);
+
+  uint32_t groupCount = (engineGpuScene.objectCount +
+                         VkEngineGpuScene::CULL_WORKGROUP_SIZE - 1) /
+                        VkEngineGpuScene::CULL_WORKGROUP_SIZE;
+  vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+
+  // Commands and count are read as indirect arguments by the draw
+  VkMemoryBarrier cullBarrier{};
+  cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &cullBarrier,
+                       0, nullptr, 0, nullptr);
+}
+
+void VkEnginePipeline::recordGpuSceneDraw(VkCommandBuffer commandBuffer,
+                                          uint32_t frameIndex,
+                                          const GpuSceneDraw &gpuSceneDraw) {
+  VkPipelineLayout layout = pipelineLayout;
+  if (useBindless) {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      bindlessPipeline);
+    layout = bindlessPipelineLayout;
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            layout, 1, 1, &engineBindless.descriptorSet, 0,
+                            nullptr);
+  } else {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      instancedPipeline);
+  }
+
+  // Object transforms live in the scene's device local buffer, the surviving
+  // draws pick theirs with firstInstance
+  VkBuffer vertexBuffers[] = {engineInputModel.vertexBuffer,
+                              engineGpuScene.instanceBuffer};
+  VkDeviceSize offsets[] = {0, 0};
+  vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+  vkCmdBindIndexBuffer(commandBuffer, engineInputModel.indexBuffer, 0,
+                       VK_INDEX_TYPE_UINT16);
+
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          layout, 0, 1, &descriptorSets[frameIndex], 1,
+                          &gpuSceneDraw.uniformOffset);
+
+  // However many draws the cull pass wrote, at most one per object
+  vkCmdDrawIndexedIndirectCount(
+      commandBuffer, engineGpuScene.indirectBuffers[frameIndex], 0,
+      engineGpuScene.countBuffers[frameIndex], 0, engineGpuScene.objectCount,
+      sizeof(VkDrawIndexedIndirectCommand));
 }
 
 PipelineConfigInfo
-VkEnginePipeline::defaultPipelineConfigInfo(uint32_t width, uint32_t height) {
+VkEnginePipeline::defaultPipelineConfigInfo() {
 
   PipelineConfigInfo configInfo{};
 
@@ -199,25 +610,6 @@ VkEnginePipeline::defaultPipelineConfigInfo(uint32_t width, uint32_t height) {
   configInfo.inputAssemblyInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
   configInfo.inputAssemblyInfo.primitiveRestartEnable = VK_FALSE;
 
-  //***************************************************
-  // Viewport
-  configInfo.viewport.x = 0.0f;
-  configInfo.viewport.y = 0.0f;
-  configInfo.viewport.width = static_cast<float>(width);
-  configInfo.viewport.height = static_cast<float>(height);
-
-  // can't use member engineDevice due to static
-  // configInfo.viewport.width = (float)engineDevice.swapChainExtent.width;
-  // configInfo.viewport.height = (float)engineDevice.swapChainExtent.height;
-
-  configInfo.viewport.minDepth = 0.0f;
-  configInfo.viewport.maxDepth = 1.0f;
-
-  //***************************************************
-  // scissor
-  configInfo.scissor.offset = {0, 0};
-  configInfo.scissor.extent = {width, height};
-
   //***************************************************
   // Rasterizer
   configInfo.rasterizationInfo.sType =
@@ -314,22 +706,28 @@ VkEnginePipeline::defaultPipelineConfigInfo(uint32_t width, uint32_t height) {
   configInfo.colorBlendInfo.blendConstants[2] = 0.0f; // Optional
   configInfo.colorBlendInfo.blendConstants[3] = 0.0f; // Optional
 
+  //***************************************************
+  // Push constants
+  // DrawPushConstants, read by the push constant vertex shader. The texture
+  // index is passed on to the fragment shader as a flat varying, so only the
+  // vertex stage needs access
+  VkPushConstantRange drawPushRange{};
+  drawPushRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  drawPushRange.offset = 0;
+  drawPushRange.size = sizeof(DrawPushConstants);
+  configInfo.pushConstantRanges.push_back(drawPushRange);
+
   //***************************************************
   // Dynamic state
   // limited amount of the state that we've specified in the previous structs
   // can actually be changed without recreating the pipeline. Examples are the
   // size of the viewport, line width and blend constants. If you want to do
   // that, then you'll have to fill in a VkPipelineDynamicStateCreateInfo
-  // structure like this
-  /*
-  VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT,
-                                    VK_DYNAMIC_STATE_LINE_WIDTH};
-
-  VkPipelineDynamicStateCreateInfo dynamicState{};
-  dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-  dynamicState.dynamicStateCount = 2;
-  dynamicState.pDynamicStates = dynamicStates;
-  */
+  // structure, which createGraphicsPipeline does from this list.
+  // The viewport and scissor follow the swap chain extent, being dynamic the
+  // pipelines no longer depend on the window size and survive a resize
+  configInfo.dynamicStates = {VK_DYNAMIC_STATE_VIEWPORT,
+                              VK_DYNAMIC_STATE_SCISSOR};
 
   //***************************************************
 
@@ -337,77 +735,245 @@ VkEnginePipeline::defaultPipelineConfigInfo(uint32_t width, uint32_t height) {
 }
 
 void VkEnginePipeline::createCommandBuffers() {
-  commandBuffers.resize(engineSwapChain.swapChainFramebuffers.size());
+  // One per frame in flight rather than per swap chain image, these get
+  // re-recorded every frame so they don't depend on the swap chain and survive
+  // window resizes
+  commandBuffers.resize(VkEngineDevice::MAX_FRAMES_IN_FLIGHT);
+  frameCommandPools.resize(VkEngineDevice::MAX_FRAMES_IN_FLIGHT);
 
-  VkCommandBufferAllocateInfo allocInfo{};
+  for (size_t i = 0; i < commandBuffers.size(); i++) {
+    // Each frame slot gets a pool of its own that is reset as a whole at the
+    // start of the frame, cheaper than resetting buffers one by one
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = engineDevice.graphicsFamilyIndex;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+    if (vkCreateCommandPool(engineDevice.logicalDevice, &poolInfo, nullptr,
+                            &frameCommandPools[i]) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create frame command pool!");
+    }
 
-  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  allocInfo.commandPool = engineDevice.commandPool;
-  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  allocInfo.commandBufferCount = (uint32_t)commandBuffers.size();
+    VkCommandBufferAllocateInfo allocInfo{};
 
-  if (vkAllocateCommandBuffers(engineDevice.logicalDevice, &allocInfo,
-                               commandBuffers.data()) != VK_SUCCESS) {
-    throw std::runtime_error("failed to allocate command buffers!");
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = frameCommandPools[i];
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+
+    if (vkAllocateCommandBuffers(engineDevice.logicalDevice, &allocInfo,
+                                 &commandBuffers[i]) != VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate command buffers!");
+    }
   }
+}
 
-  for (size_t i = 0; i < commandBuffers.size(); i++) {
-    VkCommandBufferBeginInfo beginInfo{};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = 0;                  // Optional
-    beginInfo.pInheritanceInfo = nullptr; // Optional
+void VkEnginePipeline::createFrameDescriptorAllocators() {
+  for (auto &frameAllocator : frameDescriptorAllocators) {
+    frameAllocator.init(engineDevice.logicalDevice, 256,
+                        {{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1.0f},
+                         {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1.0f},
+                         {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2.0f},
+                         {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4.0f}});
+  }
+}
 
-    if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) != VK_SUCCESS) {
-      throw std::runtime_error("failed to begin recording command buffer!");
-    }
-    // Begin render pass
-    VkRenderPassBeginInfo renderPassInfo{};
-    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    renderPassInfo.renderPass = engineSwapChain.renderPass;
-    renderPassInfo.framebuffer = engineSwapChain.swapChainFramebuffers[i];
-
-    // where shader draws
-    renderPassInfo.renderArea.offset = {0, 0};
-    // make sure to use swapchainextent and not window extent due to high
-    // density displays
-    renderPassInfo.renderArea.extent = engineSwapChain.swapChainExtent;
-
-    VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
-    renderPassInfo.clearValueCount = 1;
-    renderPassInfo.pClearValues = &clearColor;
+void VkEnginePipeline::resetFrameDescriptors(uint32_t frameIndex) {
+  frameDescriptorAllocators[frameIndex].reset();
+}
 
+VkDescriptorSet
+VkEnginePipeline::allocateFrameDescriptorSet(uint32_t frameIndex,
+                                             VkDescriptorSetLayout layout) {
+  return frameDescriptorAllocators[frameIndex].allocate(layout);
+}
+
+void VkEnginePipeline::markCommandsDirty() { parallelRecorder.invalidate(); }
+
+// The primary is recorded every frame, it's only a handful of commands. Big
+// draw lists go through the parallel recorder's cached secondaries
+void VkEnginePipeline::recordCommandBuffer(
+    uint32_t imageIndex, uint32_t frameIndex,
+    const std::vector<DrawCall> &drawCalls,
+    const GpuSceneDraw *gpuSceneDraw) {
+  VkCommandBuffer commandBuffer = commandBuffers[frameIndex];
+
+  // The frame's fence was waited on, nothing from this pool is still in use
+  vkResetCommandPool(engineDevice.logicalDevice, frameCommandPools[frameIndex],
+                     0);
+
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  beginInfo.pInheritanceInfo = nullptr; // Optional
+
+  if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+    throw std::runtime_error("failed to begin recording command buffer!");
+  }
+
+  // Picks up what this frame slot measured last time and resets its queries,
+  // has to happen outside the render pass
+  engineProfiler.beginFrame(commandBuffer, frameIndex);
+  uint32_t frameScope = engineProfiler.beginScope(commandBuffer, "frame");
+
+  // Compute can't run inside a render pass, cull before it starts
+  if (gpuSceneDraw != nullptr) {
+    uint32_t cullScope = engineProfiler.beginScope(commandBuffer, "cull");
+    recordCull(commandBuffer, frameIndex, *gpuSceneDraw);
+    engineProfiler.endScope(commandBuffer, cullScope);
+  }
+
+  // Begin render pass
+  VkRenderPassBeginInfo renderPassInfo{};
+  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+  renderPassInfo.renderPass = engineSwapChain.renderPass;
+  renderPassInfo.framebuffer =
+      engineSwapChain.swapChainFramebuffers[imageIndex];
+
+  // where shader draws
+  renderPassInfo.renderArea.offset = {0, 0};
+  // make sure to use swapchainextent and not window extent due to high
+  // density displays
+  renderPassInfo.renderArea.extent = engineSwapChain.swapChainExtent;
+
+  VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
+  renderPassInfo.clearValueCount = 1;
+  renderPassInfo.pClearValues = &clearColor;
+
+  uint32_t drawCount = static_cast<uint32_t>(drawCalls.size());
+  // A subpass is either all inline or all secondaries, the GPU scene draw is
+  // recorded inline
+  bool recordInParallel =
+      parallelRecorder.useSecondaries(drawCount) && gpuSceneDraw == nullptr;
+
+  // Secondaries can only be executed inside a statistics query when the
+  // device has inheritedQueries, without it the pass only gets timestamps
+  uint32_t mainPassScope = engineProfiler.beginScope(
+      commandBuffer, "main pass",
+      !recordInParallel || engineDevice.inheritedQueries);
+
+  if (!recordInParallel) {
     // inline so that render pass isn't calling secondary command buffers
-    vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo,
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
                          VK_SUBPASS_CONTENTS_INLINE);
+    setViewportAndScissor(commandBuffer);
+    recordDraws(commandBuffer, frameIndex, drawCalls, 0, drawCount);
+    if (gpuSceneDraw != nullptr) {
+      recordGpuSceneDraw(commandBuffer, frameIndex, *gpuSceneDraw);
+    }
+  } else {
+    // The render pass only executes secondaries. Chunks whose draws changed
+    // are re-recorded on the worker threads while this thread waits, the
+    // rest are reused from the last time this frame slot was recorded
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
+                         VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+    VkCommandBufferInheritanceInfo inheritance{};
+    inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritance.renderPass = engineSwapChain.renderPass;
+    inheritance.subpass = 0;
+    // Left null so cached secondaries can run against any swap chain image
+    inheritance.framebuffer = VK_NULL_HANDLE;
+    // 0 unless the query above was started, which needs inheritedQueries
+    inheritance.pipelineStatistics = engineProfiler.activeStatistics();
+
+    parallelRecorder.record(
+        frameIndex, inheritance, drawCalls.data(), sizeof(DrawCall), drawCount,
+        [&](VkCommandBuffer secondary, uint32_t first, uint32_t count) {
+          setViewportAndScissor(secondary);
+          recordDraws(secondary, frameIndex, drawCalls, first, count);
+        },
+        secondaryCommandBuffers);
+
+    vkCmdExecuteCommands(
+        commandBuffer, static_cast<uint32_t>(secondaryCommandBuffers.size()),
+        secondaryCommandBuffers.data());
+  }
 
-    bindCommandBufferToGraphicsPipelilne(commandBuffers[i]);
-
-    VkBuffer vertexBuffers[] = {engineInputModel.vertexBuffer};
-    VkDeviceSize offsets[] = {0};
-    vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
+  vkCmdEndRenderPass(commandBuffer);
 
-    vkCmdBindIndexBuffer(commandBuffers[i], engineInputModel.indexBuffer, 0,
-                         VK_INDEX_TYPE_UINT16);
+  engineProfiler.endScope(commandBuffer, mainPassScope);
+  engineProfiler.endScope(commandBuffer, frameScope);
 
-    // Drawing with only vertex buffer
-    // vkCmdDraw(commandBuffers[i],
-    //           static_cast<uint32_t>(engineInputModel.vertices.size()), 1, 0,
-    //           0);
+  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+    throw std::runtime_error("failed to record command buffer!");
+  }
+}
 
-    // bind the right descriptor
-    vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS,
-                            pipelineLayout, 0, 1, &descriptorSets[i], 0,
-                            nullptr);
+void VkEnginePipeline::recordDraws(VkCommandBuffer commandBuffer,
+                                   uint32_t frameIndex,
+                                   const std::vector<DrawCall> &drawCalls,
+                                   uint32_t first, uint32_t count) {
+  // Secondaries don't inherit any bound state, so every one of them binds
+  // everything again. Binding 1 is only read by the instanced pipeline
+  VkBuffer vertexBuffers[] = {engineInputModel.vertexBuffer,
+                              engineInputModel.instanceBuffer};
+  VkDeviceSize offsets[] = {0,
+                            engineInputModel.instanceFrameOffset(frameIndex)};
+  vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+
+  vkCmdBindIndexBuffer(commandBuffer, engineInputModel.indexBuffer, 0,
+                       VK_INDEX_TYPE_UINT16);
+
+  VkPipeline instancedDrawPipeline =
+      useBindless ? bindlessPipeline : instancedPipeline;
+  VkPipeline singleDrawPipeline = graphicsPipeline;
+  if (usePushConstants) {
+    singleDrawPipeline = useBindless ? pushBindlessPipeline : pushPipeline;
+  }
 
-    vkCmdDrawIndexed(commandBuffers[i],
-                     static_cast<uint32_t>(engineInputModel.indices.size()), 1,
-                     0, 0, 0);
+  VkPipeline boundPipeline = VK_NULL_HANDLE;
+  VkPipelineLayout boundLayout = VK_NULL_HANDLE;
+  uint32_t boundUniformOffset = 0;
+  for (uint32_t i = first; i < first + count; i++) {
+    const DrawCall &drawCall = drawCalls[i];
+
+    bool instanced = drawCall.instanceCount > 0;
+    VkPipeline pipeline =
+        instanced ? instancedDrawPipeline : singleDrawPipeline;
+    if (pipeline != boundPipeline) {
+      vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                        pipeline);
+      boundPipeline = pipeline;
+    }
 
-    vkCmdEndRenderPass(commandBuffers[i]);
+    bool bindless =
+        pipeline == bindlessPipeline || pipeline == pushBindlessPipeline;
+    VkPipelineLayout layout =
+        bindless ? bindlessPipelineLayout : pipelineLayout;
+    if (layout != boundLayout) {
+      // Binding set 0 through pipelineLayout disturbs set 1, so both are
+      // bound again whenever the layout changes. Every texture is in the one
+      // set 1, however many different textures the draws use
+      if (bindless) {
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                layout, 1, 1, &engineBindless.descriptorSet,
+                                0, nullptr);
+      }
+      vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                              layout, 0, 1, &descriptorSets[frameIndex], 1,
+                              &drawCall.uniformOffset);
+      boundLayout = layout;
+      boundUniformOffset = drawCall.uniformOffset;
+    } else if (drawCall.uniformOffset != boundUniformOffset) {
+      // Same descriptor set for every draw, only the dynamic offset into the
+      // uniform ring changes. Draws sharing a uniform skip the rebind
+      vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                              layout, 0, 1, &descriptorSets[frameIndex], 1,
+                              &drawCall.uniformOffset);
+      boundUniformOffset = drawCall.uniformOffset;
+    }
 
-    if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
-      throw std::runtime_error("failed to record command buffer!");
+    if (!instanced && usePushConstants) {
+      // Every layout has the same range, so this survives pipeline switches
+      vkCmdPushConstants(commandBuffer, layout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                         sizeof(DrawPushConstants), &drawCall.push);
     }
+
+    vkCmdDrawIndexed(commandBuffer,
+                     static_cast<uint32_t>(engineInputModel.indices.size()),
+                     instanced ? drawCall.instanceCount : 1, 0, 0,
+                     drawCall.firstInstance);
   }
 }
 
@@ -427,47 +993,65 @@ void VkEnginePipeline::recreateSwapChain() {
     glfwGetFramebufferSize(engineDevice.vkWindow.window, &width, &height);
     glfwWaitEvents();
   }
-  vkDeviceWaitIdle(engineDevice.logicalDevice);
 
-  cleanupSwapChain();
+  // No vkDeviceWaitIdle, frames in flight keep rendering into the old
+  // images, the deletion queue destroys them once those frames are done
+  VkFormat oldFormat = engineSwapChain.swapChainImageFormat;
+  engineSwapChain.retireSwapChain();
+  // Cached secondaries have the old extent baked into their viewport
+  markCommandsDirty();
   engineSwapChain.createSwapChain();
   engineSwapChain.createImageViews();
-  engineSwapChain.createRenderPass();
-  createGraphicsPipeline(
-      VkEnginePipeline::defaultPipelineConfigInfo(width, height));
+  engineSwapChain.imagesInFlight.resize(engineSwapChain.swapChainImages.size(),
+                                        VK_NULL_HANDLE);
+  // The render pass, and every pipeline made against it, only depend on the
+  // image format. A plain resize keeps them all
+  if (engineSwapChain.swapChainImageFormat != oldFormat) {
+    std::cout << "Swap chain format changed, rebuilding pipelines\n";
+    // Waits for a shader reload building against the old render pass. What
+    // it built is dropped, the rebuild below reads the same shaders
+    std::lock_guard<std::mutex> buildLock(buildMutex);
+    {
+      std::lock_guard<std::mutex> pendingLock(pendingMutex);
+      destroyGraphicsPipelineSet(pendingPipelines);
+      pipelinesPending = false;
+    }
+    // Frames in flight still use the old ones, they're deferred like the
+    // old swap chain
+    retireGraphicsPipelines();
+    VkDevice device = engineDevice.logicalDevice;
+    VkRenderPass oldRenderPass = engineSwapChain.renderPass;
+    engineDevice.deletionQueue.push([device, oldRenderPass]() {
+      vkDestroyRenderPass(device, oldRenderPass, nullptr);
+    });
+    engineSwapChain.createRenderPass();
+    createGraphicsPipeline(graphicsPipelineConfig);
+  }
   engineSwapChain.createFramebuffers();
-  createCommandBuffers();
 }
 
-void VkEnginePipeline::cleanupSwapChain() {
-  for (int i = 0; i < engineSwapChain.swapChainFramebuffers.size(); i++) {
-    vkDestroyFramebuffer(engineDevice.logicalDevice,
-                         engineSwapChain.swapChainFramebuffers[i], nullptr);
-  }
-
-  vkFreeCommandBuffers(engineDevice.logicalDevice, engineDevice.commandPool,
-                       static_cast<uint32_t>(commandBuffers.size()),
-                       commandBuffers.data());
-
-  vkDestroyShaderModule(engineDevice.logicalDevice, fragShaderModule, nullptr);
-  vkDestroyShaderModule(engineDevice.logicalDevice, vertShaderModule, nullptr);
-  vkDestroyPipeline(engineDevice.logicalDevice, graphicsPipeline, nullptr);
-  vkDestroyPipelineLayout(engineDevice.logicalDevice, pipelineLayout, nullptr);
-  vkDestroyRenderPass(engineDevice.logicalDevice, engineSwapChain.renderPass,
-                      nullptr);
-  for (int i = 0; i < engineSwapChain.swapChainImageViews.size(); i++) {
-    vkDestroyImageView(engineDevice.logicalDevice,
-                       engineSwapChain.swapChainImageViews[i], nullptr);
-  }
-
-  vkDestroySwapchainKHR(engineDevice.logicalDevice, engineSwapChain.swapChain,
-                        nullptr);
+void VkEnginePipeline::setViewportAndScissor(VkCommandBuffer commandBuffer) {
+  VkViewport viewport{};
+  viewport.x = 0.0f;
+  viewport.y = 0.0f;
+  // swap chain extent and not window extent due to high density displays
+  viewport.width = static_cast<float>(engineSwapChain.swapChainExtent.width);
+  viewport.height = static_cast<float>(engineSwapChain.swapChainExtent.height);
+  viewport.minDepth = 0.0f;
+  viewport.maxDepth = 1.0f;
+  vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+  VkRect2D scissor{};
+  scissor.offset = {0, 0};
+  scissor.extent = engineSwapChain.swapChainExtent;
+  vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 }
 
 void VkEnginePipeline::createDescriptorSetLayout() {
   VkDescriptorSetLayoutBinding uboLayoutBinding{};
   uboLayoutBinding.binding = 0;
-  uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  // Dynamic so one set can point at any slot of the uniform ring
+  uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
   uboLayoutBinding.descriptorCount = 1;
   uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
   uboLayoutBinding.pImmutableSamplers = nullptr;
@@ -489,34 +1073,21 @@ void VkEnginePipeline::createDescriptorSetLayout() {
   layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
   layoutInfo.pBindings = bindings.data();
 
-  if (vkCreateDescriptorSetLayout(engineDevice.logicalDevice, &layoutInfo,
-                                  nullptr,
-                                  &descriptorSetLayout) != VK_SUCCESS) {
-    throw std::runtime_error("failed to create descriptor set layout!");
-  }
+  descriptorSetLayout = engineDevice.layoutCache.createLayout(layoutInfo);
 }
 
 void VkEnginePipeline::createDescriptorSets() {
-  std::vector<VkDescriptorSetLayout> layouts(
-      VkEngineDevice::MAX_FRAMES_IN_FLIGHT, descriptorSetLayout);
-
-  VkDescriptorSetAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-  allocInfo.descriptorPool = engineInputModel.descriptorPool;
-
-  allocInfo.descriptorSetCount =
-      static_cast<uint32_t>(VkEngineDevice::MAX_FRAMES_IN_FLIGHT);
-  allocInfo.pSetLayouts = layouts.data();
-
+  // Live as long as the pipeline, so they come from the device's allocator
   descriptorSets.resize(VkEngineDevice::MAX_FRAMES_IN_FLIGHT);
-  if (vkAllocateDescriptorSets(engineDevice.logicalDevice, &allocInfo,
-                               descriptorSets.data()) != VK_SUCCESS) {
-    throw std::runtime_error("failed to allocate descriptor sets!");
+  for (size_t i = 0; i < VkEngineDevice::MAX_FRAMES_IN_FLIGHT; i++) {
+    descriptorSets[i] =
+        engineDevice.descriptorAllocator.allocate(descriptorSetLayout);
   }
 
   for (size_t i = 0; i < VkEngineDevice::MAX_FRAMES_IN_FLIGHT; i++) {
     VkDescriptorBufferInfo bufferInfo{};
-    bufferInfo.buffer = engineInputModel.uniformBuffers[i];
+    // offset is supplied at bind time as a dynamic offset
+    bufferInfo.buffer = engineInputModel.uniformBuffer;
     bufferInfo.offset = 0;
     bufferInfo.range = sizeof(UniformBufferObject);
 
@@ -532,7 +1103,8 @@ void VkEnginePipeline::createDescriptorSets() {
     descriptorWriteUBO.dstSet = descriptorSets[i];
     descriptorWriteUBO.dstBinding = 0;
     descriptorWriteUBO.dstArrayElement = 0;
-    descriptorWriteUBO.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    descriptorWriteUBO.descriptorType =
+        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     descriptorWriteUBO.descriptorCount = 1;
     descriptorWriteUBO.pBufferInfo = &bufferInfo;
     descriptorWriteUBO.pImageInfo = nullptr;       // Optional
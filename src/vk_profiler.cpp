@@ -0,0 +1,250 @@
+#include "vk_profiler.hpp"
+
+namespace ve {
+
+static const uint32_t INVALID_SCOPE = UINT32_MAX;
+
+VkEngineProfiler::VkEngineProfiler(VkEngineDevice &eDevice)
+    : engineDevice{eDevice} {
+  if (engineDevice.timestampValidBits == 0) {
+    std::cout << "Profiler: graphics queue has no timestamp support\n";
+    return;
+  }
+  enabled = true;
+  statisticsEnabled = engineDevice.pipelineStatisticsQuery;
+  if (engineDevice.timestampValidBits < 64) {
+    timestampMask = (1ull << engineDevice.timestampValidBits) - 1;
+  }
+
+  frames.resize(VkEngineDevice::MAX_FRAMES_IN_FLIGHT);
+  for (auto &frame : frames) {
+    VkQueryPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = MAX_SCOPES * 2;
+
+    if (vkCreateQueryPool(engineDevice.logicalDevice, &poolInfo, nullptr,
+                          &frame.timestampPool) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create timestamp query pool!");
+    }
+
+    if (statisticsEnabled) {
+      poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+      poolInfo.queryCount = MAX_SCOPES;
+      poolInfo.pipelineStatistics = STATISTICS;
+
+      if (vkCreateQueryPool(engineDevice.logicalDevice, &poolInfo, nullptr,
+                            &frame.statisticsPool) != VK_SUCCESS) {
+        throw std::runtime_error(
+            "failed to create pipeline statistics query pool!");
+      }
+    }
+  }
+
+  std::cout << "Profiler: " << engineDevice.timestampPeriod << " ns/tick, "
+            << engineDevice.timestampValidBits << " valid timestamp bits"
+            << (statisticsEnabled ? ", pipeline statistics on" : "") << "\n";
+}
+
+VkEngineProfiler::~VkEngineProfiler() {
+  for (auto &frame : frames) {
+    vkDestroyQueryPool(engineDevice.logicalDevice, frame.timestampPool,
+                       nullptr);
+    if (frame.statisticsPool != VK_NULL_HANDLE) {
+      vkDestroyQueryPool(engineDevice.logicalDevice, frame.statisticsPool,
+                         nullptr);
+    }
+  }
+}
+
+void VkEngineProfiler::beginFrame(VkCommandBuffer commandBuffer,
+                                  uint32_t frameIndex) {
+  if (!enabled) {
+    return;
+  }
+  recordingFrame = frameIndex;
+  FrameQueries &frame = frames[frameIndex];
+
+  if (frame.recorded) {
+    collectResults(frame);
+  }
+
+  frame.scopeNames.clear();
+  frame.scopeStatistics.clear();
+  frame.statisticsCount = 0;
+  frame.recorded = true;
+  statisticsActive = false;
+
+  // Queries have to be reset before they can be written again, done on the
+  // GPU so it's ordered with the rest of the frame
+  vkCmdResetQueryPool(commandBuffer, frame.timestampPool, 0, MAX_SCOPES * 2);
+  if (frame.statisticsPool != VK_NULL_HANDLE) {
+    vkCmdResetQueryPool(commandBuffer, frame.statisticsPool, 0, MAX_SCOPES);
+  }
+}
+
+uint32_t VkEngineProfiler::beginScope(VkCommandBuffer commandBuffer,
+                                      const std::string &name,
+                                      bool withStatistics) {
+  if (!enabled) {
+    return INVALID_SCOPE;
+  }
+  FrameQueries &frame = frames[recordingFrame];
+  if (frame.scopeNames.size() >= MAX_SCOPES) {
+    return INVALID_SCOPE;
+  }
+
+  uint32_t scope = static_cast<uint32_t>(frame.scopeNames.size());
+  frame.scopeNames.push_back(name);
+  frame.scopeStatistics.push_back(-1);
+
+  // TOP_OF_PIPE: written as soon as all earlier commands have started
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                      frame.timestampPool, scope * 2);
+
+  if (withStatistics && statisticsEnabled && !statisticsActive) {
+    frame.scopeStatistics[scope] = static_cast<int32_t>(frame.statisticsCount);
+    vkCmdBeginQuery(commandBuffer, frame.statisticsPool,
+                    frame.statisticsCount, 0);
+    frame.statisticsCount++;
+    statisticsActive = true;
+  }
+  return scope;
+}
+
+void VkEngineProfiler::endScope(VkCommandBuffer commandBuffer,
+                                uint32_t scope) {
+  if (!enabled || scope == INVALID_SCOPE) {
+    return;
+  }
+  FrameQueries &frame = frames[recordingFrame];
+
+  int32_t statisticsQuery = frame.scopeStatistics[scope];
+  if (statisticsQuery >= 0) {
+    vkCmdEndQuery(commandBuffer, frame.statisticsPool,
+                  static_cast<uint32_t>(statisticsQuery));
+    statisticsActive = false;
+  }
+
+  // BOTTOM_OF_PIPE: written once all earlier commands have finished
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                      frame.timestampPool, scope * 2 + 1);
+}
+
+VkQueryPipelineStatisticFlags VkEngineProfiler::activeStatistics() const {
+  return statisticsActive ? STATISTICS : 0;
+}
+
+void VkEngineProfiler::collectResults(FrameQueries &frame) {
+  uint32_t scopeCount = static_cast<uint32_t>(frame.scopeNames.size());
+  if (scopeCount == 0) {
+    return;
+  }
+
+  // Each query is followed by its availability word. Without WAIT_BIT this
+  // never blocks, a query that isn't done yet just reads as unavailable
+  std::vector<uint64_t> timestamps(scopeCount * 2 * 2);
+  vkGetQueryPoolResults(
+      engineDevice.logicalDevice, frame.timestampPool, 0, scopeCount * 2,
+      timestamps.size() * sizeof(uint64_t), timestamps.data(),
+      2 * sizeof(uint64_t),
+      VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+  const uint32_t statisticsStride = STATISTIC_COUNT + 1;
+  std::vector<uint64_t> statistics(frame.statisticsCount * statisticsStride);
+  if (frame.statisticsCount > 0) {
+    vkGetQueryPoolResults(
+        engineDevice.logicalDevice, frame.statisticsPool, 0,
+        frame.statisticsCount, statistics.size() * sizeof(uint64_t),
+        statistics.data(), statisticsStride * sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+  }
+
+  lastResults.clear();
+  for (uint32_t scope = 0; scope < scopeCount; scope++) {
+    const uint64_t *begin = &timestamps[scope * 4];
+    const uint64_t *end = &timestamps[scope * 4 + 2];
+    if (begin[1] == 0 || end[1] == 0) {
+      continue;
+    }
+
+    ProfileScopeResult result{};
+    result.name = frame.scopeNames[scope];
+    // Masking the difference also handles the counter wrapping around
+    uint64_t ticks = (end[0] - begin[0]) & timestampMask;
+    result.gpuMs = ticks * engineDevice.timestampPeriod / 1000000.0;
+
+    int32_t statisticsQuery = frame.scopeStatistics[scope];
+    if (statisticsQuery >= 0) {
+      const uint64_t *values = &statistics[statisticsQuery * statisticsStride];
+      if (values[STATISTIC_COUNT] != 0) {
+        result.hasStatistics = true;
+        result.inputAssemblyVertices = values[0];
+        result.inputAssemblyPrimitives = values[1];
+        result.vertexShaderInvocations = values[2];
+        result.clippingPrimitives = values[3];
+        result.fragmentShaderInvocations = values[4];
+      }
+    }
+
+    auto totals = scopeTotals.find(result.name);
+    if (totals == scopeTotals.end()) {
+      totals = scopeTotals.emplace(result.name, ScopeTotals{}).first;
+      scopeOrder.push_back(result.name);
+    }
+    totals->second.gpuMsTotal += result.gpuMs;
+    totals->second.gpuMsMax = std::max(totals->second.gpuMsMax, result.gpuMs);
+    totals->second.samples++;
+
+    lastResults.push_back(result);
+  }
+
+  framesCollected++;
+  if (framesCollected >= REPORT_INTERVAL) {
+    report();
+  }
+}
+
+bool VkEngineProfiler::getScopeResult(const std::string &name,
+                                      ProfileScopeResult &result) const {
+  for (const auto &scopeResult : lastResults) {
+    if (scopeResult.name == name) {
+      result = scopeResult;
+      return true;
+    }
+  }
+  return false;
+}
+
+void VkEngineProfiler::report() {
+  if (framesCollected == 0) {
+    return;
+  }
+
+  std::cout << "Profiler: GPU time over " << framesCollected << " frames\n";
+  for (const auto &name : scopeOrder) {
+    ScopeTotals &totals = scopeTotals[name];
+    if (totals.samples == 0) {
+      continue;
+    }
+    std::cout << "  " << name << ": " << totals.gpuMsTotal / totals.samples
+              << " ms avg, " << totals.gpuMsMax << " ms max\n";
+    totals = ScopeTotals{};
+  }
+
+  // Counters don't change much frame to frame, the latest ones will do
+  for (const auto &result : lastResults) {
+    if (result.hasStatistics) {
+      std::cout << "  " << result.name << ": "
+                << result.inputAssemblyVertices << " vertices, "
+                << result.inputAssemblyPrimitives << " primitives, "
+                << result.vertexShaderInvocations << " VS invocations, "
+                << result.clippingPrimitives << " primitives after clipping, "
+                << result.fragmentShaderInvocations << " FS invocations\n";
+    }
+  }
+
+  framesCollected = 0;
+}
+
+} // namespace ve
@@ -0,0 +1,313 @@
+#include "vk_scene.hpp"
+
+namespace ve {
+
+// Used as an lvalue in the conditionals below, so it needs a definition
+const SceneEntity VkEngineScene::NO_ENTITY;
+
+VkEngineScene::VkEngineScene(VkEngineThreadPool &pool) : threadPool{pool} {
+  changedRanges.resize(VkEngineDevice::MAX_FRAMES_IN_FLIGHT);
+  frameInstances.resize(VkEngineDevice::MAX_FRAMES_IN_FLIGHT);
+}
+
+SceneEntity VkEngineScene::createEntity(SceneEntity parentEntity) {
+  if (parentEntity != NO_ENTITY && parentEntity >= entityCount()) {
+    throw std::runtime_error("scene entity parent doesn't exist!");
+  }
+
+  SceneEntity entity = entityCount();
+  uint32_t slot = static_cast<uint32_t>(slotEntity.size());
+  entitySlot.push_back(slot);
+  entityParent.push_back(parentEntity);
+
+  // Appended for now, rebuildOrder moves it next to its siblings
+  slotEntity.push_back(entity);
+  parent.push_back(parentEntity == NO_ENTITY ? NO_ENTITY
+                                             : entitySlot[parentEntity]);
+  subtreeSize.push_back(1);
+  translation.push_back(glm::vec3(0.0f));
+  rotation.push_back(glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+  scale.push_back(glm::vec3(1.0f));
+  color.push_back(glm::vec4(1.0f));
+  textureIndex.push_back(0);
+  world.push_back(glm::mat4(1.0f));
+  dirty.push_back(0);
+
+  hierarchyChanged = true;
+  return entity;
+}
+
+uint32_t VkEngineScene::entityCount() const {
+  return static_cast<uint32_t>(entitySlot.size());
+}
+
+void VkEngineScene::markDirty(uint32_t slot) {
+  if (!dirty[slot]) {
+    dirty[slot] = 1;
+    dirtySlots.push_back(slot);
+  }
+}
+
+void VkEngineScene::setTranslation(SceneEntity entity,
+                                   const glm::vec3 &value) {
+  uint32_t slot = entitySlot[entity];
+  translation[slot] = value;
+  markDirty(slot);
+}
+
+void VkEngineScene::setRotation(SceneEntity entity, const glm::quat &value) {
+  uint32_t slot = entitySlot[entity];
+  rotation[slot] = value;
+  markDirty(slot);
+}
+
+void VkEngineScene::setScale(SceneEntity entity, const glm::vec3 &value) {
+  uint32_t slot = entitySlot[entity];
+  scale[slot] = value;
+  markDirty(slot);
+}
+
+void VkEngineScene::setColor(SceneEntity entity, const glm::vec4 &value) {
+  uint32_t slot = entitySlot[entity];
+  color[slot] = value;
+  // Goes out with the next instance copy like a transform change would
+  markDirty(slot);
+}
+
+const glm::mat4 &VkEngineScene::worldMatrix(SceneEntity entity) const {
+  return world[entitySlot[entity]];
+}
+
+void VkEngineScene::setTextureIndex(SceneEntity entity, uint32_t value) {
+  uint32_t slot = entitySlot[entity];
+  textureIndex[slot] = value;
+  markDirty(slot);
+}
+
+const glm::vec4 &VkEngineScene::entityColor(SceneEntity entity) const {
+  return color[entitySlot[entity]];
+}
+
+uint32_t VkEngineScene::entityTextureIndex(SceneEntity entity) const {
+  return textureIndex[entitySlot[entity]];
+}
+
+glm::mat4 VkEngineScene::localMatrix(uint32_t slot) const {
+  return glm::translate(glm::mat4(1.0f), translation[slot]) *
+         glm::mat4_cast(rotation[slot]) *
+         glm::scale(glm::mat4(1.0f), scale[slot]);
+}
+
+void VkEngineScene::updateRange(const SlotRange &range) {
+  // Pre-order, so a parent inside the range was already done and one outside
+  // it is clean
+  for (uint32_t slot = range.first; slot < range.end; slot++) {
+    world[slot] = parent[slot] == NO_ENTITY
+                      ? localMatrix(slot)
+                      : world[parent[slot]] * localMatrix(slot);
+    dirty[slot] = 0;
+  }
+}
+
+void VkEngineScene::update() {
+  auto startTime = std::chrono::high_resolution_clock::now();
+
+  if (hierarchyChanged) {
+    rebuildOrder();
+  }
+
+  updateCount++;
+  std::vector<SlotRange> &ranges =
+      changedRanges[updateCount % changedRanges.size()];
+  ranges.clear();
+
+  // A dirty slot inside the subtree of an earlier one is redone by that
+  // subtree anyway, what's left are disjoint subtrees
+  std::sort(dirtySlots.begin(), dirtySlots.end());
+  uint32_t coveredEnd = 0;
+  uint32_t dirtyCount = 0;
+  for (uint32_t slot : dirtySlots) {
+    if (slot < coveredEnd) {
+      continue;
+    }
+    coveredEnd = slot + subtreeSize[slot];
+    ranges.push_back({slot, coveredEnd});
+    dirtyCount += subtreeSize[slot];
+  }
+  dirtySlots.clear();
+
+  if (dirtyCount < PARALLEL_MIN_ENTITIES || threadPool.workers.empty()) {
+    for (const SlotRange &range : ranges) {
+      updateRange(range);
+    }
+  } else {
+    // Disjoint subtrees don't read each other's matrices, so whole ranges
+    // are batched into tasks of roughly equal size
+    uint32_t taskTarget = dirtyCount / (threadPool.workerCount() * 4);
+    if (taskTarget < TASK_ENTITIES) {
+      taskTarget = TASK_ENTITIES;
+    }
+    std::vector<uint32_t> taskStarts{0};
+    uint32_t taskSize = 0;
+    for (uint32_t i = 0; i < ranges.size(); i++) {
+      if (taskSize >= taskTarget) {
+        taskStarts.push_back(i);
+        taskSize = 0;
+      }
+      taskSize += ranges[i].end - ranges[i].first;
+    }
+    taskStarts.push_back(static_cast<uint32_t>(ranges.size()));
+
+    threadPool.dispatch(static_cast<uint32_t>(taskStarts.size() - 1),
+                        [&](uint32_t task) {
+                          for (uint32_t i = taskStarts[task];
+                               i < taskStarts[task + 1]; i++) {
+                            updateRange(ranges[i]);
+                          }
+                        });
+  }
+
+  entitiesUpdated += dirtyCount;
+  updateMs += std::chrono::duration<double, std::chrono::milliseconds::period>(
+                  std::chrono::high_resolution_clock::now() - startTime)
+                  .count();
+  updatesMeasured++;
+  if (updatesMeasured >= REPORT_INTERVAL) {
+    report();
+  }
+}
+
+void VkEngineScene::rebuildOrder() {
+  uint32_t count = entityCount();
+
+  // Children of every entity in creation order, as offsets into one array
+  std::vector<uint32_t> childStart(count + 1, 0);
+  for (SceneEntity entity = 0; entity < count; entity++) {
+    if (entityParent[entity] != NO_ENTITY) {
+      childStart[entityParent[entity] + 1]++;
+    }
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    childStart[i + 1] += childStart[i];
+  }
+  std::vector<SceneEntity> children(childStart[count]);
+  std::vector<uint32_t> childFill(childStart.begin(), childStart.end() - 1);
+  for (SceneEntity entity = 0; entity < count; entity++) {
+    if (entityParent[entity] != NO_ENTITY) {
+      children[childFill[entityParent[entity]]++] = entity;
+    }
+  }
+
+  // Depth first, pushing children in reverse so they come out in order
+  std::vector<SceneEntity> order;
+  order.reserve(count);
+  std::vector<SceneEntity> stack;
+  for (SceneEntity root = count; root-- > 0;) {
+    if (entityParent[root] == NO_ENTITY) {
+      stack.push_back(root);
+    }
+  }
+  while (!stack.empty()) {
+    SceneEntity entity = stack.back();
+    stack.pop_back();
+    order.push_back(entity);
+    for (uint32_t i = childStart[entity + 1]; i-- > childStart[entity];) {
+      stack.push_back(children[i]);
+    }
+  }
+
+  // Gather every slot array into the new order
+  auto permute = [&](auto &values) {
+    auto sorted = values;
+    for (uint32_t slot = 0; slot < count; slot++) {
+      sorted[slot] = values[entitySlot[order[slot]]];
+    }
+    values.swap(sorted);
+  };
+  permute(translation);
+  permute(rotation);
+  permute(scale);
+  permute(color);
+  permute(textureIndex);
+  permute(world);
+
+  slotEntity = order;
+  for (uint32_t slot = 0; slot < count; slot++) {
+    entitySlot[order[slot]] = slot;
+  }
+  for (uint32_t slot = 0; slot < count; slot++) {
+    SceneEntity parentEntity = entityParent[order[slot]];
+    parent[slot] =
+        parentEntity == NO_ENTITY ? NO_ENTITY : entitySlot[parentEntity];
+  }
+
+  // Children come after their parent, so walking backwards finishes every
+  // subtree before it's added to its parent's
+  std::fill(subtreeSize.begin(), subtreeSize.end(), 1);
+  for (uint32_t slot = count; slot-- > 0;) {
+    if (parent[slot] != NO_ENTITY) {
+      subtreeSize[parent[slot]] += subtreeSize[slot];
+    }
+  }
+
+  // Every slot moved, so everything is recomputed and rewritten once
+  dirtySlots.clear();
+  std::fill(dirty.begin(), dirty.end(), 0);
+  for (uint32_t slot = 0; slot < count; slot++) {
+    if (parent[slot] == NO_ENTITY) {
+      markDirty(slot);
+    }
+  }
+  for (auto &frame : frameInstances) {
+    frame.destination = nullptr;
+  }
+
+  hierarchyChanged = false;
+}
+
+void VkEngineScene::writeInstanceRange(InstanceData *destination,
+                                       const SlotRange &range) const {
+  for (uint32_t slot = range.first; slot < range.end; slot++) {
+    destination[slot].model = world[slot];
+    destination[slot].color = color[slot];
+    destination[slot].textureIndex = textureIndex[slot];
+  }
+}
+
+void VkEngineScene::writeInstances(uint32_t frameIndex,
+                                   InstanceData *destination) {
+  FrameInstances &frame = frameInstances[frameIndex];
+  uint64_t updatesSince = updateCount - frame.updateIndex;
+
+  // The changes since this frame slot was last written have to still be in
+  // the history, otherwise everything is copied
+  if (frame.destination != destination || frame.count != entityCount() ||
+      updatesSince > changedRanges.size()) {
+    writeInstanceRange(destination, {0, entityCount()});
+  } else {
+    for (uint64_t i = frame.updateIndex + 1; i <= updateCount; i++) {
+      for (const SlotRange &range : changedRanges[i % changedRanges.size()]) {
+        writeInstanceRange(destination, range);
+      }
+    }
+  }
+
+  frame.destination = destination;
+  frame.count = entityCount();
+  frame.updateIndex = updateCount;
+}
+
+void VkEngineScene::report() {
+  if (updatesMeasured == 0) {
+    return;
+  }
+  std::cout << "Scene: " << entityCount() << " entities, "
+            << static_cast<double>(entitiesUpdated) / updatesMeasured
+            << " updated per frame in " << updateMs / updatesMeasured
+            << " ms\n";
+  entitiesUpdated = 0;
+  updateMs = 0.0;
+  updatesMeasured = 0;
+}
+
+} // namespace ve
@@ -0,0 +1,382 @@
+#include "vk_shader_cache.hpp"
+
+#ifdef VE_SHADERC
+#include <shaderc/shaderc.hpp>
+#endif
+
+namespace ve {
+
+static const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+static const uint64_t FNV_PRIME = 1099511628211ull;
+
+// 64 bit FNV-1a, carrying on from hash
+static uint64_t hashBytes(const void *data, size_t size, uint64_t hash) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+static uint64_t hashString(const std::string &text, uint64_t hash) {
+  // Length first, so "ab" then "c" doesn't hash like "a" then "bc"
+  uint64_t size = text.size();
+  hash = hashBytes(&size, sizeof(size), hash);
+  return hashBytes(text.data(), text.size(), hash);
+}
+
+static bool readText(const std::string &path, std::string &text) {
+  std::ifstream file{path, std::ios::binary};
+  if (!file.is_open()) {
+    return false;
+  }
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  text = contents.str();
+  return true;
+}
+
+static bool readSpirv(const std::string &path, std::vector<uint32_t> &code) {
+  const uint32_t SPIRV_MAGIC = 0x07230203;
+
+  std::ifstream file{path, std::ios::ate | std::ios::binary};
+  if (!file.is_open()) {
+    return false;
+  }
+  size_t fileSize = static_cast<size_t>(file.tellg());
+  if (fileSize == 0 || fileSize % sizeof(uint32_t) != 0) {
+    return false;
+  }
+  code.resize(fileSize / sizeof(uint32_t));
+  file.seekg(0);
+  file.read(reinterpret_cast<char *>(code.data()), fileSize);
+  return file && code[0] == SPIRV_MAGIC;
+}
+
+// Both #include "name" and <name> are looked up next to the including file,
+// there are no include directories
+static std::string resolveInclude(const std::string &requestingPath,
+                                  const std::string &requested) {
+  std::filesystem::path directory =
+      std::filesystem::path(requestingPath).parent_path();
+  return (directory / requested).generic_string();
+}
+
+// Names source #includes, in order. Includes that are commented or #if'd
+// out are found too, that only costs an extra recompile when they change
+static std::vector<std::string> findIncludes(const std::string &source) {
+  std::vector<std::string> includes;
+  std::istringstream lines{source};
+  std::string line;
+  while (std::getline(lines, line)) {
+    size_t hashSign = line.find_first_not_of(" \t");
+    if (hashSign == std::string::npos || line[hashSign] != '#') {
+      continue;
+    }
+    size_t directive = line.find_first_not_of(" \t", hashSign + 1);
+    if (directive == std::string::npos ||
+        line.compare(directive, 7, "include") != 0) {
+      continue;
+    }
+    size_t open = line.find_first_of("\"<", directive + 7);
+    if (open == std::string::npos) {
+      continue;
+    }
+    size_t close = line.find(line[open] == '"' ? '"' : '>', open + 1);
+    if (close == std::string::npos) {
+      continue;
+    }
+    includes.push_back(line.substr(open + 1, close - open - 1));
+  }
+  return includes;
+}
+
+#ifdef VE_SHADERC
+// shaderc can't report its own version, the Makefiles pass in the SDK's
+#ifndef VE_SHADERC_VERSION
+#define VE_SHADERC_VERSION "unknown"
+#endif
+
+static const shaderc_env_version TARGET_ENV = shaderc_env_version_vulkan_1_2;
+static const shaderc_optimization_level OPTIMIZATION =
+    shaderc_optimization_level_performance;
+
+// Everything about the compiler that changes the SPIR-V it emits
+static std::string compilerIdentity() {
+  unsigned int spirvVersion = 0;
+  unsigned int spirvRevision = 0;
+  shaderc_get_spv_version(&spirvVersion, &spirvRevision);
+  std::ostringstream identity;
+  identity << "shaderc " << VE_SHADERC_VERSION << ", SPIR-V " << spirvVersion
+           << "." << spirvRevision << ", target env " << TARGET_ENV
+           << ", optimization " << OPTIMIZATION;
+  return identity.str();
+}
+
+static shaderc_shader_kind shaderKind(const std::string &sourcePath) {
+  std::string extension =
+      std::filesystem::path(sourcePath).extension().string();
+  if (extension == ".vert") {
+    return shaderc_glsl_vertex_shader;
+  }
+  if (extension == ".frag") {
+    return shaderc_glsl_fragment_shader;
+  }
+  if (extension == ".comp") {
+    return shaderc_glsl_compute_shader;
+  }
+  throw std::runtime_error("unknown shader stage: " + sourcePath);
+}
+
+// Resolves includes for shaderc the same way hashIncludes does
+class ShaderIncluder : public shaderc::CompileOptions::IncluderInterface {
+public:
+  struct Include {
+    std::string name;
+    std::string content;
+    shaderc_include_result result;
+  };
+
+  shaderc_include_result *GetInclude(const char *requestedSource,
+                                     shaderc_include_type /*type*/,
+                                     const char *requestingSource,
+                                     size_t /*includeDepth*/) override {
+    Include *include = new Include{};
+    std::string path = resolveInclude(requestingSource, requestedSource);
+    if (readText(path, include->content)) {
+      include->name = path;
+    } else {
+      // An empty name tells shaderc the include failed, with content as the
+      // error message
+      include->content = "can't open " + path;
+    }
+    include->result.source_name = include->name.c_str();
+    include->result.source_name_length = include->name.size();
+    include->result.content = include->content.c_str();
+    include->result.content_length = include->content.size();
+    include->result.user_data = include;
+    return &include->result;
+  }
+
+  void ReleaseInclude(shaderc_include_result *data) override {
+    delete static_cast<Include *>(data->user_data);
+  }
+};
+#endif
+
+void VkEngineShaderCache::init(VkDevice device) {
+  logicalDevice = device;
+  if (hasCompiler()) {
+    std::error_code error;
+    std::filesystem::create_directories(cacheDirectory, error);
+  }
+}
+
+void VkEngineShaderCache::cleanup() {
+  std::cout << "Shader cache: " << compiled << " compiled, " << diskHits
+            << " from disk, " << memoryHits << " from memory, "
+            << modulesCreated << " modules created, " << modulesShared
+            << " reused\n";
+  for (auto &entry : codeModules) {
+    vkDestroyShaderModule(logicalDevice, entry.second.module, nullptr);
+  }
+  codeModules.clear();
+  keyModules.clear();
+}
+
+bool VkEngineShaderCache::hasCompiler() {
+#ifdef VE_SHADERC
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool VkEngineShaderCache::isAvailable(const std::string &sourcePath) const {
+  std::ifstream file{hasCompiler() ? sourcePath : sourcePath + ".spv"};
+  return file.is_open();
+}
+
+VkShaderModule VkEngineShaderCache::getModule(const std::string &sourcePath,
+                                              const Defines &defines) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  if (!hasCompiler()) {
+    if (!defines.empty()) {
+      throw std::runtime_error("shader defines need a VE_SHADERC build: " +
+                               sourcePath);
+    }
+    std::string spirvPath = sourcePath + ".spv";
+    std::vector<uint32_t> code;
+    if (!readSpirv(spirvPath, code)) {
+      throw std::runtime_error("Failed to open file: " + spirvPath);
+    }
+    return shareModule(std::move(code));
+  }
+
+  std::string source;
+  if (!readText(sourcePath, source)) {
+    throw std::runtime_error("Failed to open file: " + sourcePath);
+  }
+  uint64_t key = cacheKey(sourcePath, source, defines);
+  auto cached = keyModules.find(key);
+  if (cached != keyModules.end()) {
+    memoryHits++;
+    return cached->second;
+  }
+
+  std::vector<uint32_t> code;
+  if (loadCached(key, code)) {
+    diskHits++;
+  } else {
+    code = compile(sourcePath, source, defines);
+    storeCached(key, code);
+  }
+  VkShaderModule module = shareModule(std::move(code));
+  keyModules.emplace(key, module);
+  return module;
+}
+
+uint64_t VkEngineShaderCache::cacheKey(const std::string &sourcePath,
+                                       const std::string &source,
+                                       const Defines &defines) {
+  uint64_t hash = FNV_OFFSET_BASIS;
+  uint32_t formatVersion = CACHE_FORMAT_VERSION;
+  hash = hashBytes(&formatVersion, sizeof(formatVersion), hash);
+#ifdef VE_SHADERC
+  hash = hashString(compilerIdentity(), hash);
+#endif
+  // The stage, identical text compiles differently as another stage
+  hash = hashString(std::filesystem::path(sourcePath).extension().string(),
+                    hash);
+  for (const auto &define : defines) {
+    hash = hashString(define.first, hash);
+    hash = hashString(define.second, hash);
+  }
+  // Not the path, the same source in two files compiles the same. Includes
+  // are looked up relative to it though, hashIncludes covers that
+  hash = hashString(source, hash);
+  return hashIncludes(sourcePath, source, hash, 0);
+}
+
+uint64_t VkEngineShaderCache::hashIncludes(const std::string &path,
+                                           const std::string &source,
+                                           uint64_t hash, uint32_t depth) {
+  if (depth >= MAX_INCLUDE_DEPTH) {
+    return hash;
+  }
+  for (const std::string &name : findIncludes(source)) {
+    std::string includePath = resolveInclude(path, name);
+    hash = hashString(includePath, hash);
+    // A missing include only goes in by name, compiling it fails anyway
+    std::string text;
+    if (readText(includePath, text)) {
+      hash = hashString(text, hash);
+      hash = hashIncludes(includePath, text, hash, depth + 1);
+    }
+  }
+  return hash;
+}
+
+std::string VkEngineShaderCache::cachePath(uint64_t key) const {
+  std::ostringstream path;
+  path << cacheDirectory << "/" << std::hex << std::setw(16)
+       << std::setfill('0') << key << ".spv";
+  return path.str();
+}
+
+bool VkEngineShaderCache::loadCached(uint64_t key,
+                                     std::vector<uint32_t> &code) {
+  // A truncated or foreign file fails the size and magic checks and is
+  // simply compiled over
+  return readSpirv(cachePath(key), code);
+}
+
+void VkEngineShaderCache::storeCached(uint64_t key,
+                                      const std::vector<uint32_t> &code) {
+  // Same as the pipeline cache, a temp file renamed over the entry so a
+  // crash mid write never leaves a truncated one
+  std::string path = cachePath(key);
+  std::string tempPath = path + ".tmp";
+  std::ofstream file{tempPath, std::ios::binary | std::ios::trunc};
+  file.write(reinterpret_cast<const char *>(code.data()),
+             code.size() * sizeof(uint32_t));
+  file.close();
+  if (!file) {
+    std::cerr << "failed to write shader cache entry " << tempPath << "\n";
+    return;
+  }
+
+  std::error_code error;
+  std::filesystem::rename(tempPath, path, error);
+  if (error) {
+    std::cerr << "failed to store shader cache entry: " << error.message()
+              << "\n";
+  }
+}
+
+std::vector<uint32_t>
+VkEngineShaderCache::compile(const std::string &sourcePath,
+                             const std::string &source,
+                             const Defines &defines) {
+#ifdef VE_SHADERC
+  shaderc::Compiler compiler;
+  shaderc::CompileOptions options;
+  options.SetTargetEnvironment(shaderc_target_env_vulkan, TARGET_ENV);
+  options.SetOptimizationLevel(OPTIMIZATION);
+  for (const auto &define : defines) {
+    options.AddMacroDefinition(define.first, define.second);
+  }
+  options.SetIncluder(std::make_unique<ShaderIncluder>());
+
+  auto startTime = std::chrono::high_resolution_clock::now();
+  shaderc::SpvCompilationResult result = compiler.CompileGlslToSpv(
+      source, shaderKind(sourcePath), sourcePath.c_str(), options);
+  if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
+    throw std::runtime_error("failed to compile " + sourcePath + ":\n" +
+                             result.GetErrorMessage());
+  }
+  double milliseconds =
+      std::chrono::duration<double, std::chrono::milliseconds::period>(
+          std::chrono::high_resolution_clock::now() - startTime)
+          .count();
+
+  compiled++;
+  std::cout << "Compiled " << sourcePath << " in " << milliseconds << " ms\n";
+  return std::vector<uint32_t>(result.cbegin(), result.cend());
+#else
+  (void)source;
+  (void)defines;
+  throw std::runtime_error("built without VE_SHADERC, can't compile " +
+                           sourcePath);
+#endif
+}
+
+VkShaderModule VkEngineShaderCache::shareModule(std::vector<uint32_t> code) {
+  uint64_t codeHash = hashBytes(code.data(), code.size() * sizeof(uint32_t),
+                                FNV_OFFSET_BASIS);
+  auto candidates = codeModules.equal_range(codeHash);
+  for (auto entry = candidates.first; entry != candidates.second; ++entry) {
+    if (entry->second.code == code) {
+      modulesShared++;
+      return entry->second.module;
+    }
+  }
+
+  VkShaderModuleCreateInfo createInfo{};
+  createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  createInfo.codeSize = code.size() * sizeof(uint32_t);
+  createInfo.pCode = code.data();
+
+  VkShaderModule shaderModule;
+  if (vkCreateShaderModule(logicalDevice, &createInfo, nullptr,
+                           &shaderModule) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create shader module!");
+  }
+  modulesCreated++;
+  codeModules.emplace(codeHash, SharedModule{shaderModule, std::move(code)});
+  return shaderModule;
+}
+
+} // namespace ve
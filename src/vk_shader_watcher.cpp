@@ -0,0 +1,227 @@
+#include "vk_shader_watcher.hpp"
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace ve {
+
+VkEngineShaderWatcher::~VkEngineShaderWatcher() { stop(); }
+
+void VkEngineShaderWatcher::start(const std::string &directory,
+                                  const std::string &compiler,
+                                  CompiledCallback callback) {
+  shaderDirectory = directory;
+  compilerCommand = compiler;
+  onCompiled = std::move(callback);
+
+#ifdef __linux__
+  inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotifyFd >= 0 &&
+      inotify_add_watch(inotifyFd, shaderDirectory.c_str(),
+                        IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    close(inotifyFd);
+    inotifyFd = -1;
+  }
+#endif
+  if (inotifyFd < 0) {
+    // Only changes from now on count, not every source that already exists
+    scanWriteTimes();
+  }
+
+  std::cout << "Watching " << shaderDirectory << " for shader changes ("
+            << (inotifyFd >= 0 ? "inotify" : "polling") << ")\n";
+  stopping = false;
+  watcher = std::thread(&VkEngineShaderWatcher::watchLoop, this);
+}
+
+void VkEngineShaderWatcher::stop() {
+  stopping = true;
+  if (watcher.joinable()) {
+    watcher.join();
+  }
+#ifdef __linux__
+  if (inotifyFd >= 0) {
+    close(inotifyFd);
+  }
+#endif
+  inotifyFd = -1;
+}
+
+bool VkEngineShaderWatcher::running() const { return watcher.joinable(); }
+
+bool VkEngineShaderWatcher::isShaderSource(const std::string &fileName) {
+  auto endsWith = [&fileName](const std::string &suffix) {
+    return fileName.size() > suffix.size() &&
+           fileName.compare(fileName.size() - suffix.size(), suffix.size(),
+                            suffix) == 0;
+  };
+  return endsWith(".vert") || endsWith(".frag");
+}
+
+void VkEngineShaderWatcher::report() {
+  if (!running()) {
+    return;
+  }
+  std::cout << "Shader watcher: " << compiled << " compiled, " << failed
+            << " failed\n";
+}
+
+void VkEngineShaderWatcher::watchLoop() {
+  while (!stopping) {
+    std::set<std::string> changed = waitForChanges();
+
+    std::vector<std::string> sourcePaths;
+    for (const std::string &sourcePath : changed) {
+      if (stopping) {
+        return;
+      }
+      if (compilerCommand.empty() || compile(sourcePath)) {
+        sourcePaths.push_back(sourcePath);
+      }
+    }
+    if (!sourcePaths.empty() && onCompiled) {
+      onCompiled(sourcePaths);
+    }
+  }
+}
+
+std::set<std::string> VkEngineShaderWatcher::waitForChanges() {
+  if (inotifyFd >= 0) {
+    return waitForInotify();
+  }
+
+  std::set<std::string> changed;
+  uint32_t intervalMs = POLL_INTERVAL_MS;
+  while (!stopping && changed.empty()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(intervalMs));
+    changed = scanWriteTimes();
+  }
+  return changed;
+}
+
+std::set<std::string> VkEngineShaderWatcher::waitForInotify() {
+  std::set<std::string> changed;
+#ifdef __linux__
+  pollfd pollFd{};
+  pollFd.fd = inotifyFd;
+  pollFd.events = POLLIN;
+
+  // Wakes up every POLL_INTERVAL_MS to check for stop(). After the first
+  // event only waits SETTLE_MS for more, an editor's save can be several
+  int timeout = POLL_INTERVAL_MS;
+  while (!stopping) {
+    if (poll(&pollFd, 1, timeout) <= 0) {
+      if (!changed.empty()) {
+        break;
+      }
+      continue;
+    }
+
+    alignas(inotify_event) char buffer[4096];
+    ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+    for (ssize_t offset = 0; offset < length;) {
+      auto event = reinterpret_cast<const inotify_event *>(buffer + offset);
+      // .spv files written by compile() land here too and are skipped
+      if (event->len > 0 && isShaderSource(event->name)) {
+        changed.insert(shaderDirectory + "/" + event->name);
+      }
+      offset += sizeof(inotify_event) + event->len;
+    }
+    if (!changed.empty()) {
+      timeout = SETTLE_MS;
+    }
+  }
+#endif
+  return changed;
+}
+
+std::set<std::string> VkEngineShaderWatcher::scanWriteTimes() {
+  std::set<std::string> changed;
+  std::error_code error;
+  std::filesystem::directory_iterator entries{shaderDirectory, error};
+  if (error) {
+    return changed;
+  }
+
+  for (const auto &entry : entries) {
+    std::string name = entry.path().filename().string();
+    if (!isShaderSource(name)) {
+      continue;
+    }
+    auto writeTime = entry.last_write_time(error);
+    if (error) {
+      continue;
+    }
+    std::string path = shaderDirectory + "/" + name;
+    auto seen = writeTimes.find(path);
+    if (seen == writeTimes.end() || seen->second != writeTime) {
+      changed.insert(path);
+    }
+    writeTimes[path] = writeTime;
+  }
+  return changed;
+}
+
+// Quotes a path for the shell std::system runs, so a file name can't turn
+// into extra arguments or commands. False if it can't be quoted safely
+static bool quotePath(const std::string &path, std::string &quoted) {
+#ifdef _WIN32
+  // cmd still expands %variables% inside double quotes and can't escape them
+  // there, " itself isn't allowed in file names
+  if (path.find_first_of("%\"") != std::string::npos) {
+    return false;
+  }
+  quoted = "\"" + path + "\"";
+#else
+  // Nothing is special inside single quotes, a ' has to end the quote, add
+  // an escaped ' and start a new one
+  quoted = "'";
+  for (char c : path) {
+    if (c == '\'') {
+      quoted += "'\\''";
+    } else {
+      quoted += c;
+    }
+  }
+  quoted += "'";
+#endif
+  return true;
+}
+
+bool VkEngineShaderWatcher::compile(const std::string &sourcePath) {
+  std::string quotedSource;
+  std::string quotedSpirv;
+  if (!quotePath(sourcePath, quotedSource) ||
+      !quotePath(sourcePath + ".spv", quotedSpirv)) {
+    failed++;
+    std::cout << "Can't pass " << sourcePath
+              << " to the compiler safely, keeping the old pipelines\n";
+    return false;
+  }
+  std::string command =
+      compilerCommand + " " + quotedSource + " -o " + quotedSpirv;
+
+  auto startTime = std::chrono::high_resolution_clock::now();
+  // The compiler prints its own errors, and leaves the old .spv alone when
+  // there are any
+  int status = std::system(command.c_str());
+  double milliseconds =
+      std::chrono::duration<double, std::chrono::milliseconds::period>(
+          std::chrono::high_resolution_clock::now() - startTime)
+          .count();
+
+  if (status != 0) {
+    failed++;
+    std::cout << "Failed to compile " << sourcePath
+              << ", keeping the old pipelines\n";
+    return false;
+  }
+  compiled++;
+  std::cout << "Compiled " << sourcePath << " in " << milliseconds << " ms\n";
+  return true;
+}
+
+} // namespace ve
@@ -0,0 +1,81 @@
+#include "vk_staging_ring.hpp"
+
+namespace ve {
+
+VkEngineStagingRing::VkEngineStagingRing(VkEngineAllocator &engineAllocator,
+                                         VkDeviceSize size)
+    : allocator{engineAllocator}, capacity{size} {
+  allocator.createBuffer(capacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                             VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                         buffer, memory);
+}
+
+VkEngineStagingRing::~VkEngineStagingRing() {
+  std::cout << "Staging ring: " << bytesStaged / 1024 << " KB staged through "
+            << capacity / 1024 << " KB, wrapped " << wraps << " times\n";
+  allocator.destroyBuffer(buffer, memory);
+}
+
+bool VkEngineStagingRing::allocate(VkDeviceSize size, VkDeviceSize alignment,
+                                   VkDeviceSize &outOffset) {
+  if (size > capacity) {
+    return false;
+  }
+
+  // Nothing in flight, start over at offset 0 so a large allocation doesn't
+  // get refused just because head sits in the middle of the buffer
+  if (head == tail) {
+    head = 0;
+    tail = 0;
+  }
+
+  uint64_t start = (head + alignment - 1) & ~(uint64_t)(alignment - 1);
+  VkDeviceSize startOffset = start % capacity;
+
+  // Doesn't fit before the end of the buffer, skip the leftover bytes and
+  // start again at offset 0
+  if (startOffset + size > capacity) {
+    start += capacity - startOffset;
+    startOffset = 0;
+  }
+
+  // Would overwrite data the GPU hasn't copied out yet
+  if (start + size - tail > capacity) {
+    return false;
+  }
+
+  if (start / capacity != head / capacity) {
+    wraps++;
+  }
+  head = start + size;
+  bytesStaged += size;
+  outOffset = startOffset;
+  return true;
+}
+
+void *VkEngineStagingRing::mappedAt(VkDeviceSize offset) {
+  return static_cast<char *>(memory.mappedData) + offset;
+}
+
+bool VkEngineStagingRing::hasUnsubmitted() {
+  uint64_t submittedEnd =
+      submittedRegions.empty() ? tail : submittedRegions.back().end;
+  return head > submittedEnd;
+}
+
+void VkEngineStagingRing::submit(uint64_t signalValue) {
+  if (hasUnsubmitted()) {
+    submittedRegions.push_back({head, signalValue});
+  }
+}
+
+void VkEngineStagingRing::reclaim(uint64_t completedValue) {
+  while (!submittedRegions.empty() &&
+         submittedRegions.front().signalValue <= completedValue) {
+    tail = submittedRegions.front().end;
+    submittedRegions.pop_front();
+  }
+}
+
+} // namespace ve
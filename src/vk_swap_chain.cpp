@@ -1,8 +1,12 @@
 #include "vk_swap_chain.hpp"
 namespace ve {
 
-VkEngineSwapChain::VkEngineSwapChain(VkEngineDevice &eDevice, VkModel &model)
-    : engineDevice{eDevice}, inputModel{model} {
+VkEngineSwapChain::VkEngineSwapChain(VkEngineDevice &eDevice, VkModel &model,
+                                     VkPresentModeKHR presentModeRequest,
+                                     uint32_t imageCountRequest)
+    : engineDevice{eDevice}, inputModel{model},
+      preferredPresentMode{presentModeRequest},
+      preferredImageCount{imageCountRequest} {
 
   createSwapChain();
   createImageViews();
@@ -25,7 +29,11 @@ VkEngineSwapChain::~VkEngineSwapChain() {
 
   vkDestroyImageView(engineDevice.logicalDevice, textureImageView, nullptr);
 
-  vkDestroySwapchainKHR(engineDevice.logicalDevice, swapChain, nullptr);
+  if (engineDevice.headless) {
+    destroyOffscreenImages();
+  } else {
+    vkDestroySwapchainKHR(engineDevice.logicalDevice, swapChain, nullptr);
+  }
 
   vkDestroyRenderPass(engineDevice.logicalDevice, renderPass, nullptr);
 
@@ -60,14 +68,43 @@ VkSurfaceFormatKHR VkEngineSwapChain::chooseSwapSurfaceFormat(
   return availableFormats[0];
 }
 
+const char *VkEngineSwapChain::presentModeName(VkPresentModeKHR mode) {
+  switch (mode) {
+  case VK_PRESENT_MODE_IMMEDIATE_KHR:
+    return "immediate";
+  case VK_PRESENT_MODE_MAILBOX_KHR:
+    return "mailbox";
+  case VK_PRESENT_MODE_FIFO_KHR:
+    return "fifo";
+  case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+    return "fifo-relaxed";
+  default:
+    return "other";
+  }
+}
+
 VkPresentModeKHR VkEngineSwapChain::chooseSwapPresentMode(
     const std::vector<VkPresentModeKHR> &availablePresentModes) {
-
+  // IMMEDIATE tears but has the least latency, MAILBOX replaces the queued
+  // image so it doesn't tear or block, FIFO is vsync and FIFO_RELAXED only
+  // tears when a frame came in late
+  bool mailboxAvailable = false;
   for (int i = 0; i < availablePresentModes.size(); i++) {
-    if (availablePresentModes[i] == VK_PRESENT_MODE_MAILBOX_KHR) {
+    if (availablePresentModes[i] == preferredPresentMode) {
       return availablePresentModes[i];
     }
-    std::cout << "avail present modes " << availablePresentModes[i] << "\n";
+    if (availablePresentModes[i] == VK_PRESENT_MODE_MAILBOX_KHR) {
+      mailboxAvailable = true;
+    }
+    std::cout << "avail present modes "
+              << presentModeName(availablePresentModes[i]) << "\n";
+  }
+  if (preferredPresentMode != VK_PRESENT_MODE_MAX_ENUM_KHR) {
+    std::cout << "Present mode " << presentModeName(preferredPresentMode)
+              << " not supported by the surface\n";
+  }
+  if (mailboxAvailable) {
+    return VK_PRESENT_MODE_MAILBOX_KHR;
   }
   // guaranteed to be avail
   return VK_PRESENT_MODE_FIFO_KHR;
@@ -100,6 +137,10 @@ VkExtent2D VkEngineSwapChain::chooseSwapExtent(
 }
 
 void VkEngineSwapChain::createSwapChain() {
+  if (engineDevice.headless) {
+    createOffscreenImages();
+    return;
+  }
   std::cout << "Creating Swap Chain\n";
   SwapChainSupportDetails swapChainSupport =
       engineDevice.querySwapChainSupport(engineDevice.physicalDevice);
@@ -107,8 +148,7 @@ void VkEngineSwapChain::createSwapChain() {
   VkSurfaceFormatKHR surfaceFormat =
       chooseSwapSurfaceFormat(swapChainSupport.formats);
 
-  VkPresentModeKHR presentMode =
-      chooseSwapPresentMode(swapChainSupport.presentModes);
+  presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
 
   VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
   std::cout << "SwapChain extent h: " << extent.height << " w:" << extent.width
@@ -121,6 +161,14 @@ void VkEngineSwapChain::createSwapChain() {
   // we can acquire another image to render to. Therefore it is recommended to
   // request at least one more image than the minimum:
   uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+  // More images let the CPU run further ahead of the display, fewer cut
+  // latency with FIFO
+  if (preferredImageCount > 0) {
+    imageCount = preferredImageCount;
+    if (imageCount < swapChainSupport.capabilities.minImageCount) {
+      imageCount = swapChainSupport.capabilities.minImageCount;
+    }
+  }
 
   // so we don't go over the maximum
   if (swapChainSupport.capabilities.maxImageCount > 0 &&
@@ -181,7 +229,9 @@ void VkEngineSwapChain::createSwapChain() {
   // your application is running, for example because the window was resized. In
   // that case the swap chain actually needs to be recreated from scratch and a
   // reference to the old one must be specified in this field.
-  createInfo.oldSwapchain = VK_NULL_HANDLE;
+  // swapChain is still the retired one when recreating, VK_NULL_HANDLE the
+  // first time. The old one can keep presenting what was already queued
+  createInfo.oldSwapchain = swapChain;
 
   if (vkCreateSwapchainKHR(engineDevice.logicalDevice, &createInfo, nullptr,
                            &swapChain) != VK_SUCCESS) {
@@ -193,9 +243,127 @@ void VkEngineSwapChain::createSwapChain() {
   swapChainImages.resize(imageCount);
   vkGetSwapchainImagesKHR(engineDevice.logicalDevice, swapChain, &imageCount,
                           swapChainImages.data());
+  std::cout << "Swap chain: " << imageCount << " images, "
+            << presentModeName(presentMode) << " present mode\n";
+}
+
+void VkEngineSwapChain::retireSwapChain() {
+  // Copied out, the members are reused by the new swap chain straight away
+  VkDevice device = engineDevice.logicalDevice;
+  VkEngineAllocator *allocator = &engineDevice.allocator;
+  VkSwapchainKHR oldSwapChain = swapChain;
+  std::vector<VkImage> oldImages;
+  std::vector<VkEngineAllocation> oldImagesMemory;
+  if (engineDevice.headless) {
+    oldImages.swap(swapChainImages);
+    oldImagesMemory.swap(offscreenImagesMemory);
+  }
+  std::vector<VkImageView> oldImageViews;
+  oldImageViews.swap(swapChainImageViews);
+  std::vector<VkFramebuffer> oldFramebuffers;
+  oldFramebuffers.swap(swapChainFramebuffers);
+
+  engineDevice.deletionQueue.push([=]() mutable {
+    for (auto framebuffer : oldFramebuffers) {
+      vkDestroyFramebuffer(device, framebuffer, nullptr);
+    }
+    for (auto imageView : oldImageViews) {
+      vkDestroyImageView(device, imageView, nullptr);
+    }
+    for (size_t i = 0; i < oldImages.size(); i++) {
+      allocator->destroyImage(oldImages[i], oldImagesMemory[i]);
+    }
+    vkDestroySwapchainKHR(device, oldSwapChain, nullptr);
+  });
+
+  swapChainImages.clear();
+  // The images they guarded are gone, the fences themselves are waited on
+  // through their frame slots
+  imagesInFlight.clear();
+}
+
+void VkEngineSwapChain::createOffscreenImages() {
+  std::cout << "Creating Offscreen Images\n";
+
+  // Same size as the window would have been, one image per frame in flight so
+  // the CPU can record the next frame while earlier ones are still rendering
+  swapChainImageFormat = VK_FORMAT_R8G8B8A8_SRGB;
+  swapChainExtent = {static_cast<uint32_t>(engineDevice.vkWindow.width),
+                     static_cast<uint32_t>(engineDevice.vkWindow.height)};
+
+  swapChainImages.resize(VkEngineDevice::MAX_FRAMES_IN_FLIGHT);
+  offscreenImagesMemory.resize(VkEngineDevice::MAX_FRAMES_IN_FLIGHT);
+
+  for (size_t i = 0; i < swapChainImages.size(); i++) {
+    // TRANSFER_SRC so the results can be copied out for batch rendering
+    inputModel.createImage(
+        swapChainExtent.width, swapChainExtent.height, swapChainImageFormat,
+        VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, swapChainImages[i],
+        offscreenImagesMemory[i]);
+  }
+  nextOffscreenImage = 0;
+}
+
+void VkEngineSwapChain::destroyOffscreenImages() {
+  for (size_t i = 0; i < swapChainImages.size(); i++) {
+    engineDevice.allocator.destroyImage(swapChainImages[i],
+                                        offscreenImagesMemory[i]);
+  }
+  swapChainImages.clear();
+  offscreenImagesMemory.clear();
+}
+
+VkResult VkEngineSwapChain::acquireNextImage(uint32_t currentFrame,
+                                             uint32_t *imageIndex) {
+  if (engineDevice.headless) {
+    // No presentation engine to hand images back to us, just round robin.
+    // drawFrame still waits on imagesInFlight before reusing one
+    *imageIndex = nextOffscreenImage;
+    nextOffscreenImage = (nextOffscreenImage + 1) %
+                         static_cast<uint32_t>(swapChainImages.size());
+    return VK_SUCCESS;
+  }
+
+  return vkAcquireNextImageKHR(engineDevice.logicalDevice, swapChain,
+                               UINT64_MAX,
+                               imageAvailableSemaphore[currentFrame],
+                               VK_NULL_HANDLE, imageIndex);
+}
+
+VkResult VkEngineSwapChain::presentImage(uint32_t currentFrame,
+                                         uint32_t imageIndex) {
+  if (engineDevice.headless) {
+    return VK_SUCCESS;
+  }
+
+  VkPresentInfoKHR presentInfo{};
+  presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+
+  // which semaphore to wait on before presentation, same as the one the
+  // command buffer signals when it has finished
+  presentInfo.waitSemaphoreCount = 1;
+  presentInfo.pWaitSemaphores = &renderFinishedSemaphore[currentFrame];
+
+  // which swapChain to present images to and the index of the image for each
+  // swap chain
+  VkSwapchainKHR swapChains[] = {swapChain};
+  presentInfo.swapchainCount = 1;
+  presentInfo.pSwapchains = swapChains;
+  presentInfo.pImageIndices = &imageIndex;
+
+  // Allows you to specify array of VkResult values to check every individual
+  // swap chain not necessary for single swapchain, we can just check for reture
+  // value of present function
+  presentInfo.pResults = nullptr; // Optional
+
+  // submits request to present and image to the swap chain
+  return vkQueuePresentKHR(engineDevice.presentQueue, &presentInfo);
 }
 
-VkImageView VkEngineSwapChain::createImageView(VkImage image, VkFormat format) {
+VkImageView VkEngineSwapChain::createImageView(VkImage image, VkFormat format,
+                                               uint32_t mipLevels) {
   VkImageViewCreateInfo viewInfo{};
   viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
   viewInfo.image = image;
@@ -216,10 +384,10 @@ VkImageView VkEngineSwapChain::createImageView(VkImage image, VkFormat format) {
 
   // subresourceRange field describes what the image's purpose is and which
   // part of the image should be accessed. Our images will be used as color
-  // targets without any mipmapping levels or multiple layers.
+  // targets without multiple layers, textures see their whole mip chain.
   viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
   viewInfo.subresourceRange.baseMipLevel = 0;
-  viewInfo.subresourceRange.levelCount = 1;
+  viewInfo.subresourceRange.levelCount = mipLevels;
   viewInfo.subresourceRange.baseArrayLayer = 0;
   viewInfo.subresourceRange.layerCount = 1;
 
@@ -243,7 +411,8 @@ void VkEngineSwapChain::createImageViews() {
 
 void VkEngineSwapChain::createTextureImageView() {
   textureImageView =
-      createImageView(inputModel.textureImage, VK_FORMAT_R8G8B8A8_SRGB);
+      createImageView(inputModel.textureImage, inputModel.textureFormat,
+                      inputModel.textureMipLevels);
 }
 
 void VkEngineSwapChain::createRenderPass() {
@@ -256,7 +425,10 @@ void VkEngineSwapChain::createRenderPass() {
   colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
   colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
   colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  // Offscreen images are never presented, leave them ready to be copied out
+  colorAttachment.finalLayout = engineDevice.headless
+                                    ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                    : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
   VkAttachmentReference colorAttachmentRef{};
   colorAttachmentRef.attachment = 0;
@@ -376,7 +548,8 @@ void VkEngineSwapChain::createTextureSampler() {
   samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
   samplerInfo.mipLodBias = 0.0f;
   samplerInfo.minLod = 0.0f;
-  samplerInfo.maxLod = 0.0f;
+  // Trilinear: linear within a level and between the two nearest levels
+  samplerInfo.maxLod = static_cast<float>(inputModel.textureMipLevels);
 
   if (vkCreateSampler(engineDevice.logicalDevice, &samplerInfo, nullptr,
                       &textureSampler) != VK_SUCCESS) {
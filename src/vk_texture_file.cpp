@@ -0,0 +1,124 @@
+#include "vk_texture_file.hpp"
+
+namespace ve {
+
+VkFormat textureFileVkFormat(TextureFileFormat format) {
+  switch (format) {
+  case TextureFileFormat::BC1:
+    return VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+  case TextureFileFormat::BC3:
+    return VK_FORMAT_BC3_SRGB_BLOCK;
+  case TextureFileFormat::BC7:
+    return VK_FORMAT_BC7_SRGB_BLOCK;
+  default:
+    return VK_FORMAT_R8G8B8A8_SRGB;
+  }
+}
+
+uint32_t textureFileBlockSize(TextureFileFormat format) {
+  return format == TextureFileFormat::RGBA8 ? 1 : 4;
+}
+
+uint32_t textureFileBlockBytes(TextureFileFormat format) {
+  switch (format) {
+  case TextureFileFormat::BC1:
+    return 8;
+  case TextureFileFormat::BC3:
+  case TextureFileFormat::BC7:
+    return 16;
+  default:
+    return 4;
+  }
+}
+
+const char *textureFileFormatName(TextureFileFormat format) {
+  switch (format) {
+  case TextureFileFormat::BC1:
+    return "BC1";
+  case TextureFileFormat::BC3:
+    return "BC3";
+  case TextureFileFormat::BC7:
+    return "BC7";
+  default:
+    return "RGBA8";
+  }
+}
+
+uint64_t textureFileLevelSize(TextureFileFormat format, uint32_t width,
+                              uint32_t height) {
+  uint64_t blockSize = textureFileBlockSize(format);
+  uint64_t blocksWide = (width + blockSize - 1) / blockSize;
+  uint64_t blocksHigh = (height + blockSize - 1) / blockSize;
+  return blocksWide * blocksHigh * textureFileBlockBytes(format);
+}
+
+bool loadTextureFile(const std::string &filePath, TextureFile &texture) {
+  std::ifstream file{filePath, std::ios::binary | std::ios::ate};
+  if (!file.is_open()) {
+    return false;
+  }
+  uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+  file.seekg(0);
+
+  file.read(reinterpret_cast<char *>(&texture.header),
+            sizeof(texture.header));
+  const TextureFileHeader &header = texture.header;
+  if (!file || header.magic != TEXTURE_FILE_MAGIC ||
+      header.version != TEXTURE_FILE_VERSION ||
+      header.format > TextureFileFormat::BC7 || header.width == 0 ||
+      header.height == 0 || header.mipLevels == 0 ||
+      header.mipLevels > mipLevelCount(header.width, header.height)) {
+    return false;
+  }
+
+  texture.levels.resize(header.mipLevels);
+  file.read(reinterpret_cast<char *>(texture.levels.data()),
+            sizeof(TextureFileLevel) * header.mipLevels);
+  if (!file) {
+    return false;
+  }
+
+  // Everything after the level table. The entries are uploaded as is, so
+  // each has to be the next smaller mip, fully inside the file and exactly
+  // as big as its dimensions say
+  uint64_t tableEnd = static_cast<uint64_t>(file.tellg());
+  uint64_t dataSize = fileSize - tableEnd;
+  uint64_t end = 0;
+  for (uint32_t level = 0; level < header.mipLevels; level++) {
+    const TextureFileLevel &entry = texture.levels[level];
+    if (entry.width != std::max(1u, header.width >> level) ||
+        entry.height != std::max(1u, header.height >> level) ||
+        entry.size !=
+            textureFileLevelSize(header.format, entry.width, entry.height) ||
+        entry.offset > dataSize || entry.size > dataSize - entry.offset) {
+      return false;
+    }
+    end = std::max(end, entry.offset + entry.size);
+  }
+
+  texture.data.resize(static_cast<size_t>(end));
+  file.read(reinterpret_cast<char *>(texture.data.data()),
+            texture.data.size());
+
+  return static_cast<bool>(file);
+}
+
+void saveTextureFile(const std::string &filePath, const TextureFile &texture) {
+  std::ofstream file{filePath, std::ios::binary | std::ios::trunc};
+  if (!file.is_open()) {
+    throw std::runtime_error("failed to open " + filePath + " for writing");
+  }
+
+  file.write(reinterpret_cast<const char *>(&texture.header),
+             sizeof(texture.header));
+  file.write(reinterpret_cast<const char *>(texture.levels.data()),
+             sizeof(TextureFileLevel) * texture.levels.size());
+  file.write(reinterpret_cast<const char *>(texture.data.data()),
+             texture.data.size());
+
+  if (!file) {
+    throw std::runtime_error("failed to write " + filePath);
+  }
+}
+
+} // namespace ve
@@ -0,0 +1,116 @@
+#include "vk_thread_pool.hpp"
+
+namespace ve {
+
+VkEngineThreadPool::VkEngineThreadPool(uint32_t threadCount) {
+  if (threadCount == 0) {
+    uint32_t hardwareThreads = std::thread::hardware_concurrency();
+    threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+  }
+
+  for (uint32_t i = 0; i < threadCount; i++) {
+    workers.emplace_back(&VkEngineThreadPool::workerLoop, this);
+  }
+}
+
+VkEngineThreadPool::~VkEngineThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  workAvailable.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+uint32_t VkEngineThreadPool::workerCount() const {
+  return workers.empty() ? 1 : static_cast<uint32_t>(workers.size());
+}
+
+void VkEngineThreadPool::dispatch(uint32_t count, const Task &task) {
+  if (count == 0) {
+    return;
+  }
+  if (workers.empty()) {
+    for (uint32_t i = 0; i < count; i++) {
+      task(i);
+    }
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    job = &task;
+    taskCount = count;
+    nextTask = 0;
+    tasksFinished = 0;
+    generation++;
+  }
+  workAvailable.notify_all();
+
+  // Also wait for every worker to leave runTasks, otherwise one could still
+  // be about to read job when the next dispatch replaces it
+  std::unique_lock<std::mutex> lock(mutex);
+  workDone.wait(lock, [this] {
+    return tasksFinished == taskCount && activeWorkers == 0;
+  });
+  job = nullptr;
+
+  if (taskError) {
+    std::exception_ptr error = taskError;
+    taskError = nullptr;
+    std::rethrow_exception(error);
+  }
+}
+
+void VkEngineThreadPool::workerLoop() {
+  uint64_t seenGeneration = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      workAvailable.wait(lock, [&] {
+        return stopping || generation != seenGeneration;
+      });
+      if (stopping) {
+        return;
+      }
+      seenGeneration = generation;
+      // Woke up after the other workers already took every task, the
+      // dispatch may have returned already so job can't be touched
+      if (nextTask >= taskCount) {
+        continue;
+      }
+      activeWorkers++;
+    }
+
+    runTasks();
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      activeWorkers--;
+    }
+    workDone.notify_all();
+  }
+}
+
+void VkEngineThreadPool::runTasks() {
+  // Tasks are grabbed one at a time so uneven tasks still balance out
+  while (true) {
+    uint32_t task = nextTask.fetch_add(1);
+    if (task >= taskCount) {
+      return;
+    }
+    try {
+      (*job)(task);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!taskError) {
+        taskError = std::current_exception();
+      }
+    }
+    tasksFinished.fetch_add(1);
+  }
+}
+
+} // namespace ve
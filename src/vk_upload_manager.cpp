@@ -0,0 +1,458 @@
+#include "vk_upload_manager.hpp"
+
+namespace ve {
+
+VkEngineUploadManager::VkEngineUploadManager(VkEngineDevice &eDevice)
+    : engineDevice{eDevice}, stagingRing{eDevice.allocator} {
+  VkPhysicalDeviceProperties properties{};
+  vkGetPhysicalDeviceProperties(engineDevice.physicalDevice, &properties);
+  stagingAlignment = std::max(
+      stagingAlignment, properties.limits.optimalBufferCopyOffsetAlignment);
+  maxChunkSize = stagingRing.capacity / 4;
+
+  createCommandPools();
+  createTimelineSemaphore();
+}
+
+VkEngineUploadManager::~VkEngineUploadManager() {
+  std::cout << "Cleaning up VkEngineUploadManager, " << uploadsRecorded
+            << " uploads in " << batchesSubmitted << " batches, "
+            << stagingStalls << " staging stalls\n";
+
+  // Anything still recorded is never going to be used, but submit it so the
+  // command buffer gets released through the normal path
+  wait(flush());
+  collect();
+
+  vkDestroySemaphore(engineDevice.logicalDevice, timelineSemaphore, nullptr);
+  vkDestroyCommandPool(engineDevice.logicalDevice, commandPool, nullptr);
+  vkDestroyCommandPool(engineDevice.logicalDevice, graphicsCommandPool,
+                       nullptr);
+}
+
+void VkEngineUploadManager::createCommandPools() {
+  VkCommandPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  poolInfo.queueFamilyIndex = engineDevice.transferFamilyIndex;
+  // upload command buffers are short lived
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+  if (vkCreateCommandPool(engineDevice.logicalDevice, &poolInfo, nullptr,
+                          &commandPool) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create upload command pool!");
+  }
+
+  // Blits need a graphics queue, transfer queues can only copy
+  poolInfo.queueFamilyIndex = engineDevice.graphicsFamilyIndex;
+  if (vkCreateCommandPool(engineDevice.logicalDevice, &poolInfo, nullptr,
+                          &graphicsCommandPool) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create upload graphics command pool!");
+  }
+}
+
+void VkEngineUploadManager::createTimelineSemaphore() {
+  VkSemaphoreTypeCreateInfo typeInfo{};
+  typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+  typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  typeInfo.initialValue = 0;
+
+  VkSemaphoreCreateInfo semaphoreInfo{};
+  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  semaphoreInfo.pNext = &typeInfo;
+
+  if (vkCreateSemaphore(engineDevice.logicalDevice, &semaphoreInfo, nullptr,
+                        &timelineSemaphore) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create upload timeline semaphore!");
+  }
+}
+
+static VkCommandBuffer beginUploadCommandBuffer(VkDevice device,
+                                                VkCommandPool pool) {
+  VkCommandBufferAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandPool = pool;
+  allocInfo.commandBufferCount = 1;
+
+  VkCommandBuffer commandBuffer;
+  if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate upload command buffer!");
+  }
+
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+  vkBeginCommandBuffer(commandBuffer, &beginInfo);
+  return commandBuffer;
+}
+
+VkCommandBuffer VkEngineUploadManager::getRecordingCommandBuffer() {
+  if (recordingCommandBuffer == VK_NULL_HANDLE) {
+    recordingCommandBuffer =
+        beginUploadCommandBuffer(engineDevice.logicalDevice, commandPool);
+  }
+  return recordingCommandBuffer;
+}
+
+VkCommandBuffer VkEngineUploadManager::getRecordingGraphicsCommandBuffer() {
+  if (recordingGraphicsCommandBuffer == VK_NULL_HANDLE) {
+    recordingGraphicsCommandBuffer = beginUploadCommandBuffer(
+        engineDevice.logicalDevice, graphicsCommandPool);
+  }
+  return recordingGraphicsCommandBuffer;
+}
+
+VkDeviceSize VkEngineUploadManager::allocateStaging(VkDeviceSize size) {
+  VkDeviceSize offset = 0;
+  while (!stagingRing.allocate(size, stagingAlignment, offset)) {
+    // The ring is full of data the GPU hasn't copied yet. Submit what's
+    // recorded so it can make progress, then wait for the oldest batch
+    if (stagingRing.hasUnsubmitted()) {
+      flush();
+    }
+    if (inFlightBatches.empty()) {
+      throw std::runtime_error("upload doesn't fit in the staging ring!");
+    }
+    wait(inFlightBatches.front().signalValue);
+    collect();
+    stagingStalls++;
+  }
+  return offset;
+}
+
+void VkEngineUploadManager::uploadBuffer(const void *data, VkDeviceSize size,
+                                         VkBuffer dstBuffer,
+                                         VkDeviceSize dstOffset) {
+  const char *bytes = static_cast<const char *>(data);
+
+  for (VkDeviceSize copied = 0; copied < size;) {
+    VkDeviceSize chunkSize = std::min(size - copied, maxChunkSize);
+    VkDeviceSize stagingOffset = allocateStaging(chunkSize);
+    memcpy(stagingRing.mappedAt(stagingOffset), bytes + copied,
+           static_cast<size_t>(chunkSize));
+
+    // Fetched after allocateStaging since that may have flushed the batch
+    VkCommandBuffer commandBuffer = getRecordingCommandBuffer();
+
+    VkBufferCopy copyRegion{};
+    copyRegion.srcOffset = stagingOffset;
+    copyRegion.dstOffset = dstOffset + copied;
+    copyRegion.size = chunkSize;
+    vkCmdCopyBuffer(commandBuffer, stagingRing.buffer, dstBuffer, 1,
+                    &copyRegion);
+
+    copied += chunkSize;
+  }
+
+  uploadsRecorded++;
+}
+
+void VkEngineUploadManager::uploadImage(const void *data, VkDeviceSize size,
+                                        VkImage image, uint32_t width,
+                                        uint32_t height, uint32_t mipLevel,
+                                        uint32_t blockSize) {
+  // Copy in bands of whole rows (of blocks, for compressed formats) so big
+  // images don't need the whole ring. Barriers apply in submission order, so
+  // this still works if a band ends up in a later batch
+  const char *bytes = static_cast<const char *>(data);
+  uint32_t blockRows = (height + blockSize - 1) / blockSize;
+  VkDeviceSize rowSize = size / blockRows;
+  uint32_t rowsPerChunk =
+      static_cast<uint32_t>(std::max<VkDeviceSize>(1, maxChunkSize / rowSize));
+
+  // Bands have to start on a multiple of the transfer family's granularity,
+  // counted in blocks for compressed formats. The last band ends at the edge
+  // of the level, which is always allowed. (0,0,0) only allows whole levels,
+  // so those are never split
+  uint32_t granularity = engineDevice.transferImageGranularity.height;
+  if (granularity == 0) {
+    rowsPerChunk = blockRows;
+  } else {
+    rowsPerChunk =
+        std::max(granularity, rowsPerChunk / granularity * granularity);
+  }
+
+  for (uint32_t row = 0; row < blockRows; row += rowsPerChunk) {
+    uint32_t rows = std::min(rowsPerChunk, blockRows - row);
+    VkDeviceSize chunkSize = rowSize * rows;
+    VkDeviceSize stagingOffset = allocateStaging(chunkSize);
+    memcpy(stagingRing.mappedAt(stagingOffset), bytes + rowSize * row,
+           static_cast<size_t>(chunkSize));
+
+    VkCommandBuffer commandBuffer = getRecordingCommandBuffer();
+
+    VkBufferImageCopy region{};
+    region.bufferOffset = stagingOffset;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = mipLevel;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+
+    // The last band of a compressed image can end in a partial block
+    uint32_t texelRow = row * blockSize;
+    region.imageOffset = {0, static_cast<int32_t>(texelRow), 0};
+    region.imageExtent = {width, std::min(rows * blockSize, height - texelRow),
+                          1};
+
+    vkCmdCopyBufferToImage(commandBuffer, stagingRing.buffer, image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+  }
+
+  uploadsRecorded++;
+}
+
+void VkEngineUploadManager::transitionImageLayout(VkImage image,
+                                                  uint32_t baseMipLevel,
+                                                  uint32_t levelCount,
+                                                  VkImageLayout oldLayout,
+                                                  VkImageLayout newLayout) {
+  VkCommandBuffer commandBuffer = getRecordingCommandBuffer();
+
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.oldLayout = oldLayout;
+  barrier.newLayout = newLayout;
+
+  // The image is CONCURRENT when the transfer family is separate so no
+  // ownership transfer is needed
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+  barrier.image = image;
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.baseMipLevel = baseMipLevel;
+  barrier.subresourceRange.levelCount = levelCount;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = 1;
+
+  VkPipelineStageFlags sourceStage;
+  VkPipelineStageFlags destinationStage;
+
+  if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
+      newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL &&
+             newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+    // Transfer queues can't name the fragment shader stage, the timeline
+    // semaphore wait on the graphics queue makes the write visible to shaders
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+
+    sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    destinationStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+  } else {
+    throw std::invalid_argument("unsupported layout transition!");
+  }
+
+  vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0,
+                       nullptr, 0, nullptr, 1, &barrier);
+}
+
+void VkEngineUploadManager::generateMipmaps(VkImage image, uint32_t width,
+                                            uint32_t height,
+                                            uint32_t mipLevels) {
+  VkCommandBuffer commandBuffer = getRecordingGraphicsCommandBuffer();
+
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.image = image;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = 1;
+  barrier.subresourceRange.levelCount = 1;
+
+  int32_t mipWidth = static_cast<int32_t>(width);
+  int32_t mipHeight = static_cast<int32_t>(height);
+
+  // Each level is blitted down from the one before it. The source level goes
+  // TRANSFER_DST -> TRANSFER_SRC for the blit, then straight to shader read
+  // since nothing writes it again
+  for (uint32_t i = 1; i < mipLevels; i++) {
+    barrier.subresourceRange.baseMipLevel = i - 1;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                         nullptr, 1, &barrier);
+
+    VkImageBlit blit{};
+    blit.srcOffsets[0] = {0, 0, 0};
+    blit.srcOffsets[1] = {mipWidth, mipHeight, 1};
+    blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    blit.srcSubresource.mipLevel = i - 1;
+    blit.srcSubresource.baseArrayLayer = 0;
+    blit.srcSubresource.layerCount = 1;
+    blit.dstOffsets[0] = {0, 0, 0};
+    blit.dstOffsets[1] = {mipWidth > 1 ? mipWidth / 2 : 1,
+                          mipHeight > 1 ? mipHeight / 2 : 1, 1};
+    blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    blit.dstSubresource.mipLevel = i;
+    blit.dstSubresource.baseArrayLayer = 0;
+    blit.dstSubresource.layerCount = 1;
+
+    vkCmdBlitImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
+                   VK_FILTER_LINEAR);
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr,
+                         0, nullptr, 1, &barrier);
+
+    if (mipWidth > 1) {
+      mipWidth /= 2;
+    }
+    if (mipHeight > 1) {
+      mipHeight /= 2;
+    }
+  }
+
+  // The last level was only ever a blit destination
+  barrier.subresourceRange.baseMipLevel = mipLevels - 1;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+}
+
+uint64_t VkEngineUploadManager::submitBatch(VkQueue queue, VkCommandPool pool,
+                                            VkCommandBuffer commandBuffer) {
+  vkEndCommandBuffer(commandBuffer);
+
+  // A timeline has to be signaled in increasing order, but batches go to two
+  // queues that don't wait for each other. Waiting for the previous value
+  // keeps the next flush's transfer batch from signaling before this flush's
+  // mip batch, which collect() would take as the mip batch being done
+  uint64_t previousValue = nextSignalValue - 1;
+  uint64_t waitValue = previousValue > completedValue ? previousValue : 0;
+  uint64_t signalValue = nextSignalValue++;
+  VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+  VkTimelineSemaphoreSubmitInfo timelineInfo{};
+  timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+  timelineInfo.waitSemaphoreValueCount = waitValue > 0 ? 1 : 0;
+  timelineInfo.pWaitSemaphoreValues = &waitValue;
+  timelineInfo.signalSemaphoreValueCount = 1;
+  timelineInfo.pSignalSemaphoreValues = &signalValue;
+
+  VkSubmitInfo submitInfo{};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.pNext = &timelineInfo;
+  submitInfo.waitSemaphoreCount = waitValue > 0 ? 1 : 0;
+  submitInfo.pWaitSemaphores = &timelineSemaphore;
+  submitInfo.pWaitDstStageMask = &waitStage;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &commandBuffer;
+  submitInfo.signalSemaphoreCount = 1;
+  submitInfo.pSignalSemaphores = &timelineSemaphore;
+
+  if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+    throw std::runtime_error("failed to submit upload batch!");
+  }
+
+  inFlightBatches.push_back({commandBuffer, pool, signalValue});
+  batchesSubmitted++;
+  return signalValue;
+}
+
+uint64_t VkEngineUploadManager::flush() {
+  if (recordingCommandBuffer != VK_NULL_HANDLE) {
+    uint64_t signalValue = submitBatch(engineDevice.transferQueue,
+                                       commandPool, recordingCommandBuffer);
+    stagingRing.submit(signalValue);
+    recordingCommandBuffer = VK_NULL_HANDLE;
+  }
+
+  // Mip generation reads what the transfer batch above (or an earlier one)
+  // copied, submitBatch makes it wait for everything submitted so far
+  if (recordingGraphicsCommandBuffer != VK_NULL_HANDLE) {
+    submitBatch(engineDevice.graphicsQueue, graphicsCommandPool,
+                recordingGraphicsCommandBuffer);
+    recordingGraphicsCommandBuffer = VK_NULL_HANDLE;
+  }
+
+  return nextSignalValue - 1;
+}
+
+bool VkEngineUploadManager::isComplete(uint64_t value) {
+  if (value <= completedValue) {
+    return true;
+  }
+  vkGetSemaphoreCounterValue(engineDevice.logicalDevice, timelineSemaphore,
+                             &completedValue);
+  return value <= completedValue;
+}
+
+void VkEngineUploadManager::wait(uint64_t value) {
+  if (isComplete(value)) {
+    return;
+  }
+
+  VkSemaphoreWaitInfo waitInfo{};
+  waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+  waitInfo.semaphoreCount = 1;
+  waitInfo.pSemaphores = &timelineSemaphore;
+  waitInfo.pValues = &value;
+
+  vkWaitSemaphores(engineDevice.logicalDevice, &waitInfo, UINT64_MAX);
+  completedValue = std::max(completedValue, value);
+}
+
+void VkEngineUploadManager::collect() {
+
+  // Batches finish in submission order, stop at the first one still running
+  size_t finished = 0;
+  while (finished < inFlightBatches.size() &&
+         isComplete(inFlightBatches[finished].signalValue)) {
+    vkFreeCommandBuffers(engineDevice.logicalDevice,
+                         inFlightBatches[finished].commandPool, 1,
+                         &inFlightBatches[finished].commandBuffer);
+    finished++;
+  }
+  inFlightBatches.erase(inFlightBatches.begin(),
+                        inFlightBatches.begin() + finished);
+
+  stagingRing.reclaim(completedValue);
+}
+
+void VkEngineUploadManager::appendWait(
+    std::vector<VkSemaphore> &waitSemaphores,
+    std::vector<VkPipelineStageFlags> &waitStages,
+    std::vector<uint64_t> &waitValues) {
+  uint64_t lastSubmitted = nextSignalValue - 1;
+  if (isComplete(lastSubmitted)) {
+    return;
+  }
+
+  // Uploaded data is read as vertex/index input, sampled in shaders and read
+  // by the culling compute shader
+  waitSemaphores.push_back(timelineSemaphore);
+  waitStages.push_back(VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+                       VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+  waitValues.push_back(lastSubmitted);
+}
+
+} // namespace ve
@@ -4,17 +4,24 @@ int boyopoo = 1;
 int boyopoo2;
 // extern int boyopoo3;
 namespace ve {
-VkWindow::VkWindow(int w, int h, std::string name) {
+VkWindow::VkWindow(int w, int h, std::string name, bool isHeadless) {
   width = w;
   height = h;
   windowName = name;
-  initWindow();
+  headless = isHeadless;
+  window = nullptr;
+  if (!headless) {
+    initWindow();
+  }
   std::cout << "Started VKWindow\n";
 }
 
 VkWindow::~VkWindow() {
 
   std::cout << "Cleaning up vkWindow Init\n";
+  if (headless) {
+    return;
+  }
   glfwDestroyWindow(window);
   glfwTerminate();
 }
@@ -27,5 +34,12 @@ void VkWindow::initWindow() {
       glfwCreateWindow(width, height, windowName.c_str(), nullptr, nullptr);
 }
 
-bool VkWindow::shouldClose() { return glfwWindowShouldClose(window); }
+bool VkWindow::shouldClose() {
+  // Nothing can close a window that doesn't exist, the app decides when a
+  // headless run is done
+  if (headless) {
+    return false;
+  }
+  return glfwWindowShouldClose(window);
+}
 } // namespace ve
\ No newline at end of file
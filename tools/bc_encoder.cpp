@@ -0,0 +1,334 @@
+#include "bc_encoder.hpp"
+
+namespace ve {
+
+// Per channel min/max over the 16 texels of a block
+static void blockBounds(const uint8_t *block, uint8_t minColor[4],
+                        uint8_t maxColor[4]) {
+#ifdef VE_BC_ENCODER_SSE2
+  __m128i row0 = _mm_loadu_si128((const __m128i *)(block));
+  __m128i row1 = _mm_loadu_si128((const __m128i *)(block + 16));
+  __m128i row2 = _mm_loadu_si128((const __m128i *)(block + 32));
+  __m128i row3 = _mm_loadu_si128((const __m128i *)(block + 48));
+
+  __m128i lo = _mm_min_epu8(_mm_min_epu8(row0, row1), _mm_min_epu8(row2, row3));
+  __m128i hi = _mm_max_epu8(_mm_max_epu8(row0, row1), _mm_max_epu8(row2, row3));
+
+  // Fold the 4 texels in each register down to 1
+  lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 8));
+  lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 4));
+  hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 8));
+  hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 4));
+
+  uint32_t loBits = static_cast<uint32_t>(_mm_cvtsi128_si32(lo));
+  uint32_t hiBits = static_cast<uint32_t>(_mm_cvtsi128_si32(hi));
+  memcpy(minColor, &loBits, 4);
+  memcpy(maxColor, &hiBits, 4);
+#else
+  for (int c = 0; c < 4; c++) {
+    minColor[c] = 255;
+    maxColor[c] = 0;
+  }
+  for (int i = 0; i < 16; i++) {
+    for (int c = 0; c < 4; c++) {
+      minColor[c] = std::min(minColor[c], block[4 * i + c]);
+      maxColor[c] = std::max(maxColor[c], block[4 * i + c]);
+    }
+  }
+#endif
+}
+
+// The bounding box diagonal from min to max only fits colours where every
+// channel rises together. Swap min/max of any channel (alpha included) that
+// runs against green so the endpoints follow the real trend
+static void selectDiagonal(const uint8_t *block, int channels,
+                           uint8_t minColor[4], uint8_t maxColor[4]) {
+  int mean[4] = {0, 0, 0, 0};
+  for (int i = 0; i < 16; i++) {
+    for (int c = 0; c < channels; c++) {
+      mean[c] += block[4 * i + c];
+    }
+  }
+  for (int c = 0; c < channels; c++) {
+    mean[c] = (mean[c] + 8) / 16;
+  }
+
+  int covariance[4] = {0, 0, 0, 0};
+  for (int i = 0; i < 16; i++) {
+    int g = block[4 * i + 1] - mean[1];
+    for (int c = 0; c < channels; c++) {
+      covariance[c] += (block[4 * i + c] - mean[c]) * g;
+    }
+  }
+  for (int c = 0; c < channels; c++) {
+    if (c != 1 && covariance[c] < 0) {
+      std::swap(minColor[c], maxColor[c]);
+    }
+  }
+}
+
+static uint16_t to565(const uint8_t color[4]) {
+  return static_cast<uint16_t>(((color[0] * 31 + 127) / 255) << 11 |
+                               ((color[1] * 63 + 127) / 255) << 5 |
+                               ((color[2] * 31 + 127) / 255));
+}
+
+static void from565(uint16_t packed, int color[3]) {
+  int r = (packed >> 11) & 31;
+  int g = (packed >> 5) & 63;
+  int b = packed & 31;
+  color[0] = (r << 3) | (r >> 2);
+  color[1] = (g << 2) | (g >> 4);
+  color[2] = (b << 3) | (b >> 2);
+}
+
+// 8 byte BC1 colour block, always in 4 colour mode
+static void encodeColorBlock(const uint8_t *block, uint8_t *out) {
+  uint8_t minColor[4];
+  uint8_t maxColor[4];
+  blockBounds(block, minColor, maxColor);
+  selectDiagonal(block, 3, minColor, maxColor);
+
+  // Pull the endpoints in by 1/16 of the range, the extremes are rarely hit
+  // exactly so this lowers the average error
+  for (int c = 0; c < 3; c++) {
+    int inset = (maxColor[c] - minColor[c]) / 16;
+    maxColor[c] = static_cast<uint8_t>(maxColor[c] - inset);
+    minColor[c] = static_cast<uint8_t>(minColor[c] + inset);
+  }
+
+  uint16_t color0 = to565(maxColor);
+  uint16_t color1 = to565(minColor);
+  uint32_t indices = 0;
+
+  if (color0 != color1) {
+    // color0 > color1 selects 4 colour mode, indices are picked against the
+    // palette after the swap so nothing else needs fixing up
+    if (color0 < color1) {
+      std::swap(color0, color1);
+    }
+
+    int palette[4][3];
+    from565(color0, palette[0]);
+    from565(color1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    for (int i = 0; i < 16; i++) {
+      int best = 0;
+      int bestError = INT32_MAX;
+      for (int p = 0; p < 4; p++) {
+        int error = 0;
+        for (int c = 0; c < 3; c++) {
+          int d = block[4 * i + c] - palette[p][c];
+          error += d * d;
+        }
+        if (error < bestError) {
+          bestError = error;
+          best = p;
+        }
+      }
+      indices |= static_cast<uint32_t>(best) << (2 * i);
+    }
+  }
+
+  memcpy(out, &color0, 2);
+  memcpy(out + 2, &color1, 2);
+  memcpy(out + 4, &indices, 4);
+}
+
+void encodeBC1Block(const uint8_t *block, uint8_t *out) {
+  encodeColorBlock(block, out);
+}
+
+void encodeBC3Block(const uint8_t *block, uint8_t *out) {
+  uint8_t minColor[4];
+  uint8_t maxColor[4];
+  blockBounds(block, minColor, maxColor);
+
+  // alpha0 > alpha1 selects the 8 value mode
+  int alpha0 = maxColor[3];
+  int alpha1 = minColor[3];
+  int palette[8] = {alpha0, alpha1};
+  for (int i = 1; i < 7; i++) {
+    palette[i + 1] = ((7 - i) * alpha0 + i * alpha1) / 7;
+  }
+
+  uint64_t indices = 0;
+  if (alpha0 != alpha1) {
+    for (int i = 0; i < 16; i++) {
+      int best = 0;
+      int bestError = INT32_MAX;
+      for (int p = 0; p < 8; p++) {
+        int error = std::abs(block[4 * i + 3] - palette[p]);
+        if (error < bestError) {
+          bestError = error;
+          best = p;
+        }
+      }
+      indices |= static_cast<uint64_t>(best) << (3 * i);
+    }
+  }
+
+  out[0] = static_cast<uint8_t>(alpha0);
+  out[1] = static_cast<uint8_t>(alpha1);
+  for (int i = 0; i < 6; i++) {
+    out[2 + i] = static_cast<uint8_t>(indices >> (8 * i));
+  }
+
+  encodeColorBlock(block, out + 8);
+}
+
+// Writes fields least significant bit first, the way BC7 blocks are laid out
+struct BitWriter {
+  uint64_t bits[2] = {0, 0};
+  uint32_t position = 0;
+
+  void write(uint32_t value, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++, position++) {
+      if (value & (1u << i)) {
+        bits[position / 64] |= 1ull << (position % 64);
+      }
+    }
+  }
+};
+
+static const int BC7_WEIGHTS4[16] = {0,  4,  9,  13, 17, 21, 26, 30,
+                                     34, 38, 43, 47, 51, 55, 60, 64};
+
+void encodeBC7Block(const uint8_t *block, uint8_t *out) {
+  uint8_t endpoints[2][4];
+  blockBounds(block, endpoints[0], endpoints[1]);
+  selectDiagonal(block, 4, endpoints[0], endpoints[1]);
+
+  // Mode 6 endpoints are 7 bits per channel plus one p-bit shared by all
+  // channels of the endpoint. Pick the p-bit that reconstructs best
+  int quantized[2][4];
+  int pBits[2];
+  int decoded[2][4];
+  for (int e = 0; e < 2; e++) {
+    int bestError = INT32_MAX;
+    for (int p = 0; p < 2; p++) {
+      int error = 0;
+      int candidate[4];
+      for (int c = 0; c < 4; c++) {
+        candidate[c] =
+            std::min(127, std::max(0, (endpoints[e][c] - p + 1) >> 1));
+        int d = endpoints[e][c] - ((candidate[c] << 1) | p);
+        error += d * d;
+      }
+      if (error < bestError) {
+        bestError = error;
+        pBits[e] = p;
+        for (int c = 0; c < 4; c++) {
+          quantized[e][c] = candidate[c];
+          decoded[e][c] = (candidate[c] << 1) | p;
+        }
+      }
+    }
+  }
+
+  int palette[16][4];
+  for (int w = 0; w < 16; w++) {
+    for (int c = 0; c < 4; c++) {
+      palette[w][c] = ((64 - BC7_WEIGHTS4[w]) * decoded[0][c] +
+                       BC7_WEIGHTS4[w] * decoded[1][c] + 32) >>
+                      6;
+    }
+  }
+
+  int indices[16];
+  for (int i = 0; i < 16; i++) {
+    int bestError = INT32_MAX;
+    for (int w = 0; w < 16; w++) {
+      int error = 0;
+      for (int c = 0; c < 4; c++) {
+        int d = block[4 * i + c] - palette[w][c];
+        error += d * d;
+      }
+      if (error < bestError) {
+        bestError = error;
+        indices[i] = w;
+      }
+    }
+  }
+
+  // The first index is stored with its top bit implied 0, flip the
+  // endpoints if it needs it
+  if (indices[0] & 8) {
+    for (int c = 0; c < 4; c++) {
+      std::swap(quantized[0][c], quantized[1][c]);
+    }
+    std::swap(pBits[0], pBits[1]);
+    for (int i = 0; i < 16; i++) {
+      indices[i] = 15 - indices[i];
+    }
+  }
+
+  BitWriter writer;
+  writer.write(1u << 6, 7); // mode 6
+  for (int c = 0; c < 4; c++) {
+    writer.write(quantized[0][c], 7);
+    writer.write(quantized[1][c], 7);
+  }
+  writer.write(pBits[0], 1);
+  writer.write(pBits[1], 1);
+  writer.write(indices[0], 3);
+  for (int i = 1; i < 16; i++) {
+    writer.write(indices[i], 4);
+  }
+
+  memcpy(out, writer.bits, 16);
+}
+
+std::vector<uint8_t> encodeImage(const uint8_t *rgba, uint32_t width,
+                                 uint32_t height, TextureFileFormat format,
+                                 uint32_t threadCount) {
+  uint32_t blocksWide = (width + 3) / 4;
+  uint32_t blocksHigh = (height + 3) / 4;
+  uint32_t blockBytes = textureFileBlockBytes(format);
+  std::vector<uint8_t> encoded(static_cast<size_t>(blocksWide) * blocksHigh *
+                               blockBytes);
+
+  void (*encodeBlock)(const uint8_t *, uint8_t *) = encodeBC7Block;
+  if (format == TextureFileFormat::BC1) {
+    encodeBlock = encodeBC1Block;
+  } else if (format == TextureFileFormat::BC3) {
+    encodeBlock = encodeBC3Block;
+  }
+
+  // Threads grab the next unencoded row of blocks until none are left
+  std::atomic<uint32_t> nextBlockRow{0};
+  auto worker = [&]() {
+    uint8_t block[64];
+    for (uint32_t by = nextBlockRow++; by < blocksHigh; by = nextBlockRow++) {
+      for (uint32_t bx = 0; bx < blocksWide; bx++) {
+        for (uint32_t y = 0; y < 4; y++) {
+          uint32_t srcY = std::min(by * 4 + y, height - 1);
+          for (uint32_t x = 0; x < 4; x++) {
+            uint32_t srcX = std::min(bx * 4 + x, width - 1);
+            memcpy(block + 16 * y + 4 * x,
+                   rgba + (static_cast<size_t>(srcY) * width + srcX) * 4, 4);
+          }
+        }
+        encodeBlock(block, encoded.data() +
+                               (static_cast<size_t>(by) * blocksWide + bx) *
+                                   blockBytes);
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (uint32_t i = 1; i < threadCount; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  return encoded;
+}
+
+} // namespace ve
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "vk_texture_file.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define VE_BC_ENCODER_SSE2 1
+#endif
+
+namespace ve {
+
+// Block encoders, block is 4x4 RGBA8 texels in row order (64 bytes)
+void encodeBC1Block(const uint8_t *block, uint8_t *out);
+void encodeBC3Block(const uint8_t *block, uint8_t *out);
+// Mode 6 only: one subset, RGBA endpoints with per endpoint p-bits and 4 bit
+// indices. Handles most colour/alpha content well and is the cheapest mode to
+// search
+void encodeBC7Block(const uint8_t *block, uint8_t *out);
+
+// Encodes a whole level, rows of blocks are shared out between threadCount
+// threads. Edges of sizes that aren't a multiple of 4 repeat the last texel
+std::vector<uint8_t> encodeImage(const uint8_t *rgba, uint32_t width,
+                                 uint32_t height, TextureFileFormat format,
+                                 uint32_t threadCount);
+
+} // namespace ve
@@ -0,0 +1,121 @@
+// Offline texture cooker, turns a jpg/png into a mipmapped, block compressed
+// .vtex the engine can upload without any processing
+//
+// texture_cooker <input image> <output.vtex> [--format bc1|bc3|bc7|rgba8]
+//                [--threads <count>]
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include "bc_encoder.hpp"
+#include "vk_mipmap.hpp"
+#include "vk_texture_file.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+static bool parseFormat(const std::string &name,
+                        ve::TextureFileFormat &format) {
+  if (name == "bc1") {
+    format = ve::TextureFileFormat::BC1;
+  } else if (name == "bc3") {
+    format = ve::TextureFileFormat::BC3;
+  } else if (name == "bc7") {
+    format = ve::TextureFileFormat::BC7;
+  } else if (name == "rgba8") {
+    format = ve::TextureFileFormat::RGBA8;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    std::cerr << "usage: texture_cooker <input image> <output.vtex> "
+                 "[--format bc1|bc3|bc7|rgba8] [--threads <count>]\n";
+    return EXIT_FAILURE;
+  }
+
+  std::string inputPath = argv[1];
+  std::string outputPath = argv[2];
+  ve::TextureFileFormat format = ve::TextureFileFormat::BC7;
+  uint32_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+  for (int i = 3; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--format" && i + 1 < argc) {
+      if (!parseFormat(argv[++i], format)) {
+        std::cerr << "Unknown format: " << argv[i] << "\n";
+        return EXIT_FAILURE;
+      }
+    } else if (arg == "--threads" && i + 1 < argc) {
+      threadCount = std::max(1, std::stoi(argv[++i]));
+    } else {
+      std::cerr << "Unknown argument: " << arg << "\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  int width, height, channels;
+  stbi_uc *pixels = stbi_load(inputPath.c_str(), &width, &height, &channels,
+                              STBI_rgb_alpha);
+  if (!pixels) {
+    std::cerr << "failed to load " << inputPath << "\n";
+    return EXIT_FAILURE;
+  }
+
+  auto startTime = std::chrono::high_resolution_clock::now();
+
+  // Mips are filtered from the uncompressed data, then each one is encoded
+  std::vector<ve::MipLevel> mipChain = ve::generateMipChainCpu(
+      pixels, static_cast<uint32_t>(width), static_cast<uint32_t>(height));
+
+  ve::TextureFile texture{};
+  texture.header.format = format;
+  texture.header.width = static_cast<uint32_t>(width);
+  texture.header.height = static_cast<uint32_t>(height);
+  texture.header.mipLevels = static_cast<uint32_t>(mipChain.size() + 1);
+
+  uint64_t uncompressedSize = 0;
+  for (uint32_t level = 0; level < texture.header.mipLevels; level++) {
+    const uint8_t *levelPixels =
+        level == 0 ? pixels : mipChain[level - 1].pixels.data();
+    uint32_t levelWidth =
+        level == 0 ? texture.header.width : mipChain[level - 1].width;
+    uint32_t levelHeight =
+        level == 0 ? texture.header.height : mipChain[level - 1].height;
+
+    std::vector<uint8_t> encoded;
+    if (format == ve::TextureFileFormat::RGBA8) {
+      encoded.assign(levelPixels,
+                     levelPixels + static_cast<size_t>(levelWidth) *
+                                       levelHeight * 4);
+    } else {
+      encoded = ve::encodeImage(levelPixels, levelWidth, levelHeight, format,
+                                threadCount);
+    }
+
+    texture.levels.push_back({texture.data.size(), encoded.size(),
+                              levelWidth, levelHeight});
+    texture.data.insert(texture.data.end(), encoded.begin(), encoded.end());
+    uncompressedSize += static_cast<uint64_t>(levelWidth) * levelHeight * 4;
+  }
+  stbi_image_free(pixels);
+
+  double seconds =
+      std::chrono::duration<double, std::chrono::seconds::period>(
+          std::chrono::high_resolution_clock::now() - startTime)
+          .count();
+
+  ve::saveTextureFile(outputPath, texture);
+
+  std::cout << outputPath << ": " << width << "x" << height << " "
+            << ve::textureFileFormatName(format) << ", "
+            << texture.header.mipLevels << " levels, "
+            << texture.data.size() / 1024 << " KB (RGBA8 would be "
+            << uncompressedSize / 1024 << " KB), encoded in " << seconds
+            << "s on " << threadCount << " threads\n";
+  return EXIT_SUCCESS;
+}